@@ -0,0 +1,139 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+// Throughput of block algorithms of entries file (see EntryBlockCipher):
+// - vault: records packed into ENTRIES_CHUNK_SIZE blocks, sealed in order then opened on the thread pool;
+// - attachment: a single large block, sealed and opened on one thread.
+// Usage: pwm_blockcipher_bench [vault MiB] [attachment MiB]
+
+#include "pwmblockcipher.h"
+
+#include <QElapsedTimer>
+#include <QThread>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+/**
+ * @brief Header of an entries file sealed with given algorithm.
+ */
+static pwm::EntriesHeader benchHeader(const quint8 algorithm)
+{
+    pwm::EntriesHeader header;
+    header.version = ENTRIES_VERSION;
+    header.algorithm = algorithm;
+    memcpy(header.bytes, ENTRIES_MAGIC, ENTRIES_MAGICBYTES);
+    header.bytes[4] = ENTRIES_VERSION;
+    header.bytes[5] = algorithm;
+    randombytes_buf(header.streamHeader, sizeof header.streamHeader);
+    return header;
+}
+
+/**
+ * @return Throughput (MiB/s) of [bytes] processed in [ns].
+ */
+static double throughput(const size_t bytes, const qint64 ns)
+{
+    return (ns > 0) ? (bytes / 1048576.0) / (ns / 1e9) : 0.0;
+}
+
+/**
+ * @brief Seal [size] bytes as blocks of [blockSize] bytes, then open them sequentially and on the thread pool.
+ * @return 0 if every block was opened; -1 otherwise.
+ */
+static int benchBlocks(const char *label, const pwm::SessionKey &key, const quint8 algorithm, const size_t size, const size_t blockSize)
+{
+    const pwm::EntriesHeader header = benchHeader(algorithm);
+    pwm::EntryBlockCipher sealer(key, header);
+    pwm::EntryBlockCipher opener(key, header);
+    if (!sealer.isValid() || !opener.isValid()) return -1;
+
+    const size_t nbBlocks = (size + blockSize - 1) / blockSize;
+    std::vector<unsigned char> plain(size);
+    std::vector<unsigned char> cipher(size + nbBlocks * BLOCK_ABYTES);
+    std::vector<quint64> indexes(nbBlocks);
+    randombytes_buf(plain.data(), plain.size());
+
+    QElapsedTimer timer;
+    timer.start();
+    for (size_t block = 0 ; block < nbBlocks ; ++block)
+    {
+        const size_t length = std::min(blockSize, size - block * blockSize);
+        if (sealer.seal(cipher.data() + block * (blockSize + BLOCK_ABYTES), plain.data() + block * blockSize, length) != 0) return -1;
+        indexes[block] = block;
+    }
+    const qint64 sealNs = timer.nsecsElapsed();
+
+    // Opens block at given index; status is kept to check authenticity after timing
+    std::vector<int> failed(nbBlocks, 0);
+    const auto openBlock = [&](const quint64 &block) {
+        const size_t length = std::min<size_t>(blockSize, size - block * blockSize);
+        failed[block] = opener.open(plain.data() + block * blockSize, cipher.data() + block * (blockSize + BLOCK_ABYTES), length + BLOCK_ABYTES, block);
+    };
+
+    timer.restart();
+    for (const quint64 &block : indexes) openBlock(block);
+    const qint64 openNs = timer.nsecsElapsed();
+
+    timer.restart();
+    QtConcurrent::blockingMap(indexes, openBlock);
+    const qint64 parallelOpenNs = timer.nsecsElapsed();
+
+    for (const int status : failed)
+    {
+        if (status != 0) return -1;
+    }
+
+    printf("%-20s %-10s %8zu MiB %8zu blocks  seal %9.1f MiB/s  open %9.1f MiB/s  parallel open %9.1f MiB/s\n",
+           pwm::blockAlgorithmName(algorithm), label, size >> 20, nbBlocks,
+           throughput(size, sealNs), throughput(size, openNs), throughput(size, parallelOpenNs));
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (sodium_init() == -1) return 1;
+
+    const size_t vaultMiB = (argc > 1) ? strtoul(argv[1], NULL, 10) : 256;
+    const size_t attachmentMiB = (argc > 2) ? strtoul(argv[2], NULL, 10) : 64;
+    if (vaultMiB == 0 || attachmentMiB == 0)
+    {
+        fprintf(stderr, "Usage: %s [vault MiB] [attachment MiB]\n", argv[0]);
+        return 1;
+    }
+
+    // Cheapest derivation: only the data key matters here
+    pwm::CryptoParams params;
+    randombytes_buf(params.salt, sizeof params.salt);
+    params.opslimit = crypto_pwhash_OPSLIMIT_MIN;
+    params.memlimit = crypto_pwhash_MEMLIMIT_MIN;
+    params.alg = crypto_pwhash_ALG_ARGON2ID13;
+
+    pwm::SessionKey key;
+    if (key.derive("benchmark", params) != 0 || key.generateDataKey() != 0) return 1;
+
+    printf("%d threads, preferred algorithm: %s\n", QThread::idealThreadCount(),
+           pwm::blockAlgorithmName(pwm::preferredBlockAlgorithm()));
+
+    int returnValue = 0;
+    for (const quint8 algorithm : {pwm::BLOCK_XCHACHA20POLY1305, pwm::BLOCK_AES256GCM})
+    {
+        if (!pwm::blockAlgorithmAvailable(algorithm))
+        {
+            printf("%-20s not available on this processor\n", pwm::blockAlgorithmName(algorithm));
+            continue;
+        }
+
+        if (benchBlocks("vault", key, algorithm, vaultMiB << 20, ENTRIES_CHUNK_SIZE) != 0
+            || benchBlocks("attachment", key, algorithm, attachmentMiB << 20, attachmentMiB << 20) != 0)
+        {
+            fprintf(stderr, "%s: failed to open sealed blocks\n", pwm::blockAlgorithmName(algorithm));
+            returnValue = 1;
+        }
+    }
+
+    return returnValue;
+}
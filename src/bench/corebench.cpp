@@ -0,0 +1,578 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+// Hot paths of the core library, as JSON for comparison between releases:
+// - password generation, one at a time (generatePassword()) and in batch (generatePasswords());
+// - key derivation (generateSecretKey()) at several opslimit/memlimit settings;
+// - entries file writing and reading (writeEntries(), readEntries()) at several numbers of entries,
+//   with entries file out of page cache (cold open) and peak resident set size of a read (Linux only),
+//   size of password segment, which is not decrypted at unlock, and opening of a single password;
+// - fuzzy search of entry and user names (FuzzySearch), compared with the linear scan it replaced;
+// - record serialization and parsing (EntryRecord).
+// Randomness is deterministic unless --random is given, so that every run draws the same keys,
+// salts and passwords: never use this mode with a real vault.
+// Usage: pwm_core_bench [--max-entries N] [--min-time MS] [--seed N | --random] [--output FILE]
+
+#include "pwmsecurity.h"
+#include "pwmblockcipher.h"
+#include "pwmsealedpassword.h"
+#include "pwmpasswordgenerator.h"
+#include "pwmrecord.h"
+#include "pwmfuzzysearch.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QtEndian>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Entries are generated by batches of this size, so that passwords of a batch fit in PASSWORD_MAXBATCH characters
+#define BENCH_ENTRY_BATCH 65536
+// Records serialized or parsed by each iteration
+#define BENCH_RECORDS 1000
+// Entries searched by fuzzy search, and results kept, as many as the entry table shows (ENTRYTABLE_MAXRESULTS)
+#define BENCH_SEARCH_ENTRIES 100000
+#define BENCH_SEARCH_RESULTS 1000
+
+
+static unsigned char randomSeed[randombytes_SEEDBYTES];
+static std::atomic<quint64> randomCalls{0};
+
+static const char *deterministicName()
+{
+    return "pwm_bench_deterministic";
+}
+
+/**
+ * @brief Deterministic replacement of randombytes_buf(): each call draws from its own seed,
+ * made of the call number and the seed given on command line.
+ */
+static void deterministicBuf(void *const buffer, const size_t size)
+{
+    unsigned char seed[randombytes_SEEDBYTES];
+    memcpy(seed, randomSeed, sizeof seed);
+    qToLittleEndian<quint64>(randomCalls.fetch_add(1), seed);
+    randombytes_buf_deterministic(buffer, size, seed);
+}
+
+static uint32_t deterministicRandom()
+{
+    uint32_t value;
+    deterministicBuf(&value, sizeof value);
+    return value;
+}
+
+// randombytes_uniform() falls back on random() when uniform is not given
+static randombytes_implementation deterministicImplementation = {
+    deterministicName, deterministicRandom, NULL, NULL, deterministicBuf, NULL
+};
+
+/**
+ * @brief Restart deterministic sequence, so that inputs of a benchmark do not depend on the ones run before.
+ */
+static void resetRandom()
+{
+    randomCalls = 0;
+}
+
+static qint64 minTimeNs = 500 * 1000000LL;
+
+/**
+ * @brief Run [function] until it has run for at least [minTimeNs], and append its timing to [results].
+ * @param items: Items (passwords, keys, entries, records) processed by each call.
+ * @param bytes: Bytes processed by each call; 0 if not relevant.
+ * @return 0 if every call succeeded; -1 otherwise.
+ */
+template <typename Function>
+static int measure(QJsonArray &results, const QString &name, const double items, const double bytes, Function function)
+{
+    fprintf(stderr, "%s...\n", qPrintable(name));
+
+    QElapsedTimer timer;
+    qint64 iterations = 0;
+    timer.start();
+    do
+    {
+        if (function() != 0)
+        {
+            fprintf(stderr, "%s failed.\n", qPrintable(name));
+            return -1;
+        }
+        ++iterations;
+    } while (timer.nsecsElapsed() < minTimeNs);
+    const double ns = static_cast<double>(timer.nsecsElapsed()) / iterations;
+
+    QJsonObject result;
+    result["name"] = name;
+    result["iterations"] = iterations;
+    result["real_time_ns"] = ns;
+    result["items_per_second"] = items * 1e9 / ns;
+    if (bytes > 0) result["bytes_per_second"] = bytes * 1e9 / ns;
+    results.append(result);
+    return 0;
+}
+
+/**
+ * @brief Same as measure(), but only [function] is timed: [setup] runs before each call, untimed.
+ */
+template <typename Setup, typename Function>
+static int measureEach(QJsonArray &results, const QString &name, const double items, const double bytes, Setup setup, Function function)
+{
+    fprintf(stderr, "%s...\n", qPrintable(name));
+
+    QElapsedTimer timer;
+    qint64 elapsed = 0;
+    qint64 iterations = 0;
+    do
+    {
+        if (setup() != 0) return -1;
+        timer.start();
+        const int status = function();
+        elapsed += timer.nsecsElapsed();
+        if (status != 0)
+        {
+            fprintf(stderr, "%s failed.\n", qPrintable(name));
+            return -1;
+        }
+        ++iterations;
+    } while (elapsed < minTimeNs);
+    const double ns = static_cast<double>(elapsed) / iterations;
+
+    QJsonObject result;
+    result["name"] = name;
+    result["iterations"] = iterations;
+    result["real_time_ns"] = ns;
+    result["items_per_second"] = items * 1e9 / ns;
+    if (bytes > 0) result["bytes_per_second"] = bytes * 1e9 / ns;
+    results.append(result);
+    return 0;
+}
+
+/**
+ * @brief Drop pages of entries file from page cache, so that next read of it starts cold.
+ * @return 0 if pages were dropped; -1 otherwise (only available on Linux).
+ */
+static int dropEntriesCache()
+{
+#ifdef Q_OS_LINUX
+    const int file = open("entries.cipher", O_RDONLY);
+    if (file == -1) return -1;
+    // Only clean pages are dropped
+    const int status = (fdatasync(file) == 0) ? posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED) : -1;
+    close(file);
+    return (status == 0) ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * @brief Read a "Vm...:" line of /proc/self/status.
+ * @return Value in bytes; -1 if not available (only available on Linux).
+ */
+static qint64 memoryStatus(const char *field)
+{
+    qint64 bytes = -1;
+#ifdef Q_OS_LINUX
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status == NULL) return -1;
+
+    char line[256];
+    const size_t fieldLength = strlen(field);
+    while (fgets(line, sizeof line, status) != NULL)
+    {
+        if (strncmp(line, field, fieldLength) == 0 && line[fieldLength] == ':')
+        {
+            bytes = strtoll(line + fieldLength + 1, NULL, 10) * 1024; // in kB
+            break;
+        }
+    }
+    fclose(status);
+#else
+    Q_UNUSED(field);
+#endif
+    return bytes;
+}
+
+/**
+ * @brief Reset peak resident set size (VmHWM) to current one.
+ * @return 0 if peak was reset; -1 otherwise (only available on Linux 4.0 and later).
+ */
+static int resetPeakRss()
+{
+#ifdef Q_OS_LINUX
+    FILE *clearRefs = fopen("/proc/self/clear_refs", "w");
+    if (clearRefs == NULL) return -1;
+    const bool written = (fputs("5", clearRefs) >= 0);
+    return (fclose(clearRefs) == 0 && written) ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * @brief Fill a store with [count] entries, with sealed passwords of PASSWORD_DEFAULT_LENGTH characters.
+ * @return 0 if every entry was added; -1 otherwise.
+ */
+static int fillEntries(const pwm::SessionKey &key, pwm::EntryStore &entries, const int count)
+{
+    pwm::PasswordPolicy policy;
+    policy.length = PASSWORD_DEFAULT_LENGTH;
+    policy.classes = pwm::PASSWORD_LOWCASE | pwm::PASSWORD_UPCASE | pwm::PASSWORD_NUMBERS | pwm::PASSWORD_SPECIALS;
+    policy.everyClass = true;
+
+    std::vector<char> passwords(static_cast<size_t>(BENCH_ENTRY_BATCH) * policy.length);
+    QByteArray sealed;
+    char entryname[32];
+    char username[48];
+    const char date[] = "2025.01.01";
+
+    entries.clear();
+    entries.reserve(count);
+    entries.begin();
+    for (int first = 0 ; first < count ; first += BENCH_ENTRY_BATCH)
+    {
+        const int batch = std::min(BENCH_ENTRY_BATCH, count - first);
+        if (pwm::generatePasswords(policy, batch, passwords.data()) != 0) return -1;
+
+        for (int entry = 0 ; entry < batch ; ++entry)
+        {
+            const std::string_view password(passwords.data() + static_cast<size_t>(entry) * policy.length, policy.length);
+            if (pwm::sealPassword(key, password, sealed) != 0) return -1;
+
+            const int entryNameLength = snprintf(entryname, sizeof entryname, "entry%07d", first + entry);
+            const int usernameLength = snprintf(username, sizeof username, "user%d@example.com", first + entry);
+            const std::string_view fields[ENTRY_NBFIELDS] = {
+                std::string_view(entryname, entryNameLength),
+                std::string_view(username, usernameLength),
+                std::string_view(sealed.constData(), sealed.size()),
+                std::string_view(date, sizeof date - 1)
+            };
+            entries.add(fields);
+        }
+    }
+    entries.commit();
+
+    sodium_memzero(passwords.data(), passwords.size());
+    return 0;
+}
+
+static int benchPasswords(QJsonArray &results)
+{
+    for (const int length : {12, 20, 64})
+    {
+        resetRandom();
+        if (measure(results, QString("generatePassword/%1").arg(length), 1, length, [length]() {
+                return pwm::generatePassword(length, true, true, true, true).isEmpty() ? -1 : 0;
+            }) != 0) return -1;
+    }
+
+    pwm::PasswordPolicy policy;
+    policy.length = PASSWORD_DEFAULT_LENGTH;
+    policy.classes = pwm::PASSWORD_LOWCASE | pwm::PASSWORD_UPCASE | pwm::PASSWORD_NUMBERS | pwm::PASSWORD_SPECIALS;
+    policy.everyClass = true;
+    std::vector<char> passwords(static_cast<size_t>(BENCH_RECORDS) * policy.length);
+
+    resetRandom();
+    return measure(results, QString("generatePasswords/%1x%2").arg(BENCH_RECORDS).arg(policy.length), BENCH_RECORDS, passwords.size(), [&]() {
+        return pwm::generatePasswords(policy, BENCH_RECORDS, passwords.data());
+    });
+}
+
+static int benchKeyDerivation(QJsonArray &results)
+{
+    struct Setting
+    {
+        const char *name;
+        unsigned long long opslimit;
+        size_t memlimit;
+        quint32 lanes;
+    };
+    const Setting settings[] = {
+        {"min", crypto_pwhash_OPSLIMIT_MIN, crypto_pwhash_MEMLIMIT_MIN, 1},
+        {"interactive", crypto_pwhash_OPSLIMIT_INTERACTIVE, crypto_pwhash_MEMLIMIT_INTERACTIVE, 1},
+        {"interactive_4lanes", crypto_pwhash_OPSLIMIT_INTERACTIVE, crypto_pwhash_MEMLIMIT_INTERACTIVE, 4},
+        {"moderate", crypto_pwhash_OPSLIMIT_MODERATE, crypto_pwhash_MEMLIMIT_MODERATE, 1}
+    };
+    const QString master = "benchmark master password";
+    unsigned char secretKey[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+
+    for (const Setting &setting : settings)
+    {
+        resetRandom();
+        pwm::CryptoParams params;
+        randombytes_buf(params.salt, sizeof params.salt);
+        params.opslimit = setting.opslimit;
+        params.memlimit = setting.memlimit;
+        params.alg = crypto_pwhash_ALG_ARGON2ID13;
+        params.lanes = setting.lanes;
+
+        if (measure(results, QString("generateSecretKey/%1").arg(setting.name), 1, 0, [&]() {
+                return pwm::generateSecretKey(secretKey, master, params);
+            }) != 0) return -1;
+    }
+
+    sodium_memzero(secretKey, sizeof secretKey);
+    return 0;
+}
+
+static int benchEntries(QJsonArray &results, const pwm::SessionKey &key, const int maxEntries)
+{
+    for (const int count : {10, 1000, 100000, 1000000})
+    {
+        if (count > maxEntries) break;
+
+        resetRandom();
+        pwm::EntryStore entries;
+        if (fillEntries(key, entries, count) != 0)
+        {
+            fprintf(stderr, "Failed to generate %d entries.\n", count);
+            return -1;
+        }
+
+        // File is written once before timing, so that its size is known
+        if (pwm::writeEntries(key, entries) != 0) return -1;
+        const double fileSize = static_cast<double>(QFile("entries.cipher").size());
+
+        if (measure(results, QString("writeEntries/%1").arg(count), count, fileSize, [&]() {
+                return pwm::writeEntries(key, entries);
+            }) != 0) return -1;
+
+        if (measure(results, QString("readEntries/%1").arg(count), count, fileSize, [&]() {
+                pwm::EntryStore read;
+                return (pwm::readEntries(key, read) == 0 && read.size() == count) ? 0 : -1;
+            }) != 0) return -1;
+
+        // Startup cost: only index blocks are decrypted at unlock, sealed passwords are copied as they are
+        // and opened one at a time, when needed
+        {
+            double passwordBytes = 0;
+            for (int entry = 0 ; entry < entries.size() ; ++entry)
+                passwordBytes += sizeof(quint32) + entries.view(entries.id(entry), pwm::ENTRY_PASSWORD).size();
+
+            QJsonObject result;
+            result["name"] = QString("entriesFile/%1").arg(count);
+            result["file_bytes"] = fileSize;
+            result["password_segment_bytes"] = passwordBytes;
+            results.append(result);
+
+            const std::string_view sealed = entries.view(entries.id(count / 2), pwm::ENTRY_PASSWORD);
+            if (measure(results, QString("OpenedPassword::open/%1").arg(count), 1, sealed.size(), [&]() {
+                    pwm::OpenedPassword password;
+                    return password.open(key, sealed);
+                }) != 0) return -1;
+        }
+
+        // Entries file not in page cache, as on first unlock after boot
+        if (dropEntriesCache() == 0)
+        {
+            if (measureEach(results, QString("readEntries/cold/%1").arg(count), count, fileSize, dropEntriesCache, [&]() {
+                    pwm::EntryStore read;
+                    return (pwm::readEntries(key, read) == 0 && read.size() == count) ? 0 : -1;
+                }) != 0) return -1;
+        }
+        else
+            fprintf(stderr, "readEntries/cold/%d skipped: page cache cannot be dropped.\n", count);
+
+        // Memory taken by a read (mapping, plaintext arena and store), on top of [entries]
+        if (resetPeakRss() == 0)
+        {
+            const qint64 rssBefore = memoryStatus("VmRSS");
+            {
+                pwm::EntryStore read;
+                if (pwm::readEntries(key, read) != 0) return -1;
+            }
+            const qint64 peakRss = memoryStatus("VmHWM");
+
+            QJsonObject result;
+            result["name"] = QString("readEntries/peakRss/%1").arg(count);
+            result["peak_rss_bytes"] = peakRss;
+            result["peak_rss_growth_bytes"] = peakRss - rssBefore;
+            results.append(result);
+        }
+        else
+            fprintf(stderr, "readEntries/peakRss/%d skipped: peak resident set size cannot be reset.\n", count);
+    }
+
+    return 0;
+}
+
+static int benchSearch(QJsonArray &results, const pwm::SessionKey &key, const int maxEntries)
+{
+    const int count = std::min(BENCH_SEARCH_ENTRIES, maxEntries);
+    if (count <= 0) return 0;
+
+    resetRandom();
+    pwm::EntryStore entries;
+    if (fillEntries(key, entries, count) != 0) return -1;
+
+    pwm::FuzzySearch search(&entries);
+    std::vector<pwm::EntryId> ids;
+
+    // Short and long queries, a query matching every entry (bound by scoring), a miss
+    for (const char *query : {"7", "e42", "ent99", "entry", "zq"})
+    {
+        const QString text = QString::fromLatin1(query);
+        if (measure(results, QString("FuzzySearch::search/%1/%2").arg(query).arg(count), 1, 0, [&]() {
+                search.search(text, BENCH_SEARCH_RESULTS, ids);
+                return 0;
+            }) != 0) return -1;
+    }
+
+    // Case folded names are copied again after any change
+    int renamed = 0;
+    if (measure(results, QString("FuzzySearch::rebuild/%1").arg(count), count, 0, [&]() {
+            entries.setField(entries.id(0), pwm::ENTRY_NAME, QString("renamed%1").arg(++renamed));
+            search.search("e42", BENCH_SEARCH_RESULTS, ids);
+            return 0;
+        }) != 0) return -1;
+
+    // Previous filter: exact entry name, found by a linear scan
+    const QStringList entrynames = entries.column(pwm::ENTRY_NAME);
+    const QString lastName = entrynames.last();
+    return measure(results, QString("QStringList::indexOf/%1").arg(count), 1, 0, [&]() {
+        return (entrynames.indexOf(lastName) == count - 1) ? 0 : -1;
+    });
+}
+
+static int benchRecords(QJsonArray &results, const pwm::SessionKey &key)
+{
+    resetRandom();
+    pwm::EntryStore entries;
+    if (fillEntries(key, entries, BENCH_RECORDS) != 0) return -1;
+
+    // Records are serialized one after the other, as in entries file blocks
+    std::string_view fields[BENCH_RECORDS][ENTRY_NBFIELDS];
+    std::vector<size_t> offsets(BENCH_RECORDS + 1, 0);
+    for (int record = 0 ; record < BENCH_RECORDS ; ++record)
+    {
+        for (int field = 0 ; field < ENTRY_NBFIELDS ; ++field)
+            fields[record][field] = entries.view(entries.id(record), static_cast<pwm::EntryField>(field));
+        offsets[record + 1] = offsets[record] + pwm::EntryRecord::encodedLength(fields[record]);
+    }
+    std::vector<unsigned char> buffer(offsets.back());
+
+    if (measure(results, QString("EntryRecord::encode/%1").arg(BENCH_RECORDS), BENCH_RECORDS, buffer.size(), [&]() {
+            for (int record = 0 ; record < BENCH_RECORDS ; ++record)
+                pwm::EntryRecord::encode(buffer.data() + offsets[record], fields[record]);
+            return 0;
+        }) != 0) return -1;
+
+    std::string_view decoded[ENTRY_NBFIELDS];
+    return measure(results, QString("EntryRecord::decode/%1").arg(BENCH_RECORDS), BENCH_RECORDS, buffer.size(), [&]() {
+        for (int record = 0 ; record < BENCH_RECORDS ; ++record)
+        {
+            if (pwm::EntryRecord::decode(buffer.data() + offsets[record], offsets[record + 1] - offsets[record], decoded) != ENTRY_NBFIELDS)
+                return -1;
+        }
+        return 0;
+    });
+}
+
+int main(int argc, char *argv[])
+{
+    int maxEntries = 1000000;
+    bool deterministic = true;
+    unsigned long long seed = 0;
+    const char *outputName = NULL;
+
+    for (int argument = 1 ; argument < argc ; ++argument)
+    {
+        const bool hasValue = (argument + 1 < argc);
+        if (strcmp(argv[argument], "--random") == 0)
+            deterministic = false;
+        else if (hasValue && strcmp(argv[argument], "--max-entries") == 0)
+            maxEntries = atoi(argv[++argument]);
+        else if (hasValue && strcmp(argv[argument], "--min-time") == 0)
+            minTimeNs = strtoll(argv[++argument], NULL, 10) * 1000000LL;
+        else if (hasValue && strcmp(argv[argument], "--seed") == 0)
+            seed = strtoull(argv[++argument], NULL, 10);
+        else if (hasValue && strcmp(argv[argument], "--output") == 0)
+            outputName = argv[++argument];
+        else
+        {
+            fprintf(stderr, "Usage: %s [--max-entries N] [--min-time MS] [--seed N | --random] [--output FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Implementation must be set before sodium_init()
+    if (deterministic)
+    {
+        qToLittleEndian<quint64>(seed, randomSeed + sizeof(quint64));
+        randombytes_set_implementation(&deterministicImplementation);
+    }
+    if (sodium_init() == -1) return 1;
+
+    QCoreApplication application(argc, argv);
+
+    // Vault files are written in a directory removed on exit
+    QTemporaryDir vaultDir;
+    if (!vaultDir.isValid() || !QDir::setCurrent(vaultDir.path()))
+    {
+        fprintf(stderr, "Failed to create temporary vault directory.\n");
+        return 1;
+    }
+
+    // Cheapest derivation: entries benchmarks only need a data key
+    resetRandom();
+    pwm::CryptoParams params;
+    randombytes_buf(params.salt, sizeof params.salt);
+    params.opslimit = crypto_pwhash_OPSLIMIT_MIN;
+    params.memlimit = crypto_pwhash_MEMLIMIT_MIN;
+    params.alg = crypto_pwhash_ALG_ARGON2ID13;
+
+    pwm::SessionKey key;
+    if (key.derive("benchmark", params) != 0 || key.generateDataKey() != 0) return 1;
+
+    QJsonArray results;
+    if (benchPasswords(results) != 0
+        || benchKeyDerivation(results) != 0
+        || benchEntries(results, key, maxEntries) != 0
+        || benchSearch(results, key, maxEntries) != 0
+        || benchRecords(results, key) != 0)
+        return 1;
+
+    QJsonObject context;
+    context["date"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    context["threads"] = QThread::idealThreadCount();
+    context["libsodium"] = sodium_version_string();
+    context["qt"] = qVersion();
+    context["block_algorithm"] = pwm::blockAlgorithmName(pwm::preferredBlockAlgorithm());
+    context["deterministic"] = deterministic;
+    if (deterministic) context["seed"] = QString::number(seed);
+    context["min_time_ms"] = minTimeNs / 1000000;
+
+    QJsonObject report;
+    report["context"] = context;
+    report["benchmarks"] = results;
+    const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+
+    FILE *output = (outputName != NULL) ? fopen(outputName, "wb") : stdout;
+    if (output == NULL)
+    {
+        fprintf(stderr, "Failed to open %s.\n", outputName);
+        return 1;
+    }
+    fwrite(json.constData(), 1, json.size(), output);
+    if (output != stdout) fclose(output);
+
+    return 0;
+}
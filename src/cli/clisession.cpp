@@ -0,0 +1,393 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "clisession.h"
+#include "pwmsealedpassword.h"
+
+#include <QDate>
+
+
+/**
+ * @brief Check that an entry or user name can be stored and journaled.
+ * @return True if [name] is not empty, fits in [maxLength] characters and has no tab nor line break.
+ */
+static bool isValidName(const QString &name, const int maxLength)
+{
+    return !name.isEmpty() && name.size() <= maxLength
+           && !name.contains('\t') && !name.contains('\n') && !name.contains('\r');
+}
+
+/**
+ * @brief Parse character classes of a generated password.
+ * @param classes: Any of 'l' (low case), 'u' (up case), 'n' (numbers), 's' (specials).
+ * @return PasswordClass flags; 0 if [classes] is empty or has an unknown character.
+ */
+static unsigned int parseClasses(const QString &classes)
+{
+    unsigned int flags = 0;
+
+    for (const QChar &character : classes)
+    {
+        switch (character.toLatin1())
+        {
+        case 'l': flags |= pwm::PASSWORD_LOWCASE; break;
+        case 'u': flags |= pwm::PASSWORD_UPCASE; break;
+        case 'n': flags |= pwm::PASSWORD_NUMBERS; break;
+        case 's': flags |= pwm::PASSWORD_SPECIALS; break;
+        default: return 0;
+        }
+    }
+
+    return flags;
+}
+
+CliSession::~CliSession()
+{
+    // Wiping session key and entries before exit
+    sessionKey.wipe();
+    entries.clear();
+}
+
+int CliSession::unlock(const QString &master)
+{
+    pwm::UnlockResult result = pwm::unlockEntries(master, master);
+    if (result.status != 0) return result.status;
+
+    sessionKey.swap(*result.key);
+    entries.swap(*result.entries);
+    vaultLock = result.lock;
+
+    // Journal records are sealed with final session key: vault must match it before any change
+    if (pwm::updateVault(sessionKey, entries, result.rekeyed, result.rewrapped, result.outdated) != 0)
+    {
+        qCritical() << "Failed to update vault files. Aborted unlock.";
+        sessionKey.wipe();
+        entries.clear();
+        return -1;
+    }
+
+    return 0;
+}
+
+int CliSession::run(const QStringList &arguments, FILE *out)
+{
+    if (arguments.isEmpty()) return -1;
+
+    const QString &command = arguments.first();
+    const QStringList commandArguments = arguments.mid(1);
+
+    if (command == "get") return get(commandArguments, out);
+    if (command == "add") return add(commandArguments, out);
+    if (command == "rotate") return rotate(commandArguments, out);
+    if (command == "list") return list(commandArguments, out);
+    if (command == "export") return exportEntries(out);
+
+    fprintf(stderr, "Unknown command: %s\n", qPrintable(command));
+    return -1;
+}
+
+int CliSession::save()
+{
+    if (pending.isEmpty()) return 0;
+
+    // Same policy as EntrySaver: journal first, entries file if journal cannot be appended or grows too large
+    const bool journaled = (pwm::appendJournal(sessionKey, pending) == 0);
+    pending.clear();
+    if (journaled && !pwm::journalNeedsCompaction()) return 0;
+
+    if (pwm::writeEntries(sessionKey, entries) != 0)
+    {
+        // Journal still holds every change if it was appended
+        if (journaled)
+        {
+            qWarning() << "Failed to compact journal into entries file. Changes are kept in journal.";
+            return 0;
+        }
+        qCritical() << "Failed to write entries file. Changes are not saved.";
+        return -1;
+    }
+
+    return 0;
+}
+
+QByteArray CliSession::escapeField(const std::string_view field)
+{
+    QByteArray escaped;
+    escaped.reserve(static_cast<int>(field.size()));
+
+    for (const char character : field)
+    {
+        switch (character)
+        {
+        case '\\': escaped.append("\\\\"); break;
+        case '\t': escaped.append("\\t"); break;
+        case '\n': escaped.append("\\n"); break;
+        case '\r': escaped.append("\\r"); break;
+        default: escaped.append(character); break;
+        }
+    }
+
+    return escaped;
+}
+
+QString CliSession::unescapeField(const QString &field)
+{
+    QString unescaped;
+    unescaped.reserve(field.size());
+
+    for (int position = 0 ; position < field.size() ; ++position)
+    {
+        if (field[position] != '\\' || position + 1 == field.size())
+        {
+            unescaped.append(field[position]);
+            continue;
+        }
+
+        switch (field[++position].toLatin1())
+        {
+        case 't': unescaped.append('\t'); break;
+        case 'n': unescaped.append('\n'); break;
+        case 'r': unescaped.append('\r'); break;
+        default: unescaped.append(field[position]); break;
+        }
+    }
+
+    return unescaped;
+}
+
+int CliSession::get(const QStringList &arguments, FILE *out)
+{
+    if (arguments.size() != 2)
+    {
+        fprintf(stderr, "Usage: get ENTRYNAME USERNAME\n");
+        return -1;
+    }
+
+    const pwm::EntryId id = findEntry(arguments);
+    if (id == ENTRY_NOID) return -1;
+
+    if (printPassword(entries.view(id, pwm::ENTRY_PASSWORD), out) != 0)
+    {
+        fprintf(stderr, "Failed to open password of %s (%s).\n", qPrintable(arguments[0]), qPrintable(arguments[1]));
+        return -1;
+    }
+
+    return 0;
+}
+
+int CliSession::add(const QStringList &arguments, FILE *out)
+{
+    if (arguments.size() < 2 || arguments.size() > 4)
+    {
+        fprintf(stderr, "Usage: add ENTRYNAME USERNAME [LENGTH] [CLASSES]\n");
+        return -1;
+    }
+
+    const QString &entryname = arguments[0];
+    const QString &username = arguments[1];
+    if (!isValidName(entryname, ENTRYNAME_MAXLEN) || !isValidName(username, USERNAME_MAXLEN))
+    {
+        fprintf(stderr, "Entry and user names must not be empty, nor exceed %d and %d characters, nor contain tabs or line breaks.\n",
+                ENTRYNAME_MAXLEN, USERNAME_MAXLEN);
+        return -1;
+    }
+    if (entries.find(entryname, username) != ENTRY_NOID)
+    {
+        fprintf(stderr, "Entry already exists: %s (%s).\n", qPrintable(entryname), qPrintable(username));
+        return -1;
+    }
+
+    // Same defaults as a password replacing one without any known class (see passwordPolicyOf())
+    pwm::PasswordPolicy policy;
+    bool validLength = true;
+    policy.length = (arguments.size() > 2) ? arguments[2].toInt(&validLength) : PASSWORD_DEFAULT_LENGTH;
+    policy.classes = parseClasses((arguments.size() > 3) ? arguments[3] : QString("luns"));
+    if (!validLength || policy.length <= 0 || policy.length > PASSWORD_MAXLEN || policy.classes == 0)
+    {
+        fprintf(stderr, "LENGTH must be between 1 and %d, and CLASSES made of l (low case), u (up case), n (numbers) and s (specials).\n",
+                PASSWORD_MAXLEN);
+        return -1;
+    }
+    policy.everyClass = (policy.length >= pwm::passwordClassCount(policy.classes));
+
+    QByteArray sealedPassword;
+    if (generate(policy, sealedPassword) != 0) return -1;
+
+    const std::string_view sealed(sealedPassword.constData(), sealedPassword.size());
+    const QString date = QDate::currentDate().toString("yyyy.MM.dd");
+
+    // Entry is only kept, and its password printed, once saved
+    entries.begin();
+    entries.add(entryname, username, sealed, date);
+    pending.append({pwm::JOURNAL_ADD, {entryname.toUtf8(), username.toUtf8(), sealedPassword, date.toUtf8()}});
+    if (save() != 0)
+    {
+        fprintf(stderr, "Failed to save %s (%s). Entry was not added.\n", qPrintable(entryname), qPrintable(username));
+        entries.rollback();
+        return -1;
+    }
+    entries.commit();
+
+    if (printPassword(sealed, out) != 0)
+    {
+        fprintf(stderr, "Failed to open password of %s (%s). Entry was added.\n", qPrintable(entryname), qPrintable(username));
+        return -1;
+    }
+    return 0;
+}
+
+int CliSession::rotate(const QStringList &arguments, FILE *out)
+{
+    if (arguments.size() != 2)
+    {
+        fprintf(stderr, "Usage: rotate ENTRYNAME USERNAME\n");
+        return -1;
+    }
+
+    const pwm::EntryId id = findEntry(arguments);
+    if (id == ENTRY_NOID) return -1;
+
+    // Current password is only opened to infer its policy
+    pwm::PasswordPolicy policy;
+    {
+        pwm::OpenedPassword password;
+        if (password.open(sessionKey, entries.view(id, pwm::ENTRY_PASSWORD)) != 0)
+        {
+            fprintf(stderr, "Failed to open password of %s (%s).\n", qPrintable(arguments[0]), qPrintable(arguments[1]));
+            return -1;
+        }
+        policy = pwm::passwordPolicyOf(password.view());
+        if (policy.length > PASSWORD_MAXLEN) policy.length = PASSWORD_MAXLEN;
+    }
+
+    QByteArray sealedPassword;
+    if (generate(policy, sealedPassword) != 0) return -1;
+
+    const std::string_view sealed(sealedPassword.constData(), sealedPassword.size());
+    const QString date = QDate::currentDate().toString("yyyy.MM.dd");
+
+    // Replacing password in a single mutation, only kept, and printed, once saved
+    entries.begin();
+    entries.setField(id, pwm::ENTRY_PASSWORD, sealed);
+    entries.setField(id, pwm::ENTRY_DATE, date);
+    pending.append({pwm::JOURNAL_REGENERATE, {arguments[0].toUtf8(), arguments[1].toUtf8(), sealedPassword, date.toUtf8()}});
+    if (save() != 0)
+    {
+        fprintf(stderr, "Failed to save %s (%s). Kept previous password.\n", qPrintable(arguments[0]), qPrintable(arguments[1]));
+        entries.rollback();
+        return -1;
+    }
+    entries.commit();
+
+    if (printPassword(sealed, out) != 0)
+    {
+        fprintf(stderr, "Failed to open password of %s (%s). Password was re-generated.\n", qPrintable(arguments[0]), qPrintable(arguments[1]));
+        return -1;
+    }
+    return 0;
+}
+
+int CliSession::list(const QStringList &arguments, FILE *out) const
+{
+    if (arguments.size() > 1)
+    {
+        fprintf(stderr, "Usage: list [PREFIX]\n");
+        return -1;
+    }
+
+    std::vector<pwm::EntryId> ids;
+    if (arguments.isEmpty())
+    {
+        ids.reserve(entries.size());
+        for (int entry = 0 ; entry < entries.size() ; ++entry)
+            ids.push_back(entries.id(entry));
+    }
+    else
+        entries.findPrefix(arguments[0], ids);
+
+    for (const pwm::EntryId id : ids)
+    {
+        fprintf(out, "%s\t%s\t%s\n",
+                escapeField(entries.view(id, pwm::ENTRY_NAME)).constData(),
+                escapeField(entries.view(id, pwm::ENTRY_USERNAME)).constData(),
+                escapeField(entries.view(id, pwm::ENTRY_DATE)).constData());
+    }
+
+    return 0;
+}
+
+int CliSession::exportEntries(FILE *out)
+{
+    // Header line: names of fields, in schema order
+    for (int field = 0 ; field < ENTRY_NBFIELDS ; ++field)
+        fprintf(out, (field == 0) ? "%s" : "\t%s", pwm::ENTRY_SCHEMA[field].name);
+    fputc('\n', out);
+
+    for (int entry = 0 ; entry < entries.size() ; ++entry)
+    {
+        const pwm::EntryId id = entries.id(entry);
+
+        for (int field = 0 ; field < ENTRY_NBFIELDS ; ++field)
+        {
+            if (field > 0) fputc('\t', out);
+
+            if (field != pwm::ENTRY_PASSWORD)
+            {
+                fputs(escapeField(entries.view(id, static_cast<pwm::EntryField>(field))).constData(), out);
+                continue;
+            }
+
+            // Plaintext is wiped as soon as it is printed
+            pwm::OpenedPassword password;
+            if (password.open(sessionKey, entries.view(id, pwm::ENTRY_PASSWORD)) != 0)
+            {
+                fputc('\n', out);
+                fprintf(stderr, "Failed to open password of entry %d. Aborted export.\n", entry);
+                return -1;
+            }
+            QByteArray escaped = escapeField(password.view());
+            fwrite(escaped.constData(), 1, escaped.size(), out);
+            sodium_memzero(escaped.data(), escaped.size());
+        }
+        fputc('\n', out);
+    }
+
+    return 0;
+}
+
+pwm::EntryId CliSession::findEntry(const QStringList &arguments) const
+{
+    const pwm::EntryId id = entries.find(arguments[0], arguments[1]);
+    if (id == ENTRY_NOID)
+        fprintf(stderr, "No such entry: %s (%s).\n", qPrintable(arguments[0]), qPrintable(arguments[1]));
+
+    return id;
+}
+
+int CliSession::generate(const pwm::PasswordPolicy &policy, QByteArray &sealed)
+{
+    // Generating password in locked memory
+    char *password = static_cast<char *>(sodium_malloc(policy.length));
+    if (password == NULL
+        || pwm::generatePasswords(policy, 1, password) != 0
+        || pwm::sealPassword(sessionKey, std::string_view(password, policy.length), sealed) != 0)
+    {
+        fprintf(stderr, "Failed to generate password.\n");
+        if (password != NULL) sodium_free(password);
+        return -1;
+    }
+
+    sodium_free(password); // zeroes memory before releasing it
+    return 0;
+}
+
+int CliSession::printPassword(const std::string_view sealed, FILE *out) const
+{
+    // Plaintext is wiped as soon as it is printed
+    pwm::OpenedPassword password;
+    if (password.open(sessionKey, sealed) != 0) return -1;
+
+    fwrite(password.view().data(), 1, password.view().size(), out);
+    fputc('\n', out);
+    return 0;
+}
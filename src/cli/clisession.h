@@ -0,0 +1,110 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef CLISESSION_H
+#define CLISESSION_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QLockFile>
+#include <QDebug>
+
+#include <memory>
+#include <stdio.h>
+#include <string_view>
+
+#include "pwmsecurity.h"
+#include "pwmjournal.h"
+#include "pwmentrystore.h"
+#include "pwmpasswordgenerator.h"
+
+
+/**
+ * @brief Unlocked vault driven by command line commands.
+ *
+ * Vault is unlocked once (see unlock()), then any number of commands are run on it with
+ * run(): a batch of commands costs a single key derivation. Vault stays locked against other
+ * processes, the GUI included, until the session is destroyed (see pwm::unlockEntries()).
+ * Each change is saved by its command with the same policy as the GUI (see EntrySaver): a
+ * journal write, or a re-write of entries file when journal grows too large. A generated
+ * password is only printed once it is saved, and a change that cannot be saved is undone.
+ *
+ * Passwords stay sealed in entries, and are only opened to be printed (see pwm::OpenedPassword).
+ * Session key and entries are wiped on destruction.
+ *
+ * Commands (arguments are UTF-8):
+ * get ENTRYNAME USERNAME                    print password
+ * add ENTRYNAME USERNAME [LENGTH] [CLASSES] add an entry with a generated password, save it and print password
+ * rotate ENTRYNAME USERNAME                 re-generate password with same length and classes, save it and print it
+ * list [PREFIX]                             print entry name, user name and date of entries
+ * export                                    print every field of every entry, passwords opened
+ *
+ * Lists and exports print one entry per line, fields separated by tabs and escaped (see escapeField()).
+ */
+class CliSession
+{
+public:
+    CliSession() = default;
+    ~CliSession();
+    CliSession(const CliSession &) = delete;
+    CliSession &operator=(const CliSession &) = delete;
+
+    /**
+     * @brief Verify master password, read entries and update vault files if needed (see pwm::updateVault()).
+     * @return 0 if unlocked; 1 if master password is incorrect; 2 if vault is open in another process; -1 otherwise.
+     */
+    int unlock(const QString &master);
+    /**
+     * @brief Run a command.
+     * @param arguments: Command name, then its arguments.
+     * @param out: Where command output is written.
+     * @return 0 if command succeeded; -1 otherwise, and entries and vault files are left unchanged.
+     */
+    int run(const QStringList &arguments, FILE *out);
+
+    /**
+     * @brief Escape backslashes, tabs and line breaks of a field, so that it fits in a tab-separated line.
+     */
+    static QByteArray escapeField(const std::string_view field);
+    /**
+     * @brief Undo escapeField().
+     */
+    static QString unescapeField(const QString &field);
+
+private:
+    int get(const QStringList &arguments, FILE *out);
+    int add(const QStringList &arguments, FILE *out);
+    int rotate(const QStringList &arguments, FILE *out);
+    int list(const QStringList &arguments, FILE *out) const;
+    int exportEntries(FILE *out);
+
+    /**
+     * @brief Find the entry named by the first two arguments, and report missing entries.
+     * @return Id of the entry; ENTRY_NOID if entry does not exist.
+     */
+    pwm::EntryId findEntry(const QStringList &arguments) const;
+    /**
+     * @brief Generate a password following [policy] and seal it. Plaintext is wiped at once.
+     * @param sealed: Where sealed password is going to be stored.
+     * @return 0 if password was generated and sealed; -1 otherwise.
+     */
+    int generate(const pwm::PasswordPolicy &policy, QByteArray &sealed);
+    /**
+     * @brief Open a sealed password and print it on its own line.
+     * @return 0 if password was opened and printed; -1 otherwise.
+     */
+    int printPassword(const std::string_view sealed, FILE *out) const;
+    /**
+     * @brief Save changes applied to entries since last save, then forget them.
+     * @return 0 if every change is saved; -1 otherwise, and changes must be undone in entries.
+     */
+    int save();
+
+    pwm::SessionKey sessionKey;
+    pwm::EntryStore entries;
+    QVector<pwm::JournalChange> pending; // changes applied to entries, not saved yet
+    std::shared_ptr<QLockFile> vaultLock; // held for the whole session
+};
+
+#endif // CLISESSION_H
@@ -0,0 +1,238 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "clisession.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+// Longest line read from standard input or password file
+#define CLI_LINE_MAXLEN 4096
+
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--vault DIRECTORY] [--password-file FILE] COMMAND [ARGUMENTS]\n"
+            "\n"
+            "Commands:\n"
+            "  get ENTRYNAME USERNAME                     print password\n"
+            "  add ENTRYNAME USERNAME [LENGTH] [CLASSES]  add an entry with a generated password, save it\n"
+            "                                             and print password\n"
+            "                                             CLASSES: any of l (low case), u (up case), n (numbers),\n"
+            "                                             s (specials); default: 20 characters of every class\n"
+            "  rotate ENTRYNAME USERNAME                  re-generate password with same length and classes,\n"
+            "                                             save it and print it\n"
+            "  list [PREFIX]                              print entry name, user name and date of entries\n"
+            "  export                                     print every field of every entry, passwords included\n"
+            "  batch                                      run commands read from standard input, one per line,\n"
+            "                                             arguments separated by tabs, with a single unlock\n"
+            "\n"
+            "Master password is read from FILE (first line), or from terminal.\n"
+            "Lists and exports separate fields with tabs, and escape \\\\, \\t, \\n and \\r.\n"
+            "Each change is saved before its password is printed; a change that cannot be saved is undone.\n"
+            "Vault cannot be opened by another process, graphical one included, while a command runs.\n"
+            "Exit status: 0 on success, 1 on error, 2 if master password is incorrect,\n"
+            "3 if vault is open in another process.\n",
+            program);
+}
+
+/**
+ * @brief Remove line break ending a line read by fgets().
+ */
+static void chompLine(char *line)
+{
+    const size_t length = strlen(line);
+    if (length > 0 && line[length - 1] == '\n') line[length - 1] = '\0';
+    if (length > 1 && line[length - 2] == '\r') line[length - 2] = '\0';
+}
+
+/**
+ * @brief Read master password from first line of a file, or from terminal without echo.
+ * @param passwordFile: File holding master password; NULL to read from terminal.
+ * @return 0 if successfully read master password; -1 otherwise.
+ *
+ * Terminal is used instead of standard input, which is kept for batch commands.
+ */
+static int readMaster(QString &master, const char *passwordFile)
+{
+    char line[CLI_LINE_MAXLEN];
+    bool read = false;
+
+    if (passwordFile != NULL)
+    {
+        FILE *file = fopen(passwordFile, "rb");
+        if (file == NULL) return -1;
+        read = (fgets(line, sizeof line, file) != NULL);
+        fclose(file);
+    }
+    else
+    {
+#ifdef Q_OS_WIN
+        HANDLE console = CreateFileW(L"CONIN$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+        if (console == INVALID_HANDLE_VALUE) return -1;
+
+        DWORD mode = 0;
+        GetConsoleMode(console, &mode);
+        SetConsoleMode(console, mode & ~ENABLE_ECHO_INPUT);
+        fputs("Master password: ", stderr);
+
+        wchar_t wideLine[CLI_LINE_MAXLEN];
+        DWORD length = 0;
+        read = ReadConsoleW(console, wideLine, CLI_LINE_MAXLEN - 1, &length, NULL);
+        SetConsoleMode(console, mode);
+        CloseHandle(console);
+        fputc('\n', stderr);
+
+        // Converting to UTF-8, like lines of password files
+        const int lineLength = read ? WideCharToMultiByte(CP_UTF8, 0, wideLine, length, line, sizeof line - 1, NULL, NULL) : 0;
+        line[lineLength] = '\0';
+        SecureZeroMemory(wideLine, sizeof wideLine);
+#else
+        FILE *terminal = fopen("/dev/tty", "r+");
+        if (terminal == NULL) return -1;
+
+        struct termios saved;
+        const bool echoDisabled = (tcgetattr(fileno(terminal), &saved) == 0);
+        if (echoDisabled)
+        {
+            struct termios noEcho = saved;
+            noEcho.c_lflag &= ~ECHO;
+            tcsetattr(fileno(terminal), TCSAFLUSH, &noEcho);
+        }
+
+        fputs("Master password: ", terminal);
+        fflush(terminal);
+        read = (fgets(line, sizeof line, terminal) != NULL);
+
+        if (echoDisabled) tcsetattr(fileno(terminal), TCSAFLUSH, &saved);
+        fputc('\n', terminal);
+        fclose(terminal);
+#endif
+    }
+
+    if (read)
+    {
+        chompLine(line);
+        master = QString::fromUtf8(line);
+    }
+
+    sodium_memzero(line, sizeof line);
+    return read ? 0 : -1;
+}
+
+/**
+ * @brief Run commands read from standard input, one per line, arguments separated by tabs.
+ * @return 0 if every command succeeded; -1 otherwise. Failed commands are reported with their line number.
+ */
+static int runBatch(CliSession &session)
+{
+    char line[CLI_LINE_MAXLEN];
+    int lineNumber = 0;
+    int returnValue = 0;
+
+    while (fgets(line, sizeof line, stdin) != NULL)
+    {
+        ++lineNumber;
+        chompLine(line);
+        if (line[0] == '\0') continue;
+
+        QStringList arguments = QString::fromUtf8(line).split('\t');
+        for (QString &argument : arguments)
+            argument = CliSession::unescapeField(argument);
+
+        if (session.run(arguments, stdout) != 0)
+        {
+            fprintf(stderr, "Line %d: command failed.\n", lineNumber);
+            returnValue = -1;
+        }
+        fflush(stdout);
+    }
+
+    sodium_memzero(line, sizeof line);
+    return returnValue;
+}
+
+int main(int argc, char *argv[])
+{
+    if (sodium_init() == -1) return 1;
+    qSetMessagePattern("%{type}: %{message}");
+    QCoreApplication application(argc, argv);
+
+    // Options, then command
+    const char *passwordFile = NULL;
+    int argument = 1;
+    for ( ; argument + 1 < argc && strncmp(argv[argument], "--", 2) == 0 ; argument += 2)
+    {
+        if (strcmp(argv[argument], "--vault") == 0)
+        {
+            if (!QDir::setCurrent(QString::fromLocal8Bit(argv[argument + 1])))
+            {
+                fprintf(stderr, "Cannot open vault directory %s.\n", argv[argument + 1]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[argument], "--password-file") == 0)
+            passwordFile = argv[argument + 1];
+        else
+            break;
+    }
+
+    if (argument >= argc || strncmp(argv[argument], "--", 2) == 0)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    const bool batch = (strcmp(argv[argument], "batch") == 0);
+    QStringList arguments;
+    for (int commandArgument = argument ; commandArgument < argc ; ++commandArgument)
+        arguments.append(QString::fromLocal8Bit(argv[commandArgument]));
+
+    if (batch && arguments.size() != 1)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    QString master;
+    if (readMaster(master, passwordFile) != 0)
+    {
+        fprintf(stderr, "Failed to read master password.\n");
+        return 1;
+    }
+
+    CliSession session;
+    const int unlockStatus = session.unlock(master);
+    sodium_memzero(master.data(), master.size() * sizeof(QChar));
+
+    if (unlockStatus == 1)
+    {
+        fprintf(stderr, "Incorrect master password.\n");
+        return 2;
+    }
+    if (unlockStatus == 2)
+    {
+        fprintf(stderr, "Vault is already open in another process.\n");
+        return 3;
+    }
+    if (unlockStatus != 0)
+    {
+        fprintf(stderr, "Failed to open entries.\n");
+        return 1;
+    }
+
+    // Every command runs on the same unlocked vault, and saves its own change
+    const int runStatus = batch ? runBatch(session) : session.run(arguments, stdout);
+
+    return (runStatus == 0) ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "entryitemdelegate.h"
+
+
+EntryItemDelegate::EntryItemDelegate(QObject *parent)
+    : QStyledItemDelegate(parent)
+{
+}
+
+void EntryItemDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    const QIcon *icon = nullptr;
+
+    switch (index.column())
+    {
+    case EntryTableModel::EditColumn:
+        icon = index.data(EntryTableModel::EditingRole).toBool() ? &validateIcon : &editIcon;
+        break;
+    case EntryTableModel::RegenerateColumn: icon = &regenerateIcon; break;
+    case EntryTableModel::DeleteColumn: icon = &deleteIcon; break;
+    default:
+        QStyledItemDelegate::paint(painter, option, index);
+        return;
+    }
+
+    // Background of selected entries, or of the entry being edited
+    const QVariant background = index.data(Qt::BackgroundRole);
+    if (option.state & QStyle::State_Selected)
+        painter->fillRect(option.rect, option.palette.highlight());
+    else if (background.isValid())
+        painter->fillRect(option.rect, background.value<QColor>());
+
+    icon->paint(painter, option.rect, Qt::AlignCenter);
+}
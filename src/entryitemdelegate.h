@@ -0,0 +1,40 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef ENTRYITEMDELEGATE_H
+#define ENTRYITEMDELEGATE_H
+
+#include <QStyledItemDelegate>
+#include <QStyleOptionViewItem>
+#include <QStyle>
+#include <QModelIndex>
+#include <QPainter>
+#include <QIcon>
+
+#include "entrytablemodel.h"
+
+
+/**
+ * @brief Delegate painting edit, re-generate and delete buttons of entry table.
+ *
+ * Buttons are painted from icons loaded once, instead of being stored in each row.
+ * Edit button is painted as a validate button for the entry being edited.
+ * Other columns are painted by QStyledItemDelegate.
+ */
+class EntryItemDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+
+public:
+    EntryItemDelegate(QObject *parent = nullptr);
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+
+private:
+    const QIcon editIcon = QIcon(":/edit");
+    const QIcon validateIcon = QIcon(":/validate");
+    const QIcon regenerateIcon = QIcon(":/regenerate");
+    const QIcon deleteIcon = QIcon(":/delete");
+};
+
+#endif // ENTRYITEMDELEGATE_H
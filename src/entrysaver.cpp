@@ -0,0 +1,158 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "entrysaver.h"
+
+#include <QSignalBlocker>
+
+
+EntrySaver::EntrySaver(const pwm::SessionKey *sessionKey, const pwm::EntryStore *entries, QObject *parent)
+    : QObject(parent), sessionKey(sessionKey), entries(entries)
+{
+    delayTimer = new QTimer(this);
+    delayTimer->setSingleShot(true);
+    delayTimer->setInterval(ENTRYSAVER_DELAY);
+
+    saveWatcher = new QFutureWatcher<SaveResult>(this);
+
+    connect(delayTimer, SIGNAL(timeout()), this, SLOT(startSave()));
+    connect(saveWatcher, SIGNAL(finished()), this, SLOT(saveFinished()));
+}
+
+void EntrySaver::enqueue(const pwm::JournalOp op, const QList<QByteArray> &fields)
+{
+    // Change is already in entries: it will be written with them if entries file is re-written
+    if (!rewrite)
+    {
+        pwm::JournalChange change;
+        change.op = op;
+        change.fields = fields;
+        pending.append(change);
+    }
+
+    // Saved with following changes once delay is over, or once running save is finished
+    if (!saving && !delayTimer->isActive()) delayTimer->start();
+}
+
+void EntrySaver::enqueueRewrite()
+{
+    // Snapshot taken when save starts holds pending changes
+    rewrite = true;
+    pending.clear();
+
+    if (!saving && !delayTimer->isActive()) delayTimer->start();
+}
+
+bool EntrySaver::flush()
+{
+    // Result is reported by return value only
+    const QSignalBlocker blocker(this);
+
+    delayTimer->stop();
+
+    // Waiting for running save, then handling its result here (finished() is then ignored)
+    if (saving)
+    {
+        saveWatcher->waitForFinished();
+        saving = false;
+        handleResult(saveWatcher->result(), rewriting);
+    }
+
+    // Saving remaining changes on this thread: a journal failure or compaction requires a second save
+    QVector<pwm::JournalChange> changes;
+    std::shared_ptr<const pwm::EntryStore> snapshot;
+    for (int attempt = 0 ; attempt < 2 && takePending(changes, snapshot) ; ++attempt)
+    {
+        if (!handleResult(save(sessionKey, changes, snapshot), snapshot != nullptr)) break;
+    }
+
+    return isSaved();
+}
+
+void EntrySaver::startSave()
+{
+    if (saving) return;
+
+    QVector<pwm::JournalChange> changes;
+    std::shared_ptr<const pwm::EntryStore> snapshot;
+    if (!takePending(changes, snapshot)) return;
+
+    saving = true;
+    rewriting = (snapshot != nullptr);
+    saveWatcher->setFuture(QtConcurrent::run(save, sessionKey, changes, snapshot));
+}
+
+void EntrySaver::saveFinished()
+{
+    if (!saving) return; // already handled by flush()
+    saving = false;
+
+    if (handleResult(saveWatcher->result(), rewriting))
+        startSave();
+}
+
+EntrySaver::SaveResult EntrySaver::save(const pwm::SessionKey *sessionKey, const QVector<pwm::JournalChange> &changes, std::shared_ptr<const pwm::EntryStore> snapshot)
+{
+    SaveResult result;
+
+    if (snapshot != nullptr)
+    {
+        result.status = pwm::writeEntries(*sessionKey, *snapshot);
+        return result;
+    }
+
+    result.status = pwm::appendJournal(*sessionKey, changes);
+    if (result.status == 0) result.compact = pwm::journalNeedsCompaction();
+
+    return result;
+}
+
+bool EntrySaver::takePending(QVector<pwm::JournalChange> &changes, std::shared_ptr<const pwm::EntryStore> &snapshot)
+{
+    changes.clear();
+    snapshot.reset();
+
+    if (rewrite)
+    {
+        // Snapshot holds every committed change, including pending ones
+        std::shared_ptr<pwm::EntryStore> copy = std::make_shared<pwm::EntryStore>();
+        copy->assign(*entries);
+        snapshot = copy;
+
+        rewrite = false;
+        pending.clear();
+        return true;
+    }
+
+    if (pending.isEmpty()) return false;
+
+    changes.swap(pending);
+    return true;
+}
+
+bool EntrySaver::handleResult(const SaveResult &result, const bool rewritten)
+{
+    if (result.status != 0)
+    {
+        // Saved journal and entries file no longer hold every change: only a re-write can save them
+        rewrite = true;
+        pending.clear();
+
+        if (rewritten)
+        {
+            // Not retried until next change or flush(), so that a full disk is not written in a loop
+            qCritical() << "Failed to write entries file. Changes are kept in memory.";
+            emit saveFailed();
+            return false;
+        }
+
+        qWarning() << "Failed to append changes to journal. Re-writing entries file.";
+        return true;
+    }
+
+    // Compacting journal into entries file
+    if (result.compact) rewrite = true;
+
+    emit saved();
+    return rewrite || !pending.isEmpty();
+}
@@ -0,0 +1,135 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef ENTRYSAVER_H
+#define ENTRYSAVER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <QStringList>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include <QDebug>
+
+#include <memory>
+
+#include "pwmsecurity.h"
+#include "pwmjournal.h"
+
+// Changes made within this delay (ms) after a first change are saved together
+#define ENTRYSAVER_DELAY 250
+
+
+/**
+ * @brief Save committed changes of entries on a worker thread.
+ *
+ * Changes are queued with enqueue() once applied to the entry store, and saved together
+ * ENTRYSAVER_DELAY ms after the first of them: a burst of changes costs a single journal
+ * write (see pwm::appendJournal()). Changes queued while a save is running are saved
+ * as soon as it is finished.
+ *
+ * Entries file is re-written from a snapshot of the store instead when journal grows
+ * too large (see pwm::journalNeedsCompaction()) or cannot be appended. Entries file
+ * is replaced in a single step (see pwm::writeEntries()), so that an interrupted save
+ * never loses previously saved entries.
+ *
+ * The store is only read on the thread owning the saver; worker only reads its snapshot
+ * and session key, which must not be modified until saves are finished (see flush()).
+ */
+class EntrySaver : public QObject
+{
+    Q_OBJECT
+
+public:
+    EntrySaver(const pwm::SessionKey *sessionKey, const pwm::EntryStore *entries, QObject *parent = nullptr);
+
+    /**
+     * @brief Queue a change already committed to entries.
+     * @param op: Type of change.
+     * @param fields: Fields of the change (see pwm::JournalOp).
+     */
+    void enqueue(const pwm::JournalOp op, const QList<QByteArray> &fields);
+    /**
+     * @brief Queue a re-write of entries file, so that every committed change is saved at once.
+     * Used for changes of many entries, which must all be saved or none.
+     */
+    void enqueueRewrite();
+    /**
+     * @brief Save queued changes now, and wait until every save is finished.
+     * @return True if every change is saved; false otherwise.
+     *
+     * Called before session key is wiped (e.g. when closing application).
+     * No signal is emitted: result is only reported by return value.
+     */
+    bool flush();
+    /**
+     * @return True if every queued change is saved.
+     */
+    bool isSaved() const { return !saving && pending.isEmpty() && !rewrite; }
+
+signals:
+    /**
+     * @brief Signal emitted when changes have been saved.
+     */
+    void saved();
+    /**
+     * @brief Signal emitted when changes could not be saved.
+     * Changes are kept in memory, and saved again with the next change or flush().
+     */
+    void saveFailed();
+
+private slots:
+    /**
+     * @brief Start saving queued changes on a worker thread, unless a save is already running.
+     * Called when coalescing delay is over.
+     */
+    void startSave();
+    /**
+     * @brief Handle worker result, and start saving changes queued meanwhile.
+     * Called when worker has finished.
+     */
+    void saveFinished();
+
+private:
+    /**
+     * @brief Result of a save, see save().
+     */
+    struct SaveResult
+    {
+        int status = -1;      // 0 if changes are saved; -1 otherwise
+        bool compact = false; // true if journal should now be compacted into entries file
+    };
+
+    /**
+     * @brief Save changes to journal, or re-write entries file from a snapshot. Run on a worker thread.
+     * @param sessionKey: Session key used for encryption.
+     * @param changes: Changes to append to journal (if no snapshot is given).
+     * @param snapshot: Copy of entries to write to entries file; null to append [changes] to journal.
+     */
+    static SaveResult save(const pwm::SessionKey *sessionKey, const QVector<pwm::JournalChange> &changes, std::shared_ptr<const pwm::EntryStore> snapshot);
+
+    /**
+     * @brief Take queued changes (or a snapshot of entries if entries file must be re-written) for next save.
+     * @return True if there is something to save.
+     */
+    bool takePending(QVector<pwm::JournalChange> &changes, std::shared_ptr<const pwm::EntryStore> &snapshot);
+    /**
+     * @brief Update queue after a save.
+     * @return True if changes queued meanwhile can be saved right away.
+     */
+    bool handleResult(const SaveResult &result, const bool rewritten);
+
+    const pwm::SessionKey *sessionKey;
+    const pwm::EntryStore *entries;
+
+    QTimer *delayTimer; // coalescing delay, started by first queued change
+    QFutureWatcher<SaveResult> *saveWatcher;
+
+    QVector<pwm::JournalChange> pending; // changes not yet handed to worker
+    bool rewrite = false;  // true if entries file must be re-written (pending changes are then useless)
+    bool saving = false;   // true while worker is running
+    bool rewriting = false; // true if running worker re-writes entries file
+};
+
+#endif // ENTRYSAVER_H
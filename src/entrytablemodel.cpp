@@ -0,0 +1,220 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "entrytablemodel.h"
+
+
+EntryTableModel::EntryTableModel(const pwm::EntryStore *entries, QObject *parent)
+    : QAbstractTableModel(parent), entries(entries), fuzzySearch(entries)
+{
+}
+
+int EntryTableModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows.size();
+}
+
+int EntryTableModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant EntryTableModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rows.size()) return QVariant();
+
+    const pwm::EntryId id = rows[index.row()];
+    if (!entries->contains(id)) return QVariant();
+
+    const bool editing = (id == editedEntry);
+
+    switch (role)
+    {
+    case Qt::DisplayRole:
+    case Qt::EditRole:
+        switch (index.column())
+        {
+        case EntrynameColumn: return editing ? editedEntryname : entries->field(id, pwm::ENTRY_NAME);
+        case UsernameColumn: return editing ? editedUsername : entries->field(id, pwm::ENTRY_USERNAME);
+        case PasswordColumn: return QString("***************");
+        default: return QVariant(); // buttons are painted by delegate
+        }
+    case Qt::DecorationRole:
+        if (index.column() == EntrynameColumn)
+            return iconFrom(entries->field(id, pwm::ENTRY_DATE));
+        return QVariant();
+    case Qt::BackgroundRole:
+        if (editing) return QColor(210,210,210);
+        return QVariant();
+    case EditingRole:
+        return editing;
+    default:
+        return QVariant();
+    }
+}
+
+Qt::ItemFlags EntryTableModel::flags(const QModelIndex &index) const
+{
+    if (!index.isValid()) return Qt::NoItemFlags;
+
+    // Only entry and user names of the entry being edited can be modified
+    if (index.column() <= UsernameColumn && index.row() < rows.size() && rows[index.row()] == editedEntry)
+        return Qt::ItemIsEnabled | Qt::ItemIsEditable;
+
+    return Qt::ItemIsEnabled;
+}
+
+bool EntryTableModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+    if (role != Qt::EditRole || !(flags(index) & Qt::ItemIsEditable)) return false;
+
+    if (index.column() == EntrynameColumn)
+        editedEntryname = value.toString();
+    else
+        editedUsername = value.toString();
+
+    emit dataChanged(index, index);
+    return true;
+}
+
+pwm::EntryId EntryTableModel::entryAt(const int row) const
+{
+    return (row >= 0 && row < rows.size()) ? rows[row] : ENTRY_NOID;
+}
+
+int EntryTableModel::rowOf(const pwm::EntryId id) const
+{
+    return (id == ENTRY_NOID) ? -1 : rows.indexOf(id);
+}
+
+void EntryTableModel::setFilter(const QString &query)
+{
+    beginResetModel();
+
+    rows.clear();
+    filter.clear();
+
+    if (!query.isEmpty())
+    {
+        std::vector<pwm::EntryId> ids;
+        fuzzySearch.search(query, ENTRYTABLE_MAXRESULTS, ids);
+
+        if (!ids.empty())
+        {
+            filter = query;
+            rows.reserve(ids.size());
+            for (const pwm::EntryId id : ids)
+                rows.append(id);
+        }
+    }
+
+    if (filter.isEmpty())
+    {
+        // Names copied by search are not kept while every entry is displayed
+        if (query.isEmpty()) fuzzySearch.clear();
+
+        rows.reserve(entries->size());
+        for (int index = 0 ; index < entries->size() ; ++index)
+            rows.append(entries->id(index));
+    }
+
+    endResetModel();
+}
+
+void EntryTableModel::reload()
+{
+    const QString query = filter; // cleared by setFilter()
+
+    editedEntry = ENTRY_NOID;
+    setFilter(query);
+}
+
+void EntryTableModel::entryAdded(const pwm::EntryId id)
+{
+    if (!entries->contains(id)) return;
+    if (!filter.isEmpty() && !fuzzySearch.matches(id, filter)) return;
+
+    // Entries are added at the end of store
+    beginInsertRows(QModelIndex(), rows.size(), rows.size());
+    rows.append(id);
+    endInsertRows();
+}
+
+void EntryTableModel::entryRemoved(const pwm::EntryId id)
+{
+    const int row = rowOf(id);
+    if (row == -1) return;
+
+    if (id == editedEntry) stopEditing();
+
+    beginRemoveRows(QModelIndex(), row, row);
+    rows.removeAt(row);
+    endRemoveRows();
+
+    // No entry matches filter anymore: displaying every entry
+    if (!filter.isEmpty() && rows.isEmpty()) setFilter(QString());
+}
+
+void EntryTableModel::entryChanged(const pwm::EntryId id)
+{
+    const int row = rowOf(id);
+    if (row != -1) rowChanged(row);
+}
+
+void EntryTableModel::startEditing(const pwm::EntryId id)
+{
+    if (editedEntry != ENTRY_NOID) stopEditing();
+    if (!entries->contains(id)) return;
+
+    editedEntry = id;
+    editedEntryname = entries->field(id, pwm::ENTRY_NAME);
+    editedUsername = entries->field(id, pwm::ENTRY_USERNAME);
+
+    entryChanged(id);
+}
+
+void EntryTableModel::stopEditing()
+{
+    const pwm::EntryId id = editedEntry;
+
+    editedEntry = ENTRY_NOID;
+    editedEntryname.clear();
+    editedUsername.clear();
+
+    entryChanged(id);
+}
+
+EntryTableModel::PasswordAge EntryTableModel::ageOf(const QString &date)
+{
+    QDate currentDate = QDate::currentDate();
+    QDate pwdDate = QDate::fromString(date, "yyyy.MM.dd");
+    int monthDifference = 0; // number of months separating [currentDate] from [pwdDate]
+
+    if (pwdDate.isNull()) return UnknownAge;
+
+    monthDifference = (currentDate.year() - pwdDate.year()) * 12 + (currentDate.month() - pwdDate.month());
+
+    if (monthDifference < 3) return RecentAge;
+    else if (monthDifference < 6) return AgingAge;
+
+    return ExpiredAge;
+}
+
+QIcon EntryTableModel::iconFrom(const QString &date) const
+{
+    switch (ageOf(date))
+    {
+    case RecentAge: return greenIcon;
+    case AgingAge: return orangeIcon;
+    case ExpiredAge: return redIcon;
+    default:
+        // Date format is incorrect
+        qWarning() << "Date format of " << date << "is incorrect. Date icon will not appear.";
+        return QIcon();
+    }
+}
+
+void EntryTableModel::rowChanged(const int row)
+{
+    emit dataChanged(index(row, 0), index(row, ColumnCount - 1));
+}
@@ -0,0 +1,177 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef ENTRYTABLEMODEL_H
+#define ENTRYTABLEMODEL_H
+
+#include <QAbstractTableModel>
+#include <QModelIndex>
+#include <QVariant>
+#include <QVector>
+#include <QIcon>
+#include <QColor>
+#include <QDate>
+#include <QString>
+#include <QDebug>
+
+#include "pwmentrystore.h"
+#include "pwmfuzzysearch.h"
+
+#define ENTRYTABLE_MAXRESULTS 1000 // maximum number of entries displayed by a search
+
+
+/**
+ * @brief Table model displaying entries of an entry store.
+ *
+ * Columns: entry name (with date icon), user name, hidden password,
+ * then edit, re-generate and delete buttons (painted by EntryItemDelegate).
+ *
+ * The model only keeps the id of each displayed entry: fields are read from
+ * the store when a row is painted, so that only visible rows are materialized.
+ * Store is not watched: the owner of the store must call entryAdded(), entryRemoved()
+ * and entryChanged() once a mutation is committed.
+ */
+class EntryTableModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Columns of the table.
+     */
+    enum Column
+    {
+        EntrynameColumn = 0,
+        UsernameColumn = 1,
+        PasswordColumn = 2,
+        EditColumn = 3,
+        RegenerateColumn = 4,
+        DeleteColumn = 5,
+        ColumnCount = 6
+    };
+
+    /**
+     * @brief Age of a password, shown by the date icon.
+     */
+    enum PasswordAge
+    {
+        UnknownAge = 0, // date format is incorrect
+        RecentAge,      // less than 3 months (green icon)
+        AgingAge,       // between 3 and 6 months (orange icon)
+        ExpiredAge      // more than 6 months (red icon)
+    };
+
+    /**
+     * @brief Custom data role: true for cells of the entry being edited.
+     */
+    static const int EditingRole = Qt::UserRole + 1;
+
+    /**
+     * @brief Classify a password by its date of creation.
+     * @param date: Date of creation of the password. Expected format: "yyyy.MM.dd".
+     */
+    static PasswordAge ageOf(const QString &date);
+
+    EntryTableModel(const pwm::EntryStore *entries, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    Qt::ItemFlags flags(const QModelIndex &index) const override;
+    /**
+     * @brief Store entry or user name typed by user in the entry being edited.
+     * Store is not modified: new names are read with editedField() once edition is validated.
+     */
+    bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override;
+
+    /**
+     * @return Id of the entry displayed in given row; ENTRY_NOID if row does not exist.
+     */
+    pwm::EntryId entryAt(const int row) const;
+    /**
+     * @return Row of given entry; -1 if entry is not displayed.
+     */
+    int rowOf(const pwm::EntryId id) const;
+
+    /**
+     * @brief Display only entries whose entry or user name fuzzy matches [query] (ignoring case),
+     * best matches first, or every entry if no entry matches.
+     * @param query: Searched characters; empty to display every entry.
+     *
+     * At most ENTRYTABLE_MAXRESULTS entries are displayed, see pwm::FuzzySearch.
+     */
+    void setFilter(const QString &query);
+    /**
+     * @brief Reload every displayed entry from store.
+     * Called when entries are replaced.
+     */
+    void reload();
+
+    /**
+     * @brief Insert a row for an entry added at the end of store (if it matches filter).
+     */
+    void entryAdded(const pwm::EntryId id);
+    /**
+     * @brief Remove the row of a removed entry.
+     */
+    void entryRemoved(const pwm::EntryId id);
+    /**
+     * @brief Repaint the row of a modified entry.
+     */
+    void entryChanged(const pwm::EntryId id);
+
+    /**
+     * @brief Make entry and user names of an entry editable.
+     */
+    void startEditing(const pwm::EntryId id);
+    /**
+     * @brief Make entry being edited read only again.
+     */
+    void stopEditing();
+    /**
+     * @return Row of the entry being edited; -1 if no entry is being edited.
+     */
+    int editedRow() const { return rowOf(editedEntry); }
+    /**
+     * @return Id of the entry being edited; ENTRY_NOID if no entry is being edited.
+     */
+    pwm::EntryId editedId() const { return editedEntry; }
+    /**
+     * @return Entry or user name typed by user in the entry being edited.
+     */
+    QString editedField(const pwm::EntryField field) const { return (field == pwm::ENTRY_NAME) ? editedEntryname : editedUsername; }
+
+private:
+    /**
+     * @brief Return an icon corresponding to an entry's date of creation.
+     * @param date: date of creation of the entry. Expected format: "yyyy.MM.dd".
+     * @return Green icon if date is okay; Orange icon if date is about to be passed; Red icon otherwise.
+     *
+     * Red icon: date is passed (more than 6 months);
+     * Orange icon: date is about to be passed (bwt. 3 and 6 months);
+     * Green icon: date is okay (less than 3 months).
+     */
+    QIcon iconFrom(const QString &date) const;
+
+    /**
+     * @brief Emit dataChanged() for every column of given row.
+     */
+    void rowChanged(const int row);
+
+    const pwm::EntryStore *entries;
+    pwm::FuzzySearch fuzzySearch;
+
+    QVector<pwm::EntryId> rows; // id of the entry displayed in each row
+    QString filter;             // query matched by displayed entries; empty if every entry is displayed
+
+    pwm::EntryId editedEntry = ENTRY_NOID;
+    QString editedEntryname; // entry name typed by user, see setData()
+    QString editedUsername;  // user name typed by user, see setData()
+
+    // Icons are shared by every row
+    const QIcon greenIcon = QIcon(":/green");
+    const QIcon orangeIcon = QIcon(":/orange");
+    const QIcon redIcon = QIcon(":/red");
+};
+
+#endif // ENTRYTABLEMODEL_H
@@ -3,7 +3,8 @@
 
 #include "loginwindow.h"
 
-LoginWindow::LoginWindow()
+LoginWindow::LoginWindow(pwm::SessionKey *sessionKey, pwm::EntryStore *entries, std::shared_ptr<QLockFile> *vaultLock)
+    : sessionKey(sessionKey), entries(entries), vaultLock(vaultLock)
 {
     setWindowTitle(tr("Authentification"));
     setFixedSize(windowSmallSize);
@@ -29,12 +30,20 @@ LoginWindow::LoginWindow()
     changePwdButton = new QPushButton(QString(tr("Changer")));
     confirmButton->setDefault(true);
 
+    unlockProgress = new QProgressBar();
+    unlockProgress->setRange(0, 0); // busy indicator
+    unlockProgress->setTextVisible(false);
+
+    unlockWatcher = new QFutureWatcher<pwm::UnlockResult>(this);
+
     formLayout = new QFormLayout();
     formLayout->addRow(passwordLabel, passwordLine);
     formLayout->addRow(newPasswordLabel, newPasswordLine);
     formLayout->addRow(confirmNewPasswordLabel, confirmNewPasswordLine);
+    formLayout->addRow(unlockProgress);
     formLayout->setRowVisible(1, false);
     formLayout->setRowVisible(2, false);
+    formLayout->setRowVisible(3, false);
 
     buttonsLayout = new QHBoxLayout();
     buttonsLayout->addWidget(changePwdButton);
@@ -51,27 +60,14 @@ LoginWindow::LoginWindow()
 
     connect(changePwdButton, SIGNAL(pressed()), this, SLOT(changePassword()));
     connect(confirmButton, SIGNAL(pressed()), this, SLOT(verifications()));
-    connect(cancelButton, SIGNAL(pressed()), this, SLOT(reject()));
+    connect(cancelButton, SIGNAL(pressed()), this, SLOT(cancel()));
+    connect(unlockWatcher, SIGNAL(finished()), this, SLOT(unlockFinished()));
 }
 
 void LoginWindow::verifications()
 {
     const QString password = passwordLine->text();
 
-    // Uncomment only if master password hash file is empty.
-    // pwm::updateMasterHash(password);
-
-    if (!pwm::masterIsCorrect(password))
-    {
-        // Wrong password
-        QMessageBox::critical(
-            this,
-            this->windowTitle(),
-            tr("Mot de passe incorrect.")
-            );
-        return;
-    }
-
     if (passwordChanged)
     {
         const QString newPassword = newPasswordLine->text();
@@ -98,31 +94,110 @@ void LoginWindow::verifications()
             );
             return;
         }
+    }
 
-        if (newPassword == password)
-        {
-            // New password same as old
-            QMessageBox::information(
-                this,
-                this->windowTitle(),
-                tr("Nouveau mot de passe identique à l'ancien.\nAncien mot de passe conservé.")
-                );
-        }
-        else
-        {
-            pwm::updateMasterHash(newPassword);
+    // Running key derivations and decryption on a worker thread
+    unlockCancelled = false;
+    setBusy(true);
+    unlockWatcher->setFuture(QtConcurrent::run(pwm::unlockEntries, password, getNewPassword()));
+}
 
-            QMessageBox::information(
-                this,
-                this->windowTitle(),
-                tr("Mot de passe modifié avec succès.")
-                );
-        }
+void LoginWindow::unlockFinished()
+{
+    if (unlockCancelled)
+    {
+        // Discarding result of cancelled unlock; its lock is kept by the finished future otherwise
+        const pwm::UnlockResult cancelled = unlockWatcher->result();
+        cancelled.key->wipe();
+        if (cancelled.lock) cancelled.lock->unlock();
+        return;
     }
 
+    setBusy(false);
+
+    pwm::UnlockResult result = unlockWatcher->result();
+
+    if (result.status == 1)
+    {
+        // Wrong password
+        QMessageBox::critical(
+            this,
+            this->windowTitle(),
+            tr("Mot de passe incorrect.")
+            );
+        return;
+    }
+
+    if (result.status == 2)
+    {
+        // Vault opened by another instance or by command line tool
+        QMessageBox::critical(
+            this,
+            this->windowTitle(),
+            tr("Les entrées sont déjà ouvertes par un autre processus.")
+            );
+        return;
+    }
+
+    if (result.status != 0)
+    {
+        // Error in master hash reading, key derivation or entries reading
+        QMessageBox::critical(
+            this,
+            this->windowTitle(),
+            tr("Une erreur est survenue lors de l'ouverture des entrées.")
+            );
+        return;
+    }
+
+    // Handing key and entries over to main window without copying them
+    sessionKey->swap(*result.key);
+    entries->swap(*result.entries);
+    *vaultLock = result.lock;
+    rekeyed = result.rekeyed;
+    rewrapped = result.rewrapped;
+    outdated = result.outdated;
+    unlockTime = result.unlockTime;
+
+    if (passwordChanged && !masterChanged())
+    {
+        // New password same as old
+        QMessageBox::information(
+            this,
+            this->windowTitle(),
+            tr("Nouveau mot de passe identique à l'ancien.\nAncien mot de passe conservé.")
+            );
+    }
+    // Master hash is updated once data key is re-wrapped with new key (cf. MainWindow::loadEntries())
+
     accept();
 }
 
+void LoginWindow::cancel()
+{
+    if (!unlocking)
+    {
+        reject();
+        return;
+    }
+
+    unlockCancelled = true;
+    setBusy(false);
+}
+
+void LoginWindow::setBusy(const bool busy)
+{
+    unlocking = busy;
+
+    formLayout->setRowVisible(0, !busy);
+    formLayout->setRowVisible(1, !busy && passwordChanged);
+    formLayout->setRowVisible(2, !busy && passwordChanged);
+    formLayout->setRowVisible(3, busy);
+
+    confirmButton->setEnabled(!busy);
+    changePwdButton->setEnabled(!busy);
+}
+
 void LoginWindow::changePassword()
 {
     // Resizing window
@@ -14,6 +14,9 @@
 #include <QLabel>
 #include <QLineEdit>
 #include <QPushButton>
+#include <QProgressBar>
+#include <QFutureWatcher>
+#include <QtConcurrent>
 
 #include "pwmsecurity.h"
 
@@ -23,9 +26,14 @@ class LoginWindow : public QDialog
     Q_OBJECT
 
 public:
-    LoginWindow();
+    LoginWindow(pwm::SessionKey *sessionKey, pwm::EntryStore *entries, std::shared_ptr<QLockFile> *vaultLock);
     QString getPassword() const { return passwordLine->text(); }
     QString getNewPassword() const { return (newPasswordLine->text().isEmpty() ? getPassword() : newPasswordLine->text()); }
+    bool masterChanged() const { return passwordChanged && getNewPassword() != getPassword(); }
+    bool entriesRekeyed() const { return rekeyed; }
+    bool keyRewrapped() const { return rewrapped; }
+    bool entriesOutdated() const { return outdated; }
+    qint64 unlockDuration() const { return unlockTime; }
 
 private slots:
     /**
@@ -33,11 +41,26 @@ private slots:
      *
      * Called when confirm button is pressed.
      * Verifications:
-     * 1. Password must be correct.
-     * 2. (if change password is selected) New password and confirmation must match.
-     * 3. (if change password is selected) New password must be long enough.
+     * 1. (if change password is selected) New password and confirmation must match.
+     * 2. (if change password is selected) New password must be long enough.
+     * 3. Password must be correct. Session key is derived at the same time.
+     *
+     * Password verification and entries reading are run on a worker thread
+     * (see pwm::unlockEntries()); unlockFinished() is called when done.
      */
     void verifications();
+    /**
+     * @brief Check unlock result and call accept() if password was correct.
+     * Called when unlock worker has finished. Result is discarded if unlock was cancelled.
+     */
+    void unlockFinished();
+    /**
+     * @brief Cancel unlock if one is running; call reject() otherwise.
+     *
+     * Key derivation cannot be interrupted: worker keeps running and its result
+     * (session key included) is wiped as soon as it is finished.
+     */
+    void cancel();
     /**
      * @brief Set change password interface to visible.
      * Update [passwordChanged] to true.
@@ -45,6 +68,12 @@ private slots:
     void changePassword();
 
 private:
+    /**
+     * @brief Show busy indicator and disable inputs while unlocking; restore them otherwise.
+     * @param busy: True if an unlock is running.
+     */
+    void setBusy(const bool busy);
+
     const QSize windowSmallSize = QSize(300,90);
     const QSize windowLargeSize = QSize(300,140);
 
@@ -66,6 +95,19 @@ private:
     QPushButton *cancelButton;
     QPushButton *changePwdButton;
 
+    QProgressBar *unlockProgress; // busy indicator shown while unlocking
+    QFutureWatcher<pwm::UnlockResult> *unlockWatcher;
+
+    pwm::SessionKey *sessionKey; // receives key derived by unlock worker
+    pwm::EntryStore *entries;    // receives entries read by unlock worker
+    std::shared_ptr<QLockFile> *vaultLock; // receives lock of the vault taken by unlock worker
+    bool rekeyed = false;        // true if entries must be re-written with [sessionKey] data key
+    bool rewrapped = false;      // true if [sessionKey] data key must be re-wrapped with new master password
+    bool outdated = false;       // true if entries file has a previous version
+    qint64 unlockTime = 0;       // time (ms) taken by key derivation, see pwm::cryptoParamsNeedCalibration()
+    bool unlocking = false;      // true while unlock worker is running
+    bool unlockCancelled = false;
+
     bool passwordChanged = false; // flag to indicate if user asks to change master password
 };
 
@@ -15,6 +15,12 @@ MainWindow::MainWindow(QWidget *parent)
 
     addButton = new QPushButton(tr("Ajouter"));
 
+    rotateButton = new QPushButton(tr("Re-générer les expirés"));
+    regSelectionButton = new QPushButton(tr("Re-générer la sélection"));
+    delSelectionButton = new QPushButton(tr("Supprimer la sélection"));
+    regSelectionButton->setEnabled(false);
+    delSelectionButton->setEnabled(false);
+
     searchModel = new QStringListModel;
 
     searchCompleter = new QCompleter;
@@ -23,19 +29,33 @@ MainWindow::MainWindow(QWidget *parent)
     searchCompleter->setCompletionMode(QCompleter::InlineCompletion);
 
     searchBar = new QLineEdit();
+    // Completions must be updated before completer reacts to the same edition
+    connect(searchBar, SIGNAL(textEdited(QString)), this, SLOT(updateCompletions(QString)));
     searchBar->setCompleter(searchCompleter);
 
-    entryTable = new QTableWidget(0,6);
+    saver = new EntrySaver(&sessionKey, &entries, this);
+    rekeyWatcher = new QFutureWatcher<pwm::RekeyResult>(this);
+
+    entryModel = new EntryTableModel(&entries, this);
+    entryDelegate = new EntryItemDelegate(this);
+
+    entryTable = new QTableView;
+    entryTable->setModel(entryModel);
+    entryTable->setItemDelegate(entryDelegate);
     entryTable->horizontalHeader()->setVisible(false);
     entryTable->verticalHeader()->setVisible(false);
-    entryTable->setColumnWidth(0,120); // entry names
-    entryTable->setColumnWidth(1,120); // user names
-    entryTable->setColumnWidth(2,100); // passwords
-    entryTable->setColumnWidth(3,20);  // edit buttons
-    entryTable->setColumnWidth(4,20);  // re-generate buttons
-    entryTable->setColumnWidth(5,20);  // delete buttons
-
-    loginWindow = new LoginWindow();
+    entryTable->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    entryTable->verticalHeader()->setDefaultSectionSize(20);
+    entryTable->setSelectionMode(QAbstractItemView::ExtendedSelection);
+    entryTable->setSelectionBehavior(QAbstractItemView::SelectRows);
+    entryTable->setColumnWidth(EntryTableModel::EntrynameColumn,120);
+    entryTable->setColumnWidth(EntryTableModel::UsernameColumn,120);
+    entryTable->setColumnWidth(EntryTableModel::PasswordColumn,100);
+    entryTable->setColumnWidth(EntryTableModel::EditColumn,20);
+    entryTable->setColumnWidth(EntryTableModel::RegenerateColumn,20);
+    entryTable->setColumnWidth(EntryTableModel::DeleteColumn,20);
+
+    loginWindow = new LoginWindow(&sessionKey, &entries, &vaultLock);
     loginWindow->setWindowIcon(windowIcon());
     loginWindow->setModal(Qt::ApplicationModal);
 
@@ -45,10 +65,16 @@ MainWindow::MainWindow(QWidget *parent)
     regWindow = new RegEntryWindow(PASSWORD_MAXLEN, this);
     regWindow->setWindowIcon(windowIcon());
 
+    selectionLayout = new QHBoxLayout;
+    selectionLayout->addWidget(rotateButton);
+    selectionLayout->addWidget(regSelectionButton);
+    selectionLayout->addWidget(delSelectionButton);
+
     mainLayout = new QVBoxLayout;
     mainLayout->addWidget(addButton);
     mainLayout->addWidget(searchBar);
     mainLayout->addWidget(entryTable);
+    mainLayout->addLayout(selectionLayout);
 
     mainContent = new QWidget();
     mainContent->setLayout(mainLayout);
@@ -62,10 +88,17 @@ MainWindow::MainWindow(QWidget *parent)
     connect(regWindow, SIGNAL(accepted()), this, SLOT(regEntry()));
     connect(this, SIGNAL(delEntryClicked(int)), this, SLOT(delEntry(int)));
     connect(this, SIGNAL(editEntryClicked(int)), this, SLOT(editEntry(int)));
+    connect(rotateButton, SIGNAL(pressed()), this, SLOT(rotateExpired()));
+    connect(regSelectionButton, SIGNAL(pressed()), this, SLOT(regSelection()));
+    connect(delSelectionButton, SIGNAL(pressed()), this, SLOT(delSelection()));
+    connect(saver, SIGNAL(saveFailed()), this, SLOT(saveFailed()));
+    connect(rekeyWatcher, SIGNAL(finished()), this, SLOT(rekeyFinished()));
     // Table interaction
-    connect(entryTable, SIGNAL(cellDoubleClicked(int,int)), this, SLOT(copyCell(int,int)));
-    connect(entryTable, SIGNAL(cellClicked(int,int)), this, SLOT(buttonFromCell(int,int)));
+    connect(entryTable, SIGNAL(doubleClicked(QModelIndex)), this, SLOT(copyCell(QModelIndex)));
+    connect(entryTable, SIGNAL(clicked(QModelIndex)), this, SLOT(buttonFromCell(QModelIndex)));
     connect(searchBar, SIGNAL(textChanged(QString)), this, SLOT(updateTable(QString)));
+    connect(entryTable->selectionModel(), SIGNAL(selectionChanged(QItemSelection,QItemSelection)), this, SLOT(updateSelectionButtons()));
+    connect(entryModel, SIGNAL(modelReset()), this, SLOT(updateSelectionButtons()));
     // Login window
     connect(loginWindow, SIGNAL(accepted()), this, SLOT(loadEntries()));
     connect(loginWindow, SIGNAL(rejected()), this, SLOT(close()));
@@ -75,127 +108,143 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
-    // Clearing clipboard when closing window if it contains a password.
-    if (passwords.contains(clipboard->text())) clipboard->clear();
+    // Clearing clipboard when closing window if it still contains the copied password.
+    if (passwordCopied)
+    {
+        const QByteArray clipboardUtf8 = clipboard->text().toUtf8();
+        unsigned char clipboardHash[crypto_generichash_BYTES];
+        crypto_generichash(clipboardHash, sizeof clipboardHash, reinterpret_cast<const unsigned char *>(clipboardUtf8.constData()), clipboardUtf8.size(), NULL, 0);
+        if (sodium_memcmp(clipboardHash, copiedPasswordHash, sizeof clipboardHash) == 0) clipboard->clear();
+    }
+
+    // Session key is used by saves until they are finished
+    if (!saver->flush())
+        qCritical() << "Failed to save last changes before exit. Changes are lost.";
 
-    // Uncomment only if crypto parameters file is empty or parameters need to be changed
-    //pwm::updateCryptoParams();
+    // Wiping session key before exit
+    sessionKey.wipe();
 
-    // Encrypting with new master if modified
-    // pwm::writeEntries(loginWindow->getNewPassword(), entrynames, usernames, passwords, dates);
+    // Vault can be opened by another process once every save is finished
+    vaultLock.reset();
 }
 
-void MainWindow::copyCell(const int row, const int col) const
+void MainWindow::copyCell(const QModelIndex &index)
 {
-    if (col == 1) // column for usernames
-        clipboard->setText(entryTable->item(row,col)->text());
-    else if (col == 2) // column for passwords
-        clipboard->setText(passwords[indexOf(entryTable->item(row,0)->text(),entryTable->item(row,1)->text())]);
+    if (index.column() == EntryTableModel::UsernameColumn)
+        clipboard->setText(index.data().toString());
+    else if (index.column() == EntryTableModel::PasswordColumn)
+    {
+        // Plaintext is wiped as soon as it is copied
+        pwm::OpenedPassword password;
+        if (password.open(sessionKey, entries.view(entryModel->entryAt(index.row()), pwm::ENTRY_PASSWORD)) != 0)
+        {
+            QMessageBox::critical(
+                this,
+                this->windowTitle(),
+                tr("Le mot de passe n'a pas pu être déchiffré.")
+                );
+            return;
+        }
+
+        clipboard->setText(password.toString());
+        crypto_generichash(copiedPasswordHash, sizeof copiedPasswordHash,
+                           reinterpret_cast<const unsigned char *>(password.view().data()), password.view().size(), NULL, 0);
+        passwordCopied = true;
+    }
 }
 
-void MainWindow::buttonFromCell(const int row, const int col)
+void MainWindow::buttonFromCell(const QModelIndex &index)
 {
-    switch (col)
+    switch (index.column())
     {
-    case 3: emit editEntryClicked(row); break;
-    case 4: emit regEntryClicked(row); break;
-    case 5: emit delEntryClicked(row); break;
+    case EntryTableModel::EditColumn: emit editEntryClicked(index.row()); break;
+    case EntryTableModel::RegenerateColumn: emit regEntryClicked(index.row()); break;
+    case EntryTableModel::DeleteColumn: emit delEntryClicked(index.row()); break;
     default: break;
     }
 }
 
 void MainWindow::updateTable() const
 {
-    int nbRows = entrynames.size(); // <=> nb of entries
-
-    entryTable->setRowCount(0); // clearing table
-
-    for (int row = 0 ; row < nbRows ; ++row)
-        addRow(row);
+    entryModel->setFilter(QString());
 }
 
-void MainWindow::updateTable(const QString &entryname) const
+void MainWindow::updateTable(const QString &query) const
 {
-    if (!entrynames.contains(entryname))
-        updateTable(); // resetting table
-    else
-    {
-        int currentIndex = entrynames.indexOf(entryname);
-        int row = 0; // <=> each entry
-
-        entryTable->setRowCount(0); // clearing table
+    entryModel->setFilter(query);
+}
 
-        while (currentIndex != -1)
-        {
-            addRow(currentIndex);
-            currentIndex = entrynames.indexOf(entryname, currentIndex+1);
-            ++row;
-        }
-    }
+void MainWindow::updateCompletions(const QString &prefix) const
+{
+    searchModel->setStringList(entries.completeEntryname(prefix, maxCompletions));
 }
 
 void MainWindow::openRegWindow(const int row) const
 {
-    regWindow->open(entryTable->item(row,0)->text(),entryTable->item(row,1)->text());
+    const pwm::EntryId id = entryModel->entryAt(row);
+    regWindow->open(entries.field(id, pwm::ENTRY_NAME), entries.field(id, pwm::ENTRY_USERNAME));
 }
 
 void MainWindow::loadEntries()
 {
-    // Temporary variables
-    QStringList tempEntrynames = entrynames;
-    QStringList tempUsernames = usernames;
-    QStringList tempPasswords = passwords;
-    QStringList tempDates = dates;
-
-    QStringList entries = pwm::readEntries(loginWindow->getPassword());
-
+    // Session key has been derived and entries read by [loginWindow]
     if (entries.isEmpty())
-    {
-        // Empty file or error in entries file reading
         qWarning() << "No entry loaded. Entry file may be empty.";
-        return;
-    }
 
-    // Updating list attributes
-    for (const auto &entry : entries)
+    // Re-writing entries file only if data key is new (files written before key files) or if file format is outdated
+    if (pwm::updateVault(sessionKey, entries, loginWindow->entriesRekeyed(), loginWindow->keyRewrapped(), loginWindow->entriesOutdated()) != 0)
     {
-        QStringList entryFields = entry.split('\t');
-        if (entryFields.size() != 4)
-            qWarning() << "Format of entry" << entries.indexOf(entry) <<  "is incorrect. Skipped entry.";
-        else
-        {
-            tempEntrynames.append(entryFields[0]);
-            tempUsernames.append(entryFields[1]);
-            tempPasswords.append(entryFields[2]);
-            tempDates.append(entryFields[3]);
-        }
-    }
-
-    // Re-writing file in case master password has changed
-    if (pwm::writeEntries(loginWindow->getNewPassword(), tempEntrynames, tempUsernames, tempPasswords, tempDates) != 0)
-    {
-        // Error in file writing
-        qCritical() << "Error in entries writing. Could not encrypt entries with new password.";
+        // Files are left untouched, but no longer match session key: nothing must be saved
+        qCritical() << "Error in vault writing. Could not encrypt entries with new key.";
         QMessageBox::critical(
             this,
             this->windowTitle(),
             tr("Une erreur est survenue lors de la prise en compte du nouveau mot de passe.\n"
-               "Si vous souhaitez conserver vos entrées, fermez l'application SANS AJOUTER\n"
-               "D'ENTREE et revenez à l'ancien mot de passe.\n"
-               "Sinon, toute entrée ajoutée écrasera les entrées précédemment enregistrées."
+               "Les fichiers n'ont pas été modifiés : l'ancien mot de passe reste valide.\n"
+               "L'application va se fermer."
                )
             );
+        entries.clear();
+        close();
         return;
     }
 
-    // Updating entries attributes
-    entrynames = tempEntrynames;
-    usernames = tempUsernames;
-    passwords = tempPasswords;
-    dates = tempDates;
+    if (loginWindow->masterChanged())
+        QMessageBox::information(
+            this,
+            this->windowTitle(),
+            tr("Mot de passe modifié avec succès.")
+            );
 
-    searchModel->setStringList(entrynames);
-    updateTable();
+    entryModel->reload();
+
+    // Crypto parameters no longer suit this machine: re-deriving key in background
+    pwm::CryptoParams params;
+    if (pwm::readCryptoParams(params) == 0 && pwm::cryptoParamsNeedCalibration(loginWindow->unlockDuration(), params))
+        rekeyWatcher->setFuture(QtConcurrent::run(pwm::prepareRekey, loginWindow->getNewPassword()));
+}
+
+void MainWindow::rekeyFinished()
+{
+    pwm::RekeyResult result = rekeyWatcher->result();
+
+    // Parameters already calibrated, or calibration failed: current key is kept
+    if (result.status != 0) return;
+
+    // Saves running on a worker read session key and write entries file: they must be finished first
+    saver->flush();
+
+    // Data key is kept: only its wrapping changes, whatever the number of entries
+    if (result.key->adoptDataKey(sessionKey) != 0
+        || pwm::rewrapVault(*result.key, result.params) != 0)
+    {
+        qWarning() << "Failed to re-wrap data key with calibrated crypto parameters. Kept current key.";
+        result.key->wipe();
+        return;
+    }
+
+    sessionKey.swap(*result.key);
+    result.key->wipe();
 }
 
 void MainWindow::addEntry()
@@ -209,13 +258,7 @@ void MainWindow::addEntry()
     bool hasNumbers = addWindow->hasNumbers();
     bool hasSpecials = addWindow->hasSpecials();
 
-    // Temporary variables
-    QStringList tempEntrynames = entrynames;
-    QStringList tempUsernames = usernames;
-    QStringList tempPasswords = passwords;
-    QStringList tempDates = dates;
-
-    if (indexOf(entryname, username) != -1)
+    if (entries.find(entryname, username) != ENTRY_NOID)
     {
         QMessageBox::warning(
             this,
@@ -231,7 +274,12 @@ void MainWindow::addEntry()
 
     QString password = pwm::generatePassword(passwordLength, hasLowCase, hasUpCase, hasNumbers, hasSpecials);
 
-    if (password.isEmpty())
+    // Only sealed password is kept and saved
+    QByteArray sealedPassword;
+    const bool generated = !password.isEmpty() && pwm::sealPassword(sessionKey, password, sealedPassword) == 0;
+    sodium_memzero(password.data(), password.size() * sizeof(QChar));
+
+    if (!generated)
     {
         // Error in password generation
         QMessageBox::critical(
@@ -246,32 +294,11 @@ void MainWindow::addEntry()
         return;
     }
 
-    tempEntrynames.append(entryname);
-    tempUsernames.append(username);
-    tempPasswords.append(password);
-    tempDates.append(QDate::currentDate().toString("yyyy.MM.dd"));
-
-    // Writing entries in file
-    if (pwm::writeEntries(loginWindow->getNewPassword(), tempEntrynames, tempUsernames, tempPasswords, tempDates) != 0)
-    {
-        // Error in file writing
-        QMessageBox::critical(
-            this,
-            this->windowTitle(),
-            tr("Une erreur est survenue lors de l'enregistrement des entrées.\n"
-               "L'entrée suivante n'a pas été ajoutée:\n\n"
-               "     %1\n"
-               "     %2"
-               ).arg(entryname, username)
-            );
-        return;
-    }
+    QString date = QDate::currentDate().toString("yyyy.MM.dd");
 
-    // Updating entries attributes
-    entrynames = tempEntrynames;
-    usernames = tempUsernames;
-    passwords = tempPasswords;
-    dates = tempDates;
+    // Adding entry, saved in background
+    pwm::EntryId id = entries.add(entryname, username, std::string_view(sealedPassword.constData(), sealedPassword.size()), date);
+    saver->enqueue(pwm::JOURNAL_ADD, {entryname.toUtf8(), username.toUtf8(), sealedPassword, date.toUtf8()});
 
     QMessageBox::information(
         this,
@@ -279,16 +306,15 @@ void MainWindow::addEntry()
         tr("Entrée ajoutée avec succès.")
         );
 
-    searchModel->setStringList(entrynames);
-    updateTable();
+    entryModel->entryAdded(id);
 }
 
 void MainWindow::delEntry(const int row)
 {
     // User inputs
-    QString entryname = entryTable->item(row,0)->text();
-    QString username = entryTable->item(row,1)->text();
-    int indexToRemove = indexOf(entryname, username);
+    pwm::EntryId idToRemove = entryModel->entryAt(row);
+    QString entryname = entries.field(idToRemove, pwm::ENTRY_NAME);
+    QString username = entries.field(idToRemove, pwm::ENTRY_USERNAME);
 
     // Asking user to confirm deletion
     int answer = QMessageBox::warning(
@@ -305,47 +331,10 @@ void MainWindow::delEntry(const int row)
 
     if (answer == QMessageBox::Cancel) return;
 
-    // Temporary variables
-    QStringList tempEntrynames = entrynames;
-    QStringList tempUsernames = usernames;
-    QStringList tempPasswords = passwords;
-    QStringList tempDates = dates;
-
-    while (indexToRemove != -1)
-    {
-        if (tempUsernames[indexToRemove] == username)
-        {
-            // Should be executed only once because entries cannot contains same entry name and user name
-            tempEntrynames.removeAt(indexToRemove);
-            tempUsernames.removeAt(indexToRemove);
-            tempPasswords.removeAt(indexToRemove);
-            tempDates.removeAt(indexToRemove);
-        }
-        indexToRemove = tempEntrynames.indexOf(entryname, indexToRemove+1);
-    }
-
-    // Writing entries in file
-    if (pwm::writeEntries(loginWindow->getNewPassword(), tempEntrynames, tempUsernames, tempPasswords, tempDates) != 0)
-    {
-        // Error in file writing
-        qCritical() << "Failed to write entry. Entry" << entryname << username << "not added.";
-        QMessageBox::critical(
-            this,
-            this->windowTitle(),
-            tr("Une erreur est survenue lors l'enregistrement des entrées.\n"
-               "L'entrée suivante n'a pas été ajoutée:\n\n"
-               "     %1\n"
-               "     %2"
-               ).arg(entryname, username)
-            );
-        return;
-    }
-
-    // Updating entries attributes
-    entrynames = tempEntrynames;
-    usernames = tempUsernames;
-    passwords = tempPasswords;
-    dates = tempDates;
+    // Removing entry, saved in background
+    entries.remove(idToRemove);
+    saver->enqueue(pwm::JOURNAL_DELETE, {entryname.toUtf8(), username.toUtf8()});
+    entryModel->entryRemoved(idToRemove);
 
     QMessageBox::information(
         this,
@@ -353,8 +342,6 @@ void MainWindow::delEntry(const int row)
         tr("Entrée supprimée avec succès.")
         );
 
-    searchModel->setStringList(entrynames);
-    updateTable();
 }
 
 void MainWindow::regEntry()
@@ -367,17 +354,16 @@ void MainWindow::regEntry()
     bool hasUpCase = regWindow->hasUpCase();
     bool hasNumbers = regWindow->hasNumbers();
     bool hasSpecials = regWindow->hasSpecials();
-    int indexToReset = entrynames.indexOf(entryname);
-
-    // Temporary variables
-    QStringList tempEntrynames = entrynames;
-    QStringList tempUsernames = usernames;
-    QStringList tempPasswords = passwords;
-    QStringList tempDates = dates;
+    pwm::EntryId idToReset = entries.find(entryname, username);
 
     QString password = pwm::generatePassword(passwordLength, hasLowCase, hasUpCase, hasNumbers, hasSpecials);
 
-    if (password.isEmpty())
+    // Only sealed password is kept and saved
+    QByteArray sealedPassword;
+    const bool generated = !password.isEmpty() && pwm::sealPassword(sessionKey, password, sealedPassword) == 0;
+    sodium_memzero(password.data(), password.size() * sizeof(QChar));
+
+    if (!generated)
     {
         // Error in password generation
         qWarning() << "No password was generated. Kept entry" << entryname << username << "with old password.";
@@ -393,39 +379,15 @@ void MainWindow::regEntry()
         return;
     }
 
-    while (indexToReset != -1)
-    {
-        if (tempUsernames[indexToReset] == username)
-        {
-            // Should be executed only once because entries cannot contains same entry name and user name
-            tempPasswords[indexToReset] = password;
-            tempDates[indexToReset] = QDate::currentDate().toString("yyyy.MM.dd");
-        }
-        indexToReset = tempEntrynames.indexOf(entryname, indexToReset+1);
-    }
-
-    // Writing entries in file
-    if (pwm::writeEntries(loginWindow->getNewPassword(), tempEntrynames, tempUsernames, tempPasswords, tempDates) != 0)
-    {
-        // Error in file writing
-        qCritical() << "Failed to write entry. Entry" << entryname << username << "not added.";
-        QMessageBox::critical(
-            this,
-            this->windowTitle(),
-            tr("Une erreur est survenue lors de l'enregistrement de l'entrée.\n"
-               "Le mot de passe de l'entrée n'a pas été re-généré:\n\n"
-               "\t%1\n"
-               "\t%2"
-               ).arg(entryname, username)
-            );
-        return;
-    }
+    QString date = QDate::currentDate().toString("yyyy.MM.dd");
 
-    // Updating entries attributes
-    entrynames = tempEntrynames;
-    usernames = tempUsernames;
-    passwords = tempPasswords;
-    dates = tempDates;
+    // Replacing password in a single mutation, saved in background
+    entries.begin();
+    entries.setField(idToReset, pwm::ENTRY_PASSWORD, std::string_view(sealedPassword.constData(), sealedPassword.size()));
+    entries.setField(idToReset, pwm::ENTRY_DATE, date);
+    entries.commit();
+    saver->enqueue(pwm::JOURNAL_REGENERATE, {entryname.toUtf8(), username.toUtf8(), sealedPassword, date.toUtf8()});
+    entryModel->entryChanged(idToReset);
 
     QMessageBox::information(
         this,
@@ -436,75 +398,68 @@ void MainWindow::regEntry()
 
 void MainWindow::editEntry(const int row)
 {
-    int rowEdited = entryRowBeingEdited();
+    int rowEdited = entryModel->editedRow();
 
     if (rowEdited == -1) // no entry is being edited
     {
-        int indexToEdit = indexOf(entryTable->item(row,0)->text(), entryTable->item(row,1)->text());
-
-        // Setting entry and user names to editable
-        entryTable->item(row,0)->setFlags(Qt::ItemIsEnabled | Qt::ItemIsEditable);
-        entryTable->item(row,1)->setFlags(Qt::ItemIsEnabled | Qt::ItemIsEditable);
-        // Setting edit icon to validate icon
-        entryTable->item(row,3)->setIcon(QIcon(":/validate"));
-        // Setting cell background to lightgrey
-        for (int col = 0 ; col < entryTable->columnCount() ; col++)
-            entryTable->item(row,col)->setBackground(QColor(210,210,210));
-
-        // Memorizing entry to edit
-        entrynames[indexToEdit] = "entrynametoBeEdited";
-        usernames[indexToEdit] = "usernametoBeEdited";
+        // Setting entry and user names to editable, edit icon to validate icon and background to lightgrey
+        entryModel->startEditing(entryModel->entryAt(row));
 
         // Disabling deletion, re-generation, search bar, buttons and cell copy while editing
         disconnect(this, SIGNAL(delEntryClicked(int)), this, SLOT(delEntry(int)));
         disconnect(this, SIGNAL(regEntryClicked(int)), this, SLOT(openRegWindow(int)));
         disconnect(searchBar, SIGNAL(textChanged(QString)), this, SLOT(updateTable(QString)));
         disconnect(addButton, SIGNAL(pressed()), addWindow, SLOT(open()));
-        disconnect(entryTable, SIGNAL(cellDoubleClicked(int,int)), this, SLOT(copyCell(int,int)));
+        disconnect(entryTable, SIGNAL(doubleClicked(QModelIndex)), this, SLOT(copyCell(QModelIndex)));
+        disconnect(rotateButton, SIGNAL(pressed()), this, SLOT(rotateExpired()));
+        disconnect(regSelectionButton, SIGNAL(pressed()), this, SLOT(regSelection()));
+        disconnect(delSelectionButton, SIGNAL(pressed()), this, SLOT(delSelection()));
     }
     else if (rowEdited == row) // user validates modifications
     {
-        int indexToEdit = indexOf("entrynametoBeEdited", "usernametoBeEdited");
-
-        // Resetting entry and user names to read only
-        entryTable->item(row,0)->setFlags(Qt::ItemIsEnabled);
-        entryTable->item(row,1)->setFlags(Qt::ItemIsEnabled);
-        // Resetting validate icon to edit icon
-        entryTable->item(row,3)->setIcon(QIcon(":/edit"));
-        // Setting cell background to lightgrey
-        for (int col = 0 ; col < entryTable->columnCount() ; col++)
-            entryTable->item(row,col)->setBackground(QColor(255,255,255));
-
-        // Updating new entry and user names
-        entrynames[indexToEdit] = entryTable->item(row,0)->text();
-        usernames[indexToEdit] = entryTable->item(row,1)->text();
-
-        // Writing entries in file
-        if (pwm::writeEntries(loginWindow->getNewPassword(), entrynames, usernames, passwords, dates) != 0)
+        pwm::EntryId idToEdit = entryModel->editedId();
+        QString entryname = entries.field(idToEdit, pwm::ENTRY_NAME);
+        QString username = entries.field(idToEdit, pwm::ENTRY_USERNAME);
+        QString newEntryname = entryModel->editedField(pwm::ENTRY_NAME);
+        QString newUsername = entryModel->editedField(pwm::ENTRY_USERNAME);
+
+        // Entries are found by their names: two entries must not share them
+        const pwm::EntryId existingId = entries.find(newEntryname, newUsername);
+        if (existingId != ENTRY_NOID && existingId != idToEdit)
         {
-            // Error in file writing
-            QMessageBox::critical(
+            QMessageBox::warning(
                 this,
                 this->windowTitle(),
-                tr("Une erreur est survenue lors de l'enregistrement des entrées.\n"
-                   "L'entrée suivante n'a pas été modifiée:\n"
-                   "     %1\n"
-                   "     %2\n"
-                   "L'application doit être redémarrée pour recharger les entrées correctes."
-                   ).arg(entrynames[indexToEdit], usernames[indexToEdit])
+                tr("L'entrée existe déjà.\n"
+                   "Veuillez choisir un autre nom d'entrée ou d'utilisateur.")
                 );
-            close();
+            return; // entry is still being edited
         }
 
+        // Resetting entry and user names to read only, validate icon to edit icon and background to white
+        entryModel->stopEditing();
+
+        // Updating new entry and user names, saved in background
+        entries.begin();
+        entries.setField(idToEdit, pwm::ENTRY_NAME, newEntryname);
+        entries.setField(idToEdit, pwm::ENTRY_USERNAME, newUsername);
+        entries.commit();
+        saver->enqueue(pwm::JOURNAL_RENAME, {entryname.toUtf8(), username.toUtf8(), newEntryname.toUtf8(), newUsername.toUtf8()});
+        entryModel->entryChanged(idToEdit);
+
         // Re-enabling deletion, re-generation, search bar, buttons and cell copy
         connect(this, SIGNAL(delEntryClicked(int)), this, SLOT(delEntry(int)));
         connect(this, SIGNAL(regEntryClicked(int)), this, SLOT(openRegWindow(int)));
         connect(searchBar, SIGNAL(textChanged(QString)), this, SLOT(updateTable(QString)));
         connect(addButton, SIGNAL(pressed()), addWindow, SLOT(open()));
-        connect(entryTable, SIGNAL(cellDoubleClicked(int,int)), this, SLOT(copyCell(int,int)));
+        connect(entryTable, SIGNAL(doubleClicked(QModelIndex)), this, SLOT(copyCell(QModelIndex)));
+        connect(rotateButton, SIGNAL(pressed()), this, SLOT(rotateExpired()));
+        connect(regSelectionButton, SIGNAL(pressed()), this, SLOT(regSelection()));
+        connect(delSelectionButton, SIGNAL(pressed()), this, SLOT(delSelection()));
     }
     else // another entry is being modified
     {
+        pwm::EntryId idEdited = entryModel->editedId();
         QMessageBox::warning(
             this,
             this->windowTitle(),
@@ -513,82 +468,252 @@ void MainWindow::editEntry(const int row)
                "     %2\n"
                "est en cours de modification.\n"
                "Veuillez valider les modifications pour éditer une autre entrée."
-               ).arg(entryTable->item(rowEdited, 0)->text(), entryTable->item(rowEdited, 1)->text())
+               ).arg(entries.field(idEdited, pwm::ENTRY_NAME), entries.field(idEdited, pwm::ENTRY_USERNAME))
             );
     }
 }
 
-void MainWindow::addRow(const int entryIndex) const
+void MainWindow::rotateExpired()
 {
-    int row = entryTable->rowCount();
-    int nCols = entryTable->columnCount();
-
-    entryTable->insertRow(row);
+    std::vector<pwm::EntryId> expired;
+    for (int index = 0 ; index < entries.size() ; ++index)
+    {
+        const pwm::EntryId id = entries.id(index);
+        if (EntryTableModel::ageOf(entries.field(id, pwm::ENTRY_DATE)) == EntryTableModel::ExpiredAge)
+            expired.push_back(id);
+    }
 
-    if (entryIndex < 0)
+    if (expired.empty())
     {
-        for (int col = 0 ; col < nCols ; ++col)
-            entryTable->setItem(row,col,new QTableWidgetItem());
+        QMessageBox::information(
+            this,
+            this->windowTitle(),
+            tr("Aucun mot de passe n'a plus de 6 mois.")
+            );
+        return;
     }
-    else
+
+    int answer = QMessageBox::warning(
+        this,
+        tr("Re-générer les mots de passe expirés"),
+        tr("Les mots de passe de %1 entrées ont plus de 6 mois.\n"
+           "Chacun va être remplacé par un mot de passe de même longueur et de mêmes types de caractères.\n\n"
+           "Voulez-vous les re-générer ?"
+           ).arg(static_cast<int>(expired.size())),
+        QMessageBox::Ok,
+        QMessageBox::Cancel
+        );
+
+    if (answer == QMessageBox::Cancel) return;
+
+    if (regEntries(expired) != 0)
     {
-        entryTable->setItem(row,0,new QTableWidgetItem(iconFrom(dates[entryIndex]),entrynames[entryIndex]));
-        entryTable->setItem(row,1,new QTableWidgetItem(usernames[entryIndex]));
-        entryTable->setItem(row,2,new QTableWidgetItem(QString("***************")));
-        entryTable->setItem(row,3,new QTableWidgetItem(QIcon(":/edit"), QString()));
-        entryTable->setItem(row,4,new QTableWidgetItem(QIcon(":/regenerate"), QString()));
-        entryTable->setItem(row,5,new QTableWidgetItem(QIcon(":/delete"), QString()));
-        entryTable->setRowHeight(row,20);
+        QMessageBox::critical(
+            this,
+            this->windowTitle(),
+            tr("Une erreur est survenue lors de la génération des mots de passe.\n"
+               "Aucun mot de passe n'a été re-généré.")
+            );
+        return;
     }
 
-    // Disabling modification for each cell
-    for (int col = 0 ; col < nCols ; ++col)
-        entryTable->item(row,col)->setFlags(Qt::ItemIsEnabled);
+    QMessageBox::information(
+        this,
+        this->windowTitle(),
+        tr("%1 mots de passe re-générés avec succès.").arg(static_cast<int>(expired.size()))
+        );
 }
 
-QIcon MainWindow::iconFrom(const QString &date) const
+void MainWindow::regSelection()
 {
-    QDate currentDate = QDate::currentDate();
-    QDate pwdDate = QDate::fromString(date, "yyyy.MM.dd");
-    int monthDifference = 0; // number of months separating [currentDate] from [pwdDate]
+    const std::vector<pwm::EntryId> selected = selectedEntries();
+    if (selected.empty()) return;
 
-    if (pwdDate.isNull())
+    int answer = QMessageBox::warning(
+        this,
+        tr("Re-générer la sélection"),
+        tr("Les mots de passe des %1 entrées sélectionnées vont être remplacés par des mots de passe\n"
+           "de même longueur et de mêmes types de caractères.\n\n"
+           "Voulez-vous les re-générer ?"
+           ).arg(static_cast<int>(selected.size())),
+        QMessageBox::Ok,
+        QMessageBox::Cancel
+        );
+
+    if (answer == QMessageBox::Cancel) return;
+
+    if (regEntries(selected) != 0)
     {
-        // Date format is incorrect
-        qWarning() << "Date format of " << date << "is incorrect. Date icon will not appear.";
-        return QIcon();
+        QMessageBox::critical(
+            this,
+            this->windowTitle(),
+            tr("Une erreur est survenue lors de la génération des mots de passe.\n"
+               "Aucun mot de passe n'a été re-généré.")
+            );
+        return;
     }
 
-    monthDifference = (currentDate.year() - pwdDate.year()) * 12 + (currentDate.month() - pwdDate.month());
+    QMessageBox::information(
+        this,
+        this->windowTitle(),
+        tr("%1 mots de passe re-générés avec succès.").arg(static_cast<int>(selected.size()))
+        );
+}
 
-    if (monthDifference < 3) return QIcon(":/green");
-    else if (monthDifference < 6) return QIcon(":/orange");
+void MainWindow::delSelection()
+{
+    const std::vector<pwm::EntryId> selected = selectedEntries();
+    if (selected.empty()) return;
 
-    return QIcon(":/red");
+    int answer = QMessageBox::warning(
+        this,
+        tr("Supprimer la sélection"),
+        tr("Les %1 entrées sélectionnées vont être supprimées.\n\n"
+           "Voulez-vous vraiment les supprimer ?"
+           ).arg(static_cast<int>(selected.size())),
+        QMessageBox::Ok,
+        QMessageBox::Cancel
+        );
+
+    if (answer == QMessageBox::Cancel) return;
+
+    // Removing every entry in a single mutation, saved at once
+    entries.begin();
+    for (const pwm::EntryId id : selected)
+        entries.remove(id);
+    entries.commit();
+    saver->enqueueRewrite();
+
+    entryModel->reload();
+
+    QMessageBox::information(
+        this,
+        this->windowTitle(),
+        tr("%1 entrées supprimées avec succès.").arg(static_cast<int>(selected.size()))
+        );
 }
 
-const int MainWindow::indexOf(const QString &entryname, const QString &username) const
+void MainWindow::updateSelectionButtons()
 {
-    int currentIndex = entrynames.indexOf(entryname);
+    const bool hasSelection = entryTable->selectionModel()->hasSelection();
 
-    while (currentIndex != -1)
+    regSelectionButton->setEnabled(hasSelection);
+    delSelectionButton->setEnabled(hasSelection);
+}
+
+std::vector<pwm::EntryId> MainWindow::selectedEntries() const
+{
+    std::vector<pwm::EntryId> ids;
+
+    const QModelIndexList rows = entryTable->selectionModel()->selectedRows();
+    ids.reserve(rows.size());
+    for (const QModelIndex &row : rows)
     {
-        if (usernames[currentIndex] == username) return currentIndex;
-        currentIndex = entrynames.indexOf(entryname, currentIndex+1);
+        const pwm::EntryId id = entryModel->entryAt(row.row());
+        if (id != ENTRY_NOID) ids.push_back(id);
     }
 
-    return -1;
+    return ids;
 }
 
-const int MainWindow::entryRowBeingEdited() const
+int MainWindow::regEntries(const std::vector<pwm::EntryId> &ids)
 {
-    for (int row = 0 ; row < entryTable->rowCount() ; row++)
+    // Grouping entries by policy of their current password
+    std::map<std::tuple<int, unsigned int, bool>, std::vector<pwm::EntryId>> groups;
+    for (const pwm::EntryId id : ids)
     {
-        // Entry and user names can be edited at the same time,
-        // so checking entry name is enough.
-        if (entryTable->item(row, 0)->flags() == (Qt::ItemIsEnabled | Qt::ItemIsEditable))
-            return row;
+        // Current password is only opened to infer its policy
+        pwm::OpenedPassword password;
+        if (password.open(sessionKey, entries.view(id, pwm::ENTRY_PASSWORD)) != 0)
+        {
+            qCritical() << "Failed to open password. Kept every entry with its old password.";
+            return -1;
+        }
+        pwm::PasswordPolicy policy = pwm::passwordPolicyOf(password.view());
+        if (policy.length > PASSWORD_MAXLEN) policy.length = PASSWORD_MAXLEN;
+        groups[std::make_tuple(policy.length, policy.classes, policy.everyClass)].push_back(id);
     }
 
-    return -1;
+    const std::string date = QDate::currentDate().toString("yyyy.MM.dd").toStdString();
+
+    // Replacing every password in a single mutation, kept only if all were generated
+    QByteArray sealedPassword;
+    entries.begin();
+
+    for (const auto &group : groups)
+    {
+        pwm::PasswordPolicy policy;
+        std::tie(policy.length, policy.classes, policy.everyClass) = group.first;
+        const std::vector<pwm::EntryId> &groupIds = group.second;
+
+        // Generating passwords of the whole group at once, in locked memory
+        const size_t size = groupIds.size() * policy.length;
+        char *passwords = static_cast<char *>(sodium_malloc(size));
+        if (passwords == NULL
+            || pwm::generatePasswords(policy, static_cast<int>(groupIds.size()), passwords) != 0)
+        {
+            qCritical() << "Failed to generate passwords. Kept every entry with its old password.";
+            if (passwords != NULL) sodium_free(passwords);
+            entries.rollback();
+            return -1;
+        }
+
+        for (size_t entry = 0 ; entry < groupIds.size() ; ++entry)
+        {
+            if (pwm::sealPassword(sessionKey, std::string_view(passwords + entry * policy.length, policy.length), sealedPassword) != 0)
+            {
+                qCritical() << "Failed to seal passwords. Kept every entry with its old password.";
+                sodium_free(passwords);
+                entries.rollback();
+                return -1;
+            }
+            entries.setField(groupIds[entry], pwm::ENTRY_PASSWORD, std::string_view(sealedPassword.constData(), sealedPassword.size()));
+            entries.setField(groupIds[entry], pwm::ENTRY_DATE, std::string_view(date));
+        }
+
+        sodium_free(passwords); // zeroes memory before releasing it
+    }
+
+    entries.commit();
+    saver->enqueueRewrite();
+
+    for (const pwm::EntryId id : ids)
+        entryModel->entryChanged(id);
+
+    return 0;
+}
+
+void MainWindow::saveFailed()
+{
+    QMessageBox::critical(
+        this,
+        this->windowTitle(),
+        tr("Une erreur est survenue lors de l'enregistrement des entrées.\n"
+           "Les dernières modifications n'ont pas été enregistrées.\n"
+           "Elles seront de nouveau enregistrées lors de la prochaine modification\n"
+           "ou à la fermeture de l'application.")
+        );
+}
+
+void MainWindow::closeEvent(QCloseEvent *event)
+{
+    // Waiting for changes being saved, and saving queued ones
+    if (saver->flush())
+    {
+        event->accept();
+        return;
+    }
+
+    int answer = QMessageBox::warning(
+        this,
+        this->windowTitle(),
+        tr("Les dernières modifications n'ont pas pu être enregistrées.\n"
+           "Elles seront perdues si l'application est fermée.\n\n"
+           "Voulez-vous vraiment quitter ?"),
+        QMessageBox::Ok,
+        QMessageBox::Cancel
+        );
+
+    if (answer == QMessageBox::Cancel) event->ignore();
+    else event->accept();
 }
@@ -8,25 +8,40 @@
 #include <QMainWindow>
 #include <QIcon>
 #include <QVBoxLayout>
+#include <QHBoxLayout>
 #include <QPushButton>
 #include <QLineEdit>
 #include <QCompleter>
 #include <QStringListModel>
 #include <QSize>
-#include <QTableWidget>
-#include <QTableWidgetItem>
+#include <QTableView>
+#include <QModelIndex>
+#include <QItemSelectionModel>
 #include <QHeaderView>
 #include <QString>
 #include <QStringList>
 #include <QClipboard>
 #include <QDate>
 #include <QMessageBox>
+#include <QCloseEvent>
+#include <QFutureWatcher>
+#include <QtConcurrent>
 #include <QDebug>
 
+#include <map>
+#include <tuple>
+#include <vector>
+
 #include "pwmsecurity.h"
+#include "pwmjournal.h"
+#include "pwmpasswordgenerator.h"
+#include "pwmsealedpassword.h"
 #include "loginwindow.h"
 #include "addentrywindow.h"
 #include "regentrywindow.h"
+#include "entrytablemodel.h"
+#include "entryitemdelegate.h"
+#include "entrysaver.h"
 
 
 class MainWindow : public QMainWindow
@@ -40,33 +55,40 @@ public:
 private slots:
     /**
      * @brief Copy username or password to clipboard.
-     * @param row: Selected row of entry table.
-     * @param col: Selected column of entry table.
+     * @param index: Double clicked cell of entry table.
      *
      * Called when a cell is double clicked.
-     * Works only for col == 1 and col == 2.
+     * Works only for user name and password columns.
+     * Password is only decrypted for the copy (see pwm::OpenedPassword).
      */
-    void copyCell(const int row, const int col) const;
+    void copyCell(const QModelIndex &index);
     /**
      * @brief Execute the action corresponding to the cell clicked.
-     * @param row: Row index of the clicked cell.
-     * @param col: Column index of the clicked cell.
+     * @param index: Clicked cell of entry table.
      *
-     * Works only for col == 3 | 4 | 5.
+     * Works only for edit, re-generate and delete columns.
      */
-    void buttonFromCell(const int row, const int col);
+    void buttonFromCell(const QModelIndex &index);
     /**
-     * @brief Fill the table with all entries.
+     * @brief Display all entries.
      * Called when the table needs to be reset.
      */
     void updateTable() const;
     /**
-     * @brief Fills the table only with entries corresponding to given entry name.
-     * @param entryname: name of entries to display.
+     * @brief Display only entries whose entry or user name fuzzy matches given text (ignoring case), best first.
+     * @param query: Text typed in search bar.
+     *
+     * Called when search bar text changes.
+     * Only the ids of displayed entries are gathered: rows are painted when visible.
+     */
+    void updateTable(const QString &query) const;
+    /**
+     * @brief Fill search completer with entry names starting with given text (ignoring case).
+     * @param prefix: Text typed in search bar.
      *
-     * Called when an entry name is selected by auto-completion.
+     * Called when search bar text is edited, before completer handles it.
      */
-    void updateTable(const QString &entryname) const;
+    void updateCompletions(const QString &prefix) const;
 
     /**
      * @brief Open window responsible for re-generating an enrty.
@@ -76,25 +98,29 @@ private slots:
     void openRegWindow(const int row) const;
 
     /**
-     * @brief Load entries from entries file and store each field in corresponding string list.
-     * Entries file is re-encrypted in case master password has changed.
+     * @brief Display entries read from entries file.
+     * Entries are decrypted by [loginWindow] unlock worker. Entries file is re-encrypted
+     * only if a data key has been generated (files written before key files) or if entries
+     * file has a previous format version; a new master password only re-wraps data key.
+     * If unlocking was much faster or slower than CRYPTO_UNLOCK_TARGET_MS, crypto parameters
+     * are calibrated and a new key is derived on a worker thread (see pwm::prepareRekey()).
      * Called when [loginwindow] is accepted.
      */
     void loadEntries();
     /**
-     * @brief Add an entry to string lists, write entries in file, and update table.
+     * @brief Add an entry, queue it for saving, and update table.
      * Called when [addWindow] is accepted.
      * @note Check if entry already exists.
      */
     void addEntry();
     /**
-     * @brief Remove an entry from string lists attributes, write entries in file, and update table.
+     * @brief Remove an entry, queue deletion for saving, and update table.
      * @param row: Row index of the entry to be deleted.
      * Called when delete cell of an entry is clicked.
      */
     void delEntry(const int row);
     /**
-     * @brief Re-generate a password for given entry and username, and write entries in file.
+     * @brief Re-generate a password for given entry and username, and queue it for saving.
      * Called when [regWindow] is accepted.
      * @note Given entry should exist due to [regwindow] verifications.
      */
@@ -105,9 +131,45 @@ private slots:
      * Called when the edit cell of an entry is clicked.
      * Disconnect searchbar text changed, buttons and cell copy signals to avoid
      * conflicts while editing an entry.
-     * @note Close the window if a problem occurs while writing in file.
      */
     void editEntry(const int row);
+    /**
+     * @brief Re-generate passwords of every entry older than 6 months (red icon), after confirmation.
+     * Called when rotate button is pressed.
+     */
+    void rotateExpired();
+    /**
+     * @brief Re-generate passwords of selected entries, after confirmation.
+     * Called when re-generate selection button is pressed.
+     */
+    void regSelection();
+    /**
+     * @brief Remove selected entries, after confirmation, and save them all at once.
+     * Called when delete selection button is pressed.
+     */
+    void delSelection();
+    /**
+     * @brief Enable selection buttons only if entries are selected.
+     * Called when table selection changes.
+     */
+    void updateSelectionButtons();
+    /**
+     * @brief Re-wrap data key with the key derived by rekey worker.
+     * Called when rekey worker has finished. Current key is kept if rekey is not needed or fails.
+     * @see pwm::rewrapVault()
+     */
+    void rekeyFinished();
+    /**
+     * @brief Warn user that last changes are not saved yet.
+     * Called when [saver] fails to save changes.
+     */
+    void saveFailed();
+
+protected:
+    /**
+     * @brief Save queued changes before closing, and ask user to confirm if they cannot be saved.
+     */
+    void closeEvent(QCloseEvent *event) override;
 
 signals:
     /**
@@ -131,6 +193,8 @@ signals:
 
 private:
     QClipboard *clipboard;
+    bool passwordCopied = false; // true once a password was copied to [clipboard]
+    unsigned char copiedPasswordHash[crypto_generichash_BYTES]; // hash of last copied password, to clear clipboard on exit
 
     const QSize windowSize = QSize(500,600);
 
@@ -140,50 +204,46 @@ private:
 
     QPushButton *addButton;
 
+    QHBoxLayout *selectionLayout;
+    QPushButton *rotateButton;       // re-generates every expired password
+    QPushButton *regSelectionButton; // re-generates passwords of selected entries
+    QPushButton *delSelectionButton; // removes selected entries
+
     QLineEdit *searchBar;
     QCompleter *searchCompleter;
-    QStringListModel *searchModel; // must be updated whenever [entrynames] is updated
+    QStringListModel *searchModel; // completions of search bar text, see updateCompletions()
+    const int maxCompletions = 20;
 
-    QTableWidget *entryTable;
+    QTableView *entryTable;
+    EntryTableModel *entryModel;       // must be notified whenever [entries] is updated
+    EntryItemDelegate *entryDelegate;  // paints buttons of [entryTable]
 
     LoginWindow *loginWindow; // window responsible for authentification. Shows only on start.
     AddEntryWindow *addWindow; // window responsible for adding entries
     RegEntryWindow *regWindow; // window responsible for re-generate entries password
 
-    QStringList entrynames;
-    QStringList usernames;
-    QStringList passwords;
-    QStringList dates;
+    pwm::SessionKey sessionKey; // derived at unlock, used for every entries file read and write
 
-    /**
-     * @brief Add a row to the entry table.
-     * @param entryIndex: Index of the entry to display.
-     */
-    void addRow(const int entryIndex) const;
+    pwm::EntryStore entries; // filled by [loginWindow] unlock worker
 
-    /**
-     * @brief Return an icon corresponding to an entry's date of creation.
-     * @param date: date of creation of the entry. Expected format: "yyyy.MM.dd".
-     * @return Green icon if date is okay; Orange icon if date is about to be passed; Red icon otherwise.
-     *
-     * Red icon: date is passed (more than 6 months);
-     * Orange icon: date is about to be passed (bwt. 3 and 6 months);
-     * Green icon: date is okay (less than 3 months).
-     */
-    QIcon iconFrom(const QString &date) const;
+    std::shared_ptr<QLockFile> vaultLock; // keeps other processes out of the vault until exit
+
+    EntrySaver *saver; // saves changes of [entries] in background, must be given every committed change
+    QFutureWatcher<pwm::RekeyResult> *rekeyWatcher; // derives key with calibrated crypto parameters after unlock
 
     /**
-     * @brief Give the string list index corresponding to entry and user names.
-     * @param entryname: Name of the entry.
-     * @param username: Name of the user.
-     * @return Index of corresponding entry and user names; -1 if entry does not exist.
+     * @return Ids of the entries selected in table.
      */
-    const int indexOf(const QString& entryname, const QString &username) const;
-
+    std::vector<pwm::EntryId> selectedEntries() const;
     /**
-     * @brief Returns the row index of the entry being edited by user.
-     * @return Row index if a row is being edited; -1 other wise.
+     * @brief Re-generate passwords of several entries in a single transaction, saved at once.
+     * @param ids: Entries whose password is replaced.
+     * @return 0 if every password was re-generated; -1 if none was.
+     *
+     * Each new password keeps the length and classes of characters of the password it replaces
+     * (see pwm::passwordPolicyOf()). Entries sharing a policy get their passwords from a single
+     * pwm::generatePasswords() call.
      */
-    const int entryRowBeingEdited() const;
+    int regEntries(const std::vector<pwm::EntryId> &ids);
 };
 #endif // MAINWINDOW_H
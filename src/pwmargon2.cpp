@@ -0,0 +1,412 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "pwmargon2.h"
+
+#include <QtEndian>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace pwm {
+
+namespace {
+
+struct Block
+{
+    quint64 v[ARGON2_BLOCKWORDS];
+};
+
+/**
+ * @brief Memory and position shared by the segments of a derivation.
+ */
+struct Instance
+{
+    Block *memory;
+    quint32 passes;
+    quint32 lanes;
+    quint32 laneLength;    // blocks per lane
+    quint32 segmentLength; // blocks per lane and slice
+    quint32 memoryBlocks;  // laneLength * lanes
+};
+
+/**
+ * @brief Segment filled by a single thread: one lane of one slice.
+ */
+struct Segment
+{
+    quint32 pass;
+    quint32 lane;
+    quint32 slice;
+};
+
+inline quint64 rotr64(const quint64 w, const unsigned int c)
+{
+    return (w >> c) | (w << (64 - c));
+}
+
+// BlaMka: BLAKE2b addition with a 32-bit multiplication, see RFC 9106 section 3.6
+inline quint64 fBlaMka(const quint64 x, const quint64 y)
+{
+    const quint64 m = 0xFFFFFFFFull;
+    return x + y + 2 * ((x & m) * (y & m));
+}
+
+inline void gb(quint64 &a, quint64 &b, quint64 &c, quint64 &d)
+{
+    a = fBlaMka(a, b); d = rotr64(d ^ a, 32);
+    c = fBlaMka(c, d); b = rotr64(b ^ c, 24);
+    a = fBlaMka(a, b); d = rotr64(d ^ a, 16);
+    c = fBlaMka(c, d); b = rotr64(b ^ c, 63);
+}
+
+// Permutation P over 16 words (BLAKE2b round without message)
+inline void permute(quint64 &v0, quint64 &v1, quint64 &v2, quint64 &v3,
+                    quint64 &v4, quint64 &v5, quint64 &v6, quint64 &v7,
+                    quint64 &v8, quint64 &v9, quint64 &v10, quint64 &v11,
+                    quint64 &v12, quint64 &v13, quint64 &v14, quint64 &v15)
+{
+    gb(v0, v4, v8, v12);
+    gb(v1, v5, v9, v13);
+    gb(v2, v6, v10, v14);
+    gb(v3, v7, v11, v15);
+    gb(v0, v5, v10, v15);
+    gb(v1, v6, v11, v12);
+    gb(v2, v7, v8, v13);
+    gb(v3, v4, v9, v14);
+}
+
+/**
+ * @brief Compression function G: [next] = G([prev], [ref]), XORed with previous [next] if [withXor].
+ */
+void fillBlock(const Block &prev, const Block &ref, Block &next, const bool withXor)
+{
+    Block r;
+    Block tmp;
+
+    for (int i = 0 ; i < ARGON2_BLOCKWORDS ; ++i)
+        r.v[i] = prev.v[i] ^ ref.v[i];
+    tmp = r;
+    if (withXor)
+    {
+        for (int i = 0 ; i < ARGON2_BLOCKWORDS ; ++i)
+            tmp.v[i] ^= next.v[i];
+    }
+
+    // Rows of 16 words
+    for (int i = 0 ; i < 8 ; ++i)
+    {
+        quint64 *v = r.v + 16 * i;
+        permute(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7],
+                v[8], v[9], v[10], v[11], v[12], v[13], v[14], v[15]);
+    }
+    // Columns of 16 words (pairs of words)
+    for (int i = 0 ; i < 8 ; ++i)
+    {
+        quint64 *v = r.v + 2 * i;
+        permute(v[0], v[1], v[16], v[17], v[32], v[33], v[48], v[49],
+                v[64], v[65], v[80], v[81], v[96], v[97], v[112], v[113]);
+    }
+
+    for (int i = 0 ; i < ARGON2_BLOCKWORDS ; ++i)
+        next.v[i] = tmp.v[i] ^ r.v[i];
+
+    sodium_memzero(&r, sizeof r);
+    sodium_memzero(&tmp, sizeof tmp);
+}
+
+/**
+ * @brief Variable-length hash function H' (RFC 9106 section 3.3).
+ */
+void hashLong(unsigned char *out, const size_t outlen, const unsigned char *in, const size_t inlen)
+{
+    crypto_generichash_state state;
+    unsigned char outlenBytes[sizeof(quint32)];
+    qToLittleEndian<quint32>(static_cast<quint32>(outlen), outlenBytes);
+
+    if (outlen <= crypto_generichash_BYTES_MAX)
+    {
+        crypto_generichash_init(&state, NULL, 0, outlen);
+        crypto_generichash_update(&state, outlenBytes, sizeof outlenBytes);
+        crypto_generichash_update(&state, in, inlen);
+        crypto_generichash_final(&state, out, outlen);
+        return;
+    }
+
+    // Chained 64-byte hashes V1..Vr, of which first 32 bytes are output, then a last hash of remaining length
+    const size_t r = (outlen + 31) / 32 - 2;
+    unsigned char v[crypto_generichash_BYTES_MAX];
+    unsigned char next[crypto_generichash_BYTES_MAX];
+    crypto_generichash_init(&state, NULL, 0, sizeof v);
+    crypto_generichash_update(&state, outlenBytes, sizeof outlenBytes);
+    crypto_generichash_update(&state, in, inlen);
+    crypto_generichash_final(&state, v, sizeof v);
+
+    size_t written = 0;
+    for (size_t i = 1 ; i < r ; ++i)
+    {
+        memcpy(out + written, v, sizeof v / 2);
+        written += sizeof v / 2;
+        crypto_generichash(next, sizeof next, v, sizeof v, NULL, 0);
+        memcpy(v, next, sizeof v);
+    }
+    memcpy(out + written, v, sizeof v / 2);
+    written += sizeof v / 2;
+    crypto_generichash(out + written, outlen - written, v, sizeof v, NULL, 0);
+
+    sodium_memzero(v, sizeof v);
+    sodium_memzero(next, sizeof next);
+}
+
+void loadBlock(Block &block, const unsigned char bytes[ARGON2_BLOCKBYTES])
+{
+    for (int i = 0 ; i < ARGON2_BLOCKWORDS ; ++i)
+        block.v[i] = qFromLittleEndian<quint64>(bytes + 8 * i);
+}
+
+void storeBlock(unsigned char bytes[ARGON2_BLOCKBYTES], const Block &block)
+{
+    for (int i = 0 ; i < ARGON2_BLOCKWORDS ; ++i)
+        qToLittleEndian<quint64>(block.v[i], bytes + 8 * i);
+}
+
+/**
+ * @brief Position of the reference block within its lane (RFC 9106 section 3.4.1.2).
+ */
+quint32 indexAlpha(const Instance &instance, const Segment &segment, const quint32 index, const quint32 pseudoRand, const bool sameLane)
+{
+    quint64 referenceAreaSize;
+
+    if (segment.pass == 0)
+    {
+        if (segment.slice == 0)
+            referenceAreaSize = index - 1; // previous blocks of this segment
+        else if (sameLane)
+            referenceAreaSize = segment.slice * instance.segmentLength + index - 1;
+        else
+            referenceAreaSize = segment.slice * instance.segmentLength - (index == 0 ? 1 : 0);
+    }
+    else
+    {
+        if (sameLane)
+            referenceAreaSize = instance.laneLength - instance.segmentLength + index - 1;
+        else
+            referenceAreaSize = instance.laneLength - instance.segmentLength - (index == 0 ? 1 : 0);
+    }
+
+    // Non-uniform mapping favouring recent blocks
+    quint64 relativePosition = pseudoRand;
+    relativePosition = (relativePosition * relativePosition) >> 32;
+    relativePosition = referenceAreaSize - 1 - ((referenceAreaSize * relativePosition) >> 32);
+
+    const quint64 startPosition = (segment.pass != 0 && segment.slice != ARGON2_SYNC_POINTS - 1)
+        ? static_cast<quint64>(segment.slice + 1) * instance.segmentLength
+        : 0;
+
+    return static_cast<quint32>((startPosition + relativePosition) % instance.laneLength);
+}
+
+/**
+ * @brief Fill one segment. Segments of a slice only read blocks of previous slices
+ * (or their own), so that they can be filled at the same time.
+ */
+void fillSegment(const Instance &instance, const Segment &segment)
+{
+    // Argon2id: data-independent addressing in first half of first pass
+    const bool dataIndependent = (segment.pass == 0 && segment.slice < ARGON2_SYNC_POINTS / 2);
+
+    Block zero = {};
+    Block input = {};
+    Block addresses = {};
+
+    if (dataIndependent)
+    {
+        input.v[0] = segment.pass;
+        input.v[1] = segment.lane;
+        input.v[2] = segment.slice;
+        input.v[3] = instance.memoryBlocks;
+        input.v[4] = instance.passes;
+        input.v[5] = ARGON2_TYPE_ID;
+    }
+
+    auto nextAddresses = [&]() {
+        ++input.v[6];
+        fillBlock(zero, input, addresses, false);
+        fillBlock(zero, addresses, addresses, false);
+    };
+
+    // First two blocks of each lane are computed from H0
+    quint32 startingIndex = 0;
+    if (segment.pass == 0 && segment.slice == 0)
+    {
+        startingIndex = 2;
+        if (dataIndependent) nextAddresses();
+    }
+
+    quint32 currentOffset = segment.lane * instance.laneLength + segment.slice * instance.segmentLength + startingIndex;
+    quint32 previousOffset = (currentOffset % instance.laneLength == 0)
+        ? currentOffset + instance.laneLength - 1
+        : currentOffset - 1;
+
+    for (quint32 index = startingIndex ; index < instance.segmentLength ; ++index, ++currentOffset, ++previousOffset)
+    {
+        if (currentOffset % instance.laneLength == 1) previousOffset = currentOffset - 1;
+
+        quint64 pseudoRand;
+        if (dataIndependent)
+        {
+            if (index % ARGON2_BLOCKWORDS == 0) nextAddresses();
+            pseudoRand = addresses.v[index % ARGON2_BLOCKWORDS];
+        }
+        else
+            pseudoRand = instance.memory[previousOffset].v[0];
+
+        quint32 referenceLane = static_cast<quint32>((pseudoRand >> 32) % instance.lanes);
+        if (segment.pass == 0 && segment.slice == 0) referenceLane = segment.lane;
+
+        const quint32 referenceIndex = indexAlpha(instance, segment, index, static_cast<quint32>(pseudoRand), referenceLane == segment.lane);
+        const Block &reference = instance.memory[static_cast<size_t>(instance.laneLength) * referenceLane + referenceIndex];
+
+        // Blocks are XORed with their previous value from the second pass (version 0x13)
+        fillBlock(instance.memory[previousOffset], reference, instance.memory[currentOffset], segment.pass != 0);
+    }
+
+    sodium_memzero(&addresses, sizeof addresses);
+}
+
+} // namespace
+
+int argon2id(unsigned char *out, const size_t outlen,
+             const void *password, const size_t passwordlen,
+             const unsigned char *salt, const size_t saltlen,
+             const quint32 passes, const quint32 memoryKiB, const quint32 lanes,
+             const unsigned char *secret, const size_t secretlen,
+             const unsigned char *ad, const size_t adlen)
+{
+    if (outlen < 4 || outlen > 0xFFFFFFFFu || saltlen < 8 || passes < 1
+        || lanes < ARGON2_MINLANES || lanes > ARGON2_MAXLANES
+        || memoryKiB < 2 * ARGON2_SYNC_POINTS * lanes)
+    {
+        qCritical() << "Invalid Argon2id parameters. Aborted key derivation.";
+        return -1;
+    }
+
+    Instance instance;
+    instance.passes = passes;
+    instance.lanes = lanes;
+    instance.segmentLength = memoryKiB / (lanes * ARGON2_SYNC_POINTS);
+    instance.laneLength = instance.segmentLength * ARGON2_SYNC_POINTS;
+    instance.memoryBlocks = instance.laneLength * lanes;
+
+    // Blocks hold password-derived state: guarded, locked memory, wiped on release
+    const size_t memorySize = static_cast<size_t>(instance.memoryBlocks) * sizeof(Block);
+    instance.memory = static_cast<Block *>(sodium_malloc(memorySize));
+    if (instance.memory == nullptr)
+    {
+        qCritical() << "Failed to allocate Argon2id memory. Aborted key derivation.";
+        return -1;
+    }
+
+    // H0: hash of every parameter and input, followed by room for block position
+    unsigned char h0[crypto_generichash_BYTES_MAX + 2 * sizeof(quint32)];
+    crypto_generichash_state state;
+    auto hashWord = [&state](const quint32 word) {
+        unsigned char bytes[sizeof(quint32)];
+        qToLittleEndian<quint32>(word, bytes);
+        crypto_generichash_update(&state, bytes, sizeof bytes);
+    };
+    auto hashField = [&state, &hashWord](const void *data, const size_t length) {
+        hashWord(static_cast<quint32>(length));
+        if (length > 0) crypto_generichash_update(&state, static_cast<const unsigned char *>(data), length);
+    };
+
+    crypto_generichash_init(&state, NULL, 0, crypto_generichash_BYTES_MAX);
+    hashWord(lanes);
+    hashWord(static_cast<quint32>(outlen));
+    hashWord(memoryKiB);
+    hashWord(passes);
+    hashWord(ARGON2_VERSION);
+    hashWord(ARGON2_TYPE_ID);
+    hashField(password, passwordlen);
+    hashField(salt, saltlen);
+    hashField(secret, secret != nullptr ? secretlen : 0);
+    hashField(ad, ad != nullptr ? adlen : 0);
+    crypto_generichash_final(&state, h0, crypto_generichash_BYTES_MAX);
+
+    // First two blocks of each lane
+    unsigned char blockBytes[ARGON2_BLOCKBYTES];
+    for (quint32 lane = 0 ; lane < lanes ; ++lane)
+    {
+        for (quint32 index = 0 ; index < 2 ; ++index)
+        {
+            qToLittleEndian<quint32>(index, h0 + crypto_generichash_BYTES_MAX);
+            qToLittleEndian<quint32>(lane, h0 + crypto_generichash_BYTES_MAX + sizeof(quint32));
+            hashLong(blockBytes, sizeof blockBytes, h0, sizeof h0);
+            loadBlock(instance.memory[static_cast<size_t>(lane) * instance.laneLength + index], blockBytes);
+        }
+    }
+
+    // Lanes of each slice are filled at the same time, slices one after the other
+    std::vector<Segment> segments(lanes);
+    for (quint32 pass = 0 ; pass < passes ; ++pass)
+    {
+        for (quint32 slice = 0 ; slice < ARGON2_SYNC_POINTS ; ++slice)
+        {
+            for (quint32 lane = 0 ; lane < lanes ; ++lane)
+                segments[lane] = {pass, lane, slice};
+
+            if (lanes == 1)
+                fillSegment(instance, segments[0]);
+            else
+                QtConcurrent::blockingMap(segments, [&instance](Segment &segment) { fillSegment(instance, segment); });
+        }
+    }
+
+    // Final block: XOR of last block of each lane
+    Block final = instance.memory[instance.laneLength - 1];
+    for (quint32 lane = 1 ; lane < lanes ; ++lane)
+    {
+        const Block &last = instance.memory[static_cast<size_t>(lane) * instance.laneLength + instance.laneLength - 1];
+        for (int i = 0 ; i < ARGON2_BLOCKWORDS ; ++i)
+            final.v[i] ^= last.v[i];
+    }
+    storeBlock(blockBytes, final);
+    hashLong(out, outlen, blockBytes, sizeof blockBytes);
+
+    sodium_memzero(blockBytes, sizeof blockBytes);
+    sodium_memzero(&final, sizeof final);
+    sodium_memzero(h0, sizeof h0);
+    sodium_free(instance.memory); // also zeroes memory
+    return 0;
+}
+
+int argon2idSelfTest()
+{
+    // RFC 9106 section 5.3
+    unsigned char password[32];
+    unsigned char salt[16];
+    unsigned char secret[8];
+    unsigned char ad[12];
+    unsigned char tag[32];
+    static const unsigned char expected[32] = {
+        0x0d, 0x64, 0x0d, 0xf5, 0x8d, 0x78, 0x76, 0x6c, 0x08, 0xc0, 0x37, 0xa3, 0x4a, 0x8b, 0x53, 0xc9,
+        0xd0, 0x1e, 0xf0, 0x45, 0x2d, 0x75, 0xb6, 0x5e, 0xb5, 0x25, 0x20, 0xe9, 0x6b, 0x01, 0xe6, 0x59
+    };
+
+    memset(password, 0x01, sizeof password);
+    memset(salt, 0x02, sizeof salt);
+    memset(secret, 0x03, sizeof secret);
+    memset(ad, 0x04, sizeof ad);
+
+    if (argon2id(tag, sizeof tag, password, sizeof password, salt, sizeof salt, 3, 32, 4, secret, sizeof secret, ad, sizeof ad) != 0
+        || sodium_memcmp(tag, expected, sizeof tag) != 0)
+    {
+        qCritical() << "Argon2id implementation does not match RFC 9106 test vector.";
+        return -1;
+    }
+
+    return 0;
+}
+
+} // namespace pwm
@@ -0,0 +1,70 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMARGON2_H
+#define PWMARGON2_H
+
+#include <QtGlobal>
+#include <QDebug>
+
+#include <sodium.h>
+
+// Argon2 block size (bytes) and number of 64-bit words per block
+#define ARGON2_BLOCKBYTES 1024
+#define ARGON2_BLOCKWORDS 128
+
+// Each pass over memory is split into this many slices; lanes are synchronised between slices
+#define ARGON2_SYNC_POINTS 4
+
+#define ARGON2_VERSION 0x13
+#define ARGON2_TYPE_ID 2 // Argon2id
+
+// Bounds of lane count accepted by argon2id()
+#define ARGON2_MINLANES 1
+#define ARGON2_MAXLANES 0xFFFFFF
+
+
+namespace pwm {
+
+/**
+ * @brief Derive a key with Argon2id (RFC 9106), filling lanes in parallel.
+ *
+ * @param out: Array where derived key is going to be stored.
+ * @param outlen: Length of derived key (at least 4 bytes).
+ * @param password: Password bytes.
+ * @param passwordlen: Length of [password].
+ * @param salt: Salt bytes.
+ * @param saltlen: Length of [salt] (at least 8 bytes).
+ * @param passes: Number of passes over memory (t, at least 1).
+ * @param memoryKiB: Memory size in KiB (m, at least 8 * [lanes]).
+ * @param lanes: Degree of parallelism (p).
+ * @param secret: Optional secret value (K), may be null.
+ * @param secretlen: Length of [secret].
+ * @param ad: Optional associated data (X), may be null.
+ * @param adlen: Length of [ad].
+ * @return 0 if successfully derived key; -1 otherwise (invalid parameters or not enough memory).
+ *
+ * libsodium crypto_pwhash() only fills a single lane (p = 1): this backend lets multi-core
+ * machines afford more memory for the same derivation time. Segments of each slice are
+ * filled on the global thread pool, one per lane, the calling thread taking part.
+ * With a single lane, result is the same as crypto_pwhash() with crypto_pwhash_ALG_ARGON2ID13
+ * and [memoryKiB] * 1024 bytes.
+ */
+int argon2id(unsigned char *out, const size_t outlen,
+             const void *password, const size_t passwordlen,
+             const unsigned char *salt, const size_t saltlen,
+             const quint32 passes, const quint32 memoryKiB, const quint32 lanes,
+             const unsigned char *secret = nullptr, const size_t secretlen = 0,
+             const unsigned char *ad = nullptr, const size_t adlen = 0);
+
+/**
+ * @brief Check argon2id() against the Argon2id test vector of RFC 9106 (section 5.3).
+ * @return 0 if derived tag matches; -1 otherwise.
+ *
+ * Run once before the first multi-lane derivation (see generateSecretKey()).
+ */
+int argon2idSelfTest();
+
+} // namespace pwm
+
+#endif // PWMARGON2_H
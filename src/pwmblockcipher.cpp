@@ -0,0 +1,210 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "pwmblockcipher.h"
+
+#include <QtEndian>
+#include <cstring>
+
+namespace pwm {
+
+/**
+ * @brief AEAD of a block algorithm. libsodium AEADs share the same signatures.
+ */
+struct BlockAead
+{
+    quint8 algorithm;
+    const char *name;
+    size_t nonceBytes;
+    decltype(&crypto_aead_xchacha20poly1305_ietf_encrypt) encrypt;
+    decltype(&crypto_aead_xchacha20poly1305_ietf_decrypt) decrypt;
+    int (*isAvailable)(); // null if always available
+};
+
+static_assert(crypto_aead_aes256gcm_ABYTES == BLOCK_ABYTES && crypto_aead_aes256gcm_KEYBYTES == crypto_kdf_KEYBYTES,
+              "Block algorithms share tag and key sizes");
+
+static const BlockAead blockAeads[] = {
+    {BLOCK_XCHACHA20POLY1305, "XChaCha20-Poly1305", crypto_aead_xchacha20poly1305_ietf_NPUBBYTES,
+     crypto_aead_xchacha20poly1305_ietf_encrypt, crypto_aead_xchacha20poly1305_ietf_decrypt, nullptr},
+    {BLOCK_AES256GCM, "AES-256-GCM", crypto_aead_aes256gcm_NPUBBYTES,
+     crypto_aead_aes256gcm_encrypt, crypto_aead_aes256gcm_decrypt, crypto_aead_aes256gcm_is_available},
+};
+
+/**
+ * @return AEAD of given algorithm; null if not supported.
+ */
+static const BlockAead *findAead(const quint8 algorithm)
+{
+    for (const BlockAead &aead : blockAeads)
+    {
+        if (aead.algorithm == algorithm) return &aead;
+    }
+    return nullptr;
+}
+
+bool blockAlgorithmAvailable(const quint8 algorithm)
+{
+    const BlockAead *aead = findAead(algorithm);
+    return aead != nullptr && (aead->isAvailable == nullptr || aead->isAvailable() != 0);
+}
+
+BlockAlgorithm preferredBlockAlgorithm()
+{
+    return blockAlgorithmAvailable(BLOCK_AES256GCM) ? BLOCK_AES256GCM : BLOCK_XCHACHA20POLY1305;
+}
+
+const char *blockAlgorithmName(const quint8 algorithm)
+{
+    const BlockAead *aead = findAead(algorithm);
+    return (aead != nullptr) ? aead->name : "unknown";
+}
+
+EntryBlockCipher::EntryBlockCipher(const SessionKey &key, const EntriesHeader &header)
+    : header(header), aead(findAead(header.algorithm))
+{
+    if (!blockAlgorithmAvailable(header.algorithm))
+    {
+        qCritical() << "Block algorithm" << blockAlgorithmName(header.algorithm) << "is not available on this processor.";
+        encryptionKey = NULL;
+        macKey = NULL;
+        return;
+    }
+
+    encryptionKey = static_cast<unsigned char *>(sodium_malloc(2 * crypto_kdf_KEYBYTES));
+    if (encryptionKey == NULL)
+    {
+        qCritical() << "Failed to allocate secure memory for block keys.";
+        macKey = NULL;
+        return;
+    }
+    macKey = encryptionKey + crypto_kdf_KEYBYTES;
+
+    if (!key.isValid()
+        || crypto_kdf_derive_from_key(encryptionKey, crypto_kdf_KEYBYTES, BLOCK_SUBKEY_ENCRYPTION, BLOCK_KDF_CONTEXT, key.data()) != 0
+        || crypto_kdf_derive_from_key(macKey, crypto_kdf_KEYBYTES, BLOCK_SUBKEY_MAC, BLOCK_KDF_CONTEXT, key.data()) != 0
+        || crypto_generichash_init(&macState, macKey, crypto_kdf_KEYBYTES, BLOCK_MACBYTES) != 0)
+    {
+        qCritical() << "Failed to derive block keys.";
+        return;
+    }
+
+    // Short nonces are only unique within a file: so is the key
+    if (aead->nonceBytes < sizeof header.streamHeader)
+    {
+        unsigned char fileKey[crypto_kdf_KEYBYTES];
+        const int status = crypto_generichash(fileKey, sizeof fileKey, header.streamHeader, sizeof header.streamHeader, encryptionKey, crypto_kdf_KEYBYTES);
+        memcpy(encryptionKey, fileKey, sizeof fileKey);
+        sodium_memzero(fileKey, sizeof fileKey);
+        if (status != 0)
+        {
+            qCritical() << "Failed to derive file key.";
+            return;
+        }
+    }
+
+    // File MAC starts with whole header
+    crypto_generichash_update(&macState, header.bytes, sizeof header.bytes);
+    crypto_generichash_update(&macState, header.streamHeader, sizeof header.streamHeader);
+
+    valid = true;
+}
+
+EntryBlockCipher::~EntryBlockCipher()
+{
+    // sodium_free() also zeroes memory before releasing it
+    if (encryptionKey != NULL) sodium_free(encryptionKey);
+    sodium_memzero(&macState, sizeof macState);
+}
+
+void EntryBlockCipher::blockNonce(unsigned char nonce[crypto_aead_xchacha20poly1305_ietf_NPUBBYTES], unsigned char ad[ENTRIES_FILEHEADERBYTES + sizeof(quint64)], const quint64 index) const
+{
+    unsigned char indexLE[sizeof(quint64)];
+    qToLittleEndian<quint64>(index, indexLE);
+
+    static_assert(sizeof header.streamHeader == crypto_aead_xchacha20poly1305_ietf_NPUBBYTES, "File id is used as nonce");
+    if (aead->nonceBytes == sizeof header.streamHeader)
+    {
+        memcpy(nonce, header.streamHeader, aead->nonceBytes);
+        for (size_t i = 0 ; i < sizeof indexLE ; ++i)
+            nonce[aead->nonceBytes - sizeof indexLE + i] ^= indexLE[i];
+    }
+    else
+    {
+        // Key is unique to the file (see constructor)
+        memset(nonce, 0, aead->nonceBytes);
+        memcpy(nonce, indexLE, sizeof indexLE);
+    }
+
+    memcpy(ad, header.bytes, ENTRIES_FILEHEADERBYTES);
+    memcpy(ad + ENTRIES_FILEHEADERBYTES, indexLE, sizeof indexLE);
+}
+
+int EntryBlockCipher::seal(unsigned char *cipher, const unsigned char *plain, const size_t plainLength)
+{
+    unsigned char nonce[crypto_aead_xchacha20poly1305_ietf_NPUBBYTES];
+    unsigned char ad[ENTRIES_FILEHEADERBYTES + sizeof(quint64)];
+
+    if (!valid) return -1;
+
+    blockNonce(nonce, ad, nbBlocks);
+    if (aead->encrypt(
+            cipher, NULL,
+            plain, plainLength,
+            ad, sizeof ad,
+            NULL, nonce, encryptionKey) != 0)
+        return -1;
+
+    authenticate(cipher, plainLength + BLOCK_ABYTES);
+    return 0;
+}
+
+void EntryBlockCipher::macCipher(const unsigned char *cipher, const size_t cipherLength)
+{
+    // Tag authenticates content: MAC only needs its length and tag
+    unsigned char lengthLE[sizeof(quint32)];
+    qToLittleEndian<quint32>(static_cast<quint32>(cipherLength), lengthLE);
+
+    crypto_generichash_update(&macState, lengthLE, sizeof lengthLE);
+    crypto_generichash_update(&macState, cipher + cipherLength - BLOCK_ABYTES, BLOCK_ABYTES);
+}
+
+void EntryBlockCipher::authenticate(const unsigned char *cipher, const size_t cipherLength)
+{
+    macCipher(cipher, cipherLength);
+    ++nbBlocks;
+}
+
+void EntryBlockCipher::authenticatePassword(const unsigned char *sealed, const size_t sealedLength)
+{
+    macCipher(sealed, sealedLength);
+    ++nbPasswords;
+}
+
+int EntryBlockCipher::open(unsigned char *plain, const unsigned char *cipher, const size_t cipherLength, const quint64 index) const
+{
+    unsigned char nonce[crypto_aead_xchacha20poly1305_ietf_NPUBBYTES];
+    unsigned char ad[ENTRIES_FILEHEADERBYTES + sizeof(quint64)];
+
+    if (!valid || cipherLength < BLOCK_ABYTES) return -1;
+
+    blockNonce(nonce, ad, index);
+    return aead->decrypt(
+        plain, NULL, NULL,
+        cipher, cipherLength,
+        ad, sizeof ad,
+        nonce, encryptionKey);
+}
+
+void EntryBlockCipher::finalMac(unsigned char mac[BLOCK_MACBYTES])
+{
+    // Both counts tell blocks apart from passwords
+    unsigned char countsLE[2 * sizeof(quint64)];
+    qToLittleEndian<quint64>(nbBlocks, countsLE);
+    qToLittleEndian<quint64>(nbPasswords, countsLE + sizeof(quint64));
+
+    crypto_generichash_update(&macState, countsLE, sizeof countsLE);
+    crypto_generichash_final(&macState, mac, BLOCK_MACBYTES);
+}
+
+} // namespace pwm
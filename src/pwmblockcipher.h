@@ -0,0 +1,141 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMBLOCKCIPHER_H
+#define PWMBLOCKCIPHER_H
+
+#include <QtGlobal>
+#include <QDebug>
+
+#include <sodium.h>
+
+#include "pwmsecurity.h"
+
+// Subkeys of data key used by entries file
+#define BLOCK_KDF_CONTEXT "pwmblock"
+#define BLOCK_SUBKEY_ENCRYPTION 1
+#define BLOCK_SUBKEY_MAC 2
+
+#define BLOCK_ABYTES crypto_aead_xchacha20poly1305_ietf_ABYTES // same for every algorithm
+#define BLOCK_MACBYTES crypto_generichash_BYTES
+
+
+namespace pwm {
+
+/**
+ * @brief AEAD sealing blocks of entries file, recorded in file header.
+ */
+enum BlockAlgorithm : quint8
+{
+    BLOCK_XCHACHA20POLY1305 = 0, // portable, fast in software
+    BLOCK_AES256GCM = 1          // only where AES is accelerated by processor (see crypto_aead_aes256gcm_is_available())
+};
+
+/**
+ * @return True if blocks of given algorithm can be sealed and opened on this processor.
+ */
+bool blockAlgorithmAvailable(const quint8 algorithm);
+
+/**
+ * @brief Algorithm of new entries files: AES-256-GCM if accelerated by processor, XChaCha20-Poly1305 otherwise.
+ */
+BlockAlgorithm preferredBlockAlgorithm();
+
+/**
+ * @return Name of given algorithm; "unknown" if not supported.
+ */
+const char *blockAlgorithmName(const quint8 algorithm);
+
+struct BlockAead;
+
+/**
+ * @brief Independently sealed blocks of entries file.
+ *
+ * Each block is encrypted with the AEAD recorded in file header (see BlockAlgorithm), so
+ * that blocks can be decrypted in any order and on several threads, unlike a secretstream.
+ * - XChaCha20-Poly1305: nonce of a block is the file id, whose last 8 bytes are XORed with block index.
+ * - AES-256-GCM: nonces are too short to be random. Encryption key is unique to the file
+ *   (keyed BLAKE2b of file id), and nonce of a block is its index.
+ * - Block is authenticated with file header and its index: moving a block fails to decrypt.
+ * - File MAC (keyed BLAKE2b) covers file header, file id, length and tag of every block in
+ *   order, length and tag of every sealed password of password segment in order, then numbers
+ *   of blocks and passwords: removing, reordering or truncating blocks is detected before any
+ *   block is decrypted, and passwords are bound to their entry without being opened.
+ * Encryption and MAC keys are derived from session key, and stored in guarded, locked memory.
+ */
+class EntryBlockCipher
+{
+public:
+    /**
+     * @brief Derive block keys and start file MAC.
+     * @param key: Session key of entries file.
+     * @param header: Header of entries file, with its file id.
+     */
+    EntryBlockCipher(const SessionKey &key, const EntriesHeader &header);
+    ~EntryBlockCipher();
+    EntryBlockCipher(const EntryBlockCipher &) = delete;
+    EntryBlockCipher &operator=(const EntryBlockCipher &) = delete;
+
+    /**
+     * @brief Encrypt a block, and add it to file MAC.
+     * @param cipher: Array where cipher is going to be stored ([plainLength] + BLOCK_ABYTES bytes).
+     * @param plain: Block plaintext.
+     * @param plainLength: Length of [plain].
+     * @return 0 if successfully encrypted block; -1 otherwise.
+     * @attention Blocks must be sealed in order.
+     */
+    int seal(unsigned char *cipher, const unsigned char *plain, const size_t plainLength);
+    /**
+     * @brief Add a block read from file to file MAC, without decrypting it.
+     * @param cipher: Block cipher.
+     * @param cipherLength: Length of [cipher] (at least BLOCK_ABYTES bytes).
+     * @attention Blocks must be authenticated in order.
+     */
+    void authenticate(const unsigned char *cipher, const size_t cipherLength);
+    /**
+     * @brief Add a sealed password of password segment to file MAC, without opening it.
+     * @param sealed: Sealed password (see sealPassword()).
+     * @param sealedLength: Length of [sealed] (at least BLOCK_ABYTES bytes).
+     * @attention Passwords must be authenticated in order, once every block was sealed or authenticated.
+     */
+    void authenticatePassword(const unsigned char *sealed, const size_t sealedLength);
+    /**
+     * @brief Decrypt a block. Can be called from several threads at once.
+     * @param plain: Array where plaintext is going to be stored ([cipherLength] - BLOCK_ABYTES bytes).
+     * @param cipher: Block cipher.
+     * @param cipherLength: Length of [cipher].
+     * @param index: Position of block in file.
+     * @return 0 if block is authentic at this position; -1 otherwise.
+     */
+    int open(unsigned char *plain, const unsigned char *cipher, const size_t cipherLength, const quint64 index) const;
+    /**
+     * @brief Complete file MAC over every block and password sealed or authenticated so far.
+     * @param mac: Array where MAC is going to be stored.
+     */
+    void finalMac(unsigned char mac[BLOCK_MACBYTES]);
+
+    bool isValid() const { return valid; }
+
+private:
+    /**
+     * @brief Nonce and associated data of block at given index.
+     */
+    void blockNonce(unsigned char nonce[crypto_aead_xchacha20poly1305_ietf_NPUBBYTES], unsigned char ad[ENTRIES_FILEHEADERBYTES + sizeof(quint64)], const quint64 index) const;
+    /**
+     * @brief Add length and tag of a cipher to file MAC: its tag authenticates its content.
+     */
+    void macCipher(const unsigned char *cipher, const size_t cipherLength);
+
+    EntriesHeader header;
+    const BlockAead *aead = nullptr;
+    unsigned char *encryptionKey; // crypto_aead_xchacha20poly1305_ietf_KEYBYTES bytes
+    unsigned char *macKey;        // crypto_generichash_KEYBYTES bytes, follows [encryptionKey] in secure memory
+    crypto_generichash_state macState;
+    quint64 nbBlocks = 0;
+    quint64 nbPasswords = 0;
+    bool valid = false;
+};
+
+} // namespace pwm
+
+#endif // PWMBLOCKCIPHER_H
@@ -0,0 +1,241 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "pwmcryptoparams.h"
+#include "pwmsecurity.h"
+#include "pwmargon2.h"
+
+#include <QElapsedTimer>
+#include <QThread>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+namespace pwm {
+
+int readCryptoParams(CryptoParams &params, const char *fileName)
+{
+    FILE * cryptoFile = fopen(fileName, "rb");
+    int returnValue = -1;
+
+    if (cryptoFile == NULL)
+    {
+        qCritical() << "Failed to open crypto parameters file.";
+        return returnValue;
+    }
+
+    // Reading crypto parameters file
+    if (fread(params.salt, sizeof params.salt[0], sizeof params.salt, cryptoFile) != sizeof params.salt)
+    {
+        qCritical() << "Failed to read salt from file.";
+        goto ret;
+    }
+    if (fread(&params.opslimit, sizeof params.opslimit, 1, cryptoFile) != 1)
+    {
+        qCritical() << "Failed to read opslimit from file.";
+        goto ret;
+    }
+    if (fread(&params.memlimit, sizeof params.memlimit, 1, cryptoFile) != 1)
+    {
+        qCritical() << "Failed to read memlimit from file.";
+        goto ret;
+    }
+    if (fread(&params.alg, sizeof params.alg, 1, cryptoFile) != 1)
+    {
+        qCritical() << "Failed to read algorithm from file.";
+        goto ret;
+    }
+
+    // Lane count only follows in files written for multi-lane derivation
+    {
+        unsigned char lanes[sizeof(quint32)];
+        params.lanes = (fread(lanes, 1, sizeof lanes, cryptoFile) == sizeof lanes) ? qFromLittleEndian<quint32>(lanes) : 1;
+    }
+    // Calibration time only follows in files written by a calibration
+    {
+        unsigned char calibratedMs[sizeof(quint32)];
+        params.calibratedMs = (fread(calibratedMs, 1, sizeof calibratedMs, cryptoFile) == sizeof calibratedMs) ? qFromLittleEndian<quint32>(calibratedMs) : 0;
+    }
+    if (params.lanes < ARGON2_MINLANES || params.lanes > ARGON2_MAXLANES)
+    {
+        qCritical() << "Invalid lane count in file.";
+        goto ret;
+    }
+
+    returnValue = 0;
+ret:
+    fclose(cryptoFile);
+    return returnValue;
+}
+
+int writeCryptoParams(const CryptoParams &params, const char *fileName)
+{
+    FILE * cryptoFile = fopen(fileName, "wb");
+    int returnValue = -1;
+
+    if (cryptoFile == NULL)
+    {
+        qCritical() << "Failed to open crypto parameters file. Aborted crypto parameters update.";
+        return returnValue;
+    }
+
+    // Writing parameters in file
+    if (fwrite(params.salt, sizeof params.salt[0], sizeof params.salt, cryptoFile) != sizeof params.salt)
+    {
+        qCritical() << "Failed to write salt in file. Aborted crypto parameters update.";
+        goto ret;
+    }
+    if (fwrite(&params.opslimit, sizeof params.opslimit, 1, cryptoFile) != 1)
+    {
+        qCritical() << "Failed to write opslimit in file. Aborted crypto parameters update.";
+        goto ret;
+    }
+    if (fwrite(&params.memlimit, sizeof params.memlimit, 1, cryptoFile) != 1)
+    {
+        qCritical() << "Failed to write memlimit in file. Aborted crypto parameters update.";
+        goto ret;
+    }
+    if (fwrite(&params.alg, sizeof params.alg, 1, cryptoFile) != 1)
+    {
+        qCritical() << "Failed to write algorithm in file. Aborted crypto parameters update.";
+        goto ret;
+    }
+    {
+        unsigned char lanes[sizeof(quint32)];
+        qToLittleEndian<quint32>(params.lanes, lanes);
+        if (fwrite(lanes, 1, sizeof lanes, cryptoFile) != sizeof lanes)
+        {
+            qCritical() << "Failed to write lane count in file. Aborted crypto parameters update.";
+            goto ret;
+        }
+    }
+    if (params.calibratedMs != 0)
+    {
+        unsigned char calibratedMs[sizeof(quint32)];
+        qToLittleEndian<quint32>(params.calibratedMs, calibratedMs);
+        if (fwrite(calibratedMs, 1, sizeof calibratedMs, cryptoFile) != sizeof calibratedMs)
+        {
+            qCritical() << "Failed to write calibration time in file. Aborted crypto parameters update.";
+            goto ret;
+        }
+    }
+    if (syncFile(cryptoFile) != 0)
+    {
+        qCritical() << "Failed to flush crypto parameters to disk. Aborted crypto parameters update.";
+        goto ret;
+    }
+
+    returnValue = 0;
+ret:
+    if (fclose(cryptoFile) != 0) returnValue = -1;
+    return returnValue;
+}
+
+int hashPassword(unsigned char *out, const size_t outlen, const char *password, const size_t passwordlen, const CryptoParams &params)
+{
+    if (params.lanes <= 1)
+        return crypto_pwhash(out, outlen, password, passwordlen, params.salt, params.opslimit, params.memlimit, params.alg);
+
+    // Checked once, before any key depends on it
+    static const bool argon2idValid = (argon2idSelfTest() == 0);
+
+    if (!argon2idValid || params.alg != crypto_pwhash_ALG_ARGON2ID13
+        || params.opslimit > 0xFFFFFFFFull || params.memlimit / 1024 > 0xFFFFFFFFull)
+    {
+        qCritical() << "Multi-lane key derivation is not available with these parameters.";
+        return -1;
+    }
+
+    return argon2id(out, outlen, password, passwordlen, params.salt, sizeof params.salt,
+                    static_cast<quint32>(params.opslimit), static_cast<quint32>(params.memlimit / 1024), params.lanes);
+}
+
+/**
+ * @brief Time a single key derivation.
+ * @return Derivation time (ms, at least 1); -1 if derivation failed (e.g. not enough memory).
+ */
+static qint64 timeDerivation(const CryptoParams &params)
+{
+    static const char password[] = "pwm calibration";
+    unsigned char key[crypto_kdf_KEYBYTES];
+    QElapsedTimer timer;
+
+    timer.start();
+    const int status = hashPassword(key, sizeof key, password, strlen(password), params);
+    const qint64 elapsed = timer.elapsed();
+
+    sodium_memzero(key, sizeof key);
+    if (status != 0) return -1;
+    return std::max<qint64>(elapsed, 1);
+}
+
+int calibrateCryptoParams(CryptoParams &params, const int targetMs)
+{
+    const unsigned long long minOpslimit = crypto_pwhash_OPSLIMIT_INTERACTIVE;
+    const size_t minMemlimit = crypto_pwhash_MEMLIMIT_INTERACTIVE;
+
+    if (targetMs <= 0)
+    {
+        qCritical() << "Invalid key derivation target. Aborted calibration.";
+        return -1;
+    }
+
+    CryptoParams calibrated;
+    randombytes_buf(calibrated.salt, sizeof calibrated.salt);
+    calibrated.opslimit = minOpslimit;
+    calibrated.alg = crypto_pwhash_ALG_ARGON2ID13;
+    calibrated.lanes = 1;
+    size_t maxMemlimit = CRYPTO_CALIBRATION_MAXMEMLIMIT;
+
+#ifdef PWM_PARALLEL_KDF
+    // One lane per core: same derivation time with more memory
+    calibrated.lanes = static_cast<quint32>(std::min(std::max(QThread::idealThreadCount(), 1), CRYPTO_MAXLANES));
+    if (calibrated.lanes > 1)
+    {
+        if (argon2idSelfTest() != 0)
+            calibrated.lanes = 1;
+        else
+            maxMemlimit = std::min<size_t>(static_cast<size_t>(CRYPTO_CALIBRATION_MAXMEMLIMIT) * calibrated.lanes, CRYPTO_CALIBRATION_MAXMEMLIMIT_PARALLEL);
+    }
+#endif
+
+    // Largest memory whose derivation fits in target, down to minimum
+    calibrated.memlimit = std::max<size_t>(maxMemlimit, minMemlimit);
+    qint64 elapsed;
+    for (;;)
+    {
+        elapsed = timeDerivation(calibrated);
+        if (elapsed > 0 && (elapsed <= targetMs || calibrated.memlimit / 2 < minMemlimit)) break;
+
+        if (calibrated.memlimit / 2 < minMemlimit)
+        {
+            qCritical() << "Failed to run key derivation with minimum parameters. Aborted calibration.";
+            return -1;
+        }
+        calibrated.memlimit /= 2;
+    }
+
+    // Derivation time grows linearly with number of passes
+    unsigned long long opslimit = minOpslimit * targetMs / elapsed;
+    calibrated.opslimit = std::min<unsigned long long>(std::max(opslimit, minOpslimit), 0xFFFFFFFFull);
+    calibrated.calibratedMs = static_cast<quint32>(std::min<unsigned long long>(elapsed * calibrated.opslimit / minOpslimit, 0xFFFFFFFFull));
+
+    params = calibrated;
+    qInfo() << "Calibrated key derivation:" << calibrated.opslimit << "passes over" << (calibrated.memlimit >> 20)
+            << "MiB in" << calibrated.lanes << "lanes.";
+    return 0;
+}
+
+bool cryptoParamsNeedCalibration(const qint64 unlockMs, const CryptoParams &params)
+{
+    // Same machine as calibration: target may be out of reach, calibrating again would give the same parameters
+    if (params.calibratedMs != 0
+        && unlockMs * CRYPTO_UNLOCK_TOLERANCE >= params.calibratedMs
+        && unlockMs <= static_cast<qint64>(params.calibratedMs) * CRYPTO_UNLOCK_TOLERANCE)
+        return false;
+
+    return unlockMs * CRYPTO_UNLOCK_TOLERANCE < CRYPTO_UNLOCK_TARGET_MS
+        || unlockMs > static_cast<qint64>(CRYPTO_UNLOCK_TARGET_MS) * CRYPTO_UNLOCK_TOLERANCE;
+}
+
+} // namespace pwm
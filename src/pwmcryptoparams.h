@@ -0,0 +1,111 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMCRYPTOPARAMS_H
+#define PWMCRYPTOPARAMS_H
+
+#include <QString>
+#include <QDebug>
+
+#include <sodium.h>
+#include <cstdio>
+
+#define CRYPTO_PARAMS_FILE "crypto.params"
+#define CRYPTO_PARAMS_TMPFILE "crypto.params.tmp"
+
+// Key derivation time aimed by calibration (ms)
+#define CRYPTO_UNLOCK_TARGET_MS 1000
+// Parameters are calibrated again when unlocking is this many times faster or slower than target
+#define CRYPTO_UNLOCK_TOLERANCE 2
+// Memory used by key derivation on machines fast enough; halved on slower machines
+#define CRYPTO_CALIBRATION_MAXMEMLIMIT (256 * 1024 * 1024)
+// Memory of multi-lane derivations grows with lane count, up to this limit
+#define CRYPTO_CALIBRATION_MAXMEMLIMIT_PARALLEL (1024 * 1024 * 1024)
+// Maximum number of lanes chosen by calibration (see PWM_PARALLEL_KDF)
+#define CRYPTO_MAXLANES 8
+
+
+namespace pwm {
+
+/**
+ * @brief Parameters of the key derivation of master password.
+ *
+ * File structure:
+ * salt      (unsigned char)
+ * opslimit  (unsigned long long)
+ * memlimit  (size_t)
+ * alg       (int)
+ * lanes     (quint32, little endian; missing in files written before multi-lane derivation: 1)
+ * calibrated (quint32, little endian, see calibratedMs; missing in files never calibrated: 0)
+ */
+struct CryptoParams
+{
+    unsigned char salt[crypto_pwhash_SALTBYTES] = {0};
+    unsigned long long opslimit = crypto_pwhash_OPSLIMIT_INTERACTIVE;
+    size_t memlimit = crypto_pwhash_MEMLIMIT_INTERACTIVE;
+    int alg = crypto_pwhash_ALG_DEFAULT;
+    quint32 lanes = 1; // Argon2id parallelism: 1 uses crypto_pwhash(), more uses argon2id()
+    quint32 calibratedMs = 0; // derivation time (ms) measured on the machine these parameters were calibrated on; 0 if never calibrated
+};
+
+/**
+ * @brief Read crypto parameters file.
+ * @param params: Parameters read from file.
+ * @param fileName: Name of crypto parameters file.
+ * @return 0 if successfully read parameters; -1 otherwise.
+ */
+int readCryptoParams(CryptoParams &params, const char *fileName = CRYPTO_PARAMS_FILE);
+
+/**
+ * @brief Write crypto parameters to a file, flushed to disk.
+ * @param params: Parameters to write.
+ * @param fileName: Name of the file to write (see replaceFile() to replace crypto parameters file).
+ * @return 0 if successfully wrote parameters; -1 otherwise.
+ */
+int writeCryptoParams(const CryptoParams &params, const char *fileName);
+
+/**
+ * @brief Derive a key from a password with given crypto parameters.
+ *
+ * @param out: Array where key is going to be stored.
+ * @param outlen: Length of key.
+ * @param password: Password bytes.
+ * @param passwordlen: Length of [password].
+ * @param params: Crypto parameters.
+ * @return 0 if successfully derived key; -1 otherwise.
+ *
+ * Single-lane parameters are derived by crypto_pwhash(). Multi-lane parameters are derived
+ * by argon2id(), once it has passed its self-test (see argon2idSelfTest()).
+ */
+int hashPassword(unsigned char *out, const size_t outlen, const char *password, const size_t passwordlen, const CryptoParams &params);
+
+/**
+ * @brief Choose key derivation parameters so that deriving a key takes about [targetMs] on this machine.
+ *
+ * @param params: Parameters with a new random salt.
+ * @param targetMs: Key derivation time to aim (ms).
+ * @return 0 if successfully calibrated parameters; -1 otherwise.
+ *
+ * Key derivations are run with CRYPTO_CALIBRATION_MAXMEMLIMIT bytes, halved until a derivation
+ * with crypto_pwhash_OPSLIMIT_INTERACTIVE passes fits in [targetMs]. Number of passes is then scaled
+ * to [targetMs], since derivation time grows linearly with it. Parameters never go below
+ * crypto_pwhash_OPSLIMIT_INTERACTIVE and crypto_pwhash_MEMLIMIT_INTERACTIVE, whatever the machine.
+ * With PWM_PARALLEL_KDF, one lane per core is used (up to CRYPTO_MAXLANES), and memory starts
+ * from CRYPTO_CALIBRATION_MAXMEMLIMIT per lane (up to CRYPTO_CALIBRATION_MAXMEMLIMIT_PARALLEL).
+ * Blocking for several derivations: run on a worker thread.
+ */
+int calibrateCryptoParams(CryptoParams &params, const int targetMs = CRYPTO_UNLOCK_TARGET_MS);
+
+/**
+ * @param unlockMs: Time taken by key derivation when unlocking.
+ * @param params: Parameters of the key derivation.
+ * @return True if unlocking in [unlockMs] is far enough from CRYPTO_UNLOCK_TARGET_MS to calibrate parameters again.
+ *
+ * Parameters calibrated on a machine unlocking in about [params.calibratedMs] are the best
+ * calibration can reach on it (e.g. minimum parameters on a slow machine): they are kept.
+ */
+bool cryptoParamsNeedCalibration(const qint64 unlockMs, const CryptoParams &params);
+
+} // namespace pwm
+
+#endif // PWMCRYPTOPARAMS_H
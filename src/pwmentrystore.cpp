@@ -0,0 +1,506 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "pwmentrystore.h"
+
+#include <QByteArray>
+#include <algorithm>
+#include <utility>
+
+namespace pwm {
+
+EntryStore::~EntryStore()
+{
+    clear();
+}
+
+int EntryStore::indexOf(const EntryId id) const
+{
+    if (!contains(id)) return -1;
+
+    // Ids are added in increasing order, and never reordered
+    const auto it = std::lower_bound(order.begin(), order.end(), id);
+    if (it == order.end() || *it != id) return -1;
+
+    // Entries removed before it during a transaction no longer count
+    const int removedBefore = (removedInOrder == 0) ? 0
+        : static_cast<int>(std::count_if(order.begin(), it, [this](const EntryId previous) { return !alive[previous]; }));
+    return static_cast<int>(it - order.begin()) - removedBefore;
+}
+
+EntryId EntryStore::idInTransaction(const int index) const
+{
+    int position = -1;
+
+    for (const EntryId id : order)
+    {
+        if (alive[id] && ++position == index) return id;
+    }
+
+    return ENTRY_NOID;
+}
+
+std::string_view EntryStore::view(const EntryId id, const EntryField field) const
+{
+    const Span span = columns[field].spans[id];
+    return std::string_view(span.data, span.length);
+}
+
+QString EntryStore::field(const EntryId id, const EntryField field) const
+{
+    const std::string_view value = view(id, field);
+    return QString::fromUtf8(value.data(), static_cast<int>(value.size()));
+}
+
+QStringList EntryStore::column(const EntryField field) const
+{
+    QStringList values;
+    values.reserve(size());
+
+    for (const EntryId id : order)
+    {
+        if (alive[id]) values.append(this->field(id, field));
+    }
+
+    return values;
+}
+
+EntryId EntryStore::find(const QString &entryname, const QString &username) const
+{
+    const QByteArray entrynameUtf8 = entryname.toUtf8();
+    const QByteArray usernameUtf8 = username.toUtf8();
+
+    return find(std::string_view(entrynameUtf8.constData(), entrynameUtf8.size()),
+                std::string_view(usernameUtf8.constData(), usernameUtf8.size()));
+}
+
+EntryId EntryStore::find(const std::string_view entryname, const std::string_view username) const
+{
+    const auto range = nameIndex.equal_range(nameKey(entryname, username));
+
+    // Different names may have the same key
+    for (auto it = range.first ; it != range.second ; ++it)
+    {
+        if (view(it->second, ENTRY_NAME) == entryname && view(it->second, ENTRY_USERNAME) == username)
+            return it->second;
+    }
+
+    return ENTRY_NOID;
+}
+
+EntryId EntryStore::find(const EntryField field, const QString &value) const
+{
+    QByteArray valueUtf8 = value.toUtf8();
+    const std::string_view valueView(valueUtf8.constData(), valueUtf8.size());
+    EntryId found = ENTRY_NOID;
+
+    for (const EntryId id : order)
+    {
+        if (alive[id] && view(id, field) == valueView)
+        {
+            found = id;
+            break;
+        }
+    }
+
+    // Value may be a password
+    sodium_memzero(valueUtf8.data(), valueUtf8.size());
+    return found;
+}
+
+void EntryStore::findPrefix(const QString &prefix, std::vector<EntryId> &ids) const
+{
+    const std::string foldedPrefix = PrefixIndex::fold(prefix);
+
+    ids.clear();
+    entrynamePrefixes.find(foldedPrefix, ids);
+    usernamePrefixes.find(foldedPrefix, ids);
+
+    // Ids are given in the order entries were added, which is entries order
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+}
+
+bool EntryStore::matchesPrefix(const EntryId id, const QString &prefix) const
+{
+    if (!contains(id)) return false;
+
+    const std::string foldedPrefix = PrefixIndex::fold(prefix);
+    std::string entryname = PrefixIndex::fold(view(id, ENTRY_NAME));
+    std::string username = PrefixIndex::fold(view(id, ENTRY_USERNAME));
+    const bool matches = entryname.compare(0, foldedPrefix.size(), foldedPrefix) == 0
+                         || username.compare(0, foldedPrefix.size(), foldedPrefix) == 0;
+
+    // Folded names are copies of entry fields
+    sodium_memzero(&entryname[0], entryname.size());
+    sodium_memzero(&username[0], username.size());
+    return matches;
+}
+
+QStringList EntryStore::completeEntryname(const QString &prefix, const int maxCount) const
+{
+    QStringList completions;
+    std::vector<EntryId> ids;
+
+    if (prefix.isEmpty()) return completions;
+
+    entrynamePrefixes.find(PrefixIndex::fold(prefix), ids);
+
+    for (const EntryId id : ids)
+    {
+        if (completions.size() >= maxCount) break;
+
+        const QString entryname = field(id, ENTRY_NAME);
+        if (!completions.contains(entryname)) completions.append(entryname);
+    }
+
+    return completions;
+}
+
+EntryId EntryStore::add(const std::string_view fields[ENTRY_NBFIELDS])
+{
+    const EntryId id = static_cast<EntryId>(alive.size());
+
+    // Fields are appended one after the other: characters of an entry are contiguous
+    for (int field = 0 ; field < ENTRY_NBFIELDS ; ++field)
+        columns[field].spans.push_back(append(fields[field]));
+    alive.push_back(1);
+    order.push_back(id);
+    indexInsert(id);
+    ++changes;
+
+    Undo undo;
+    undo.op = UNDO_ADD;
+    undo.id = id;
+    undoLog.push_back(undo);
+
+    if (!transaction) commit();
+    return id;
+}
+
+EntryId EntryStore::add(const QString &entryname, const QString &username, const std::string_view password, const QString &date)
+{
+    // Fields without a parameter are left empty
+    QByteArray fieldsUtf8[ENTRY_NBFIELDS];
+    fieldsUtf8[ENTRY_NAME] = entryname.toUtf8();
+    fieldsUtf8[ENTRY_USERNAME] = username.toUtf8();
+    fieldsUtf8[ENTRY_DATE] = date.toUtf8();
+    std::string_view fields[ENTRY_NBFIELDS];
+
+    for (int field = 0 ; field < ENTRY_NBFIELDS ; ++field)
+        fields[field] = std::string_view(fieldsUtf8[field].constData(), fieldsUtf8[field].size());
+    fields[ENTRY_PASSWORD] = password;
+
+    const EntryId id = add(fields);
+
+    for (auto &fieldUtf8 : fieldsUtf8)
+        sodium_memzero(fieldUtf8.data(), fieldUtf8.size());
+
+    return id;
+}
+
+void EntryStore::remove(const EntryId id)
+{
+    if (!contains(id)) return;
+
+    // Entry leaves order on commit, with every other entry removed in the same transaction
+    indexErase(id);
+    alive[id] = 0;
+    ++removedInOrder;
+    ++changes;
+
+    Undo undo;
+    undo.op = UNDO_REMOVE;
+    undo.id = id;
+    undoLog.push_back(undo);
+
+    if (!transaction) commit();
+}
+
+void EntryStore::setField(const EntryId id, const EntryField field, const std::string_view value)
+{
+    if (!contains(id)) return;
+
+    Column &column = columns[field];
+
+    Undo undo;
+    undo.op = UNDO_SET;
+    undo.id = id;
+    undo.field = field;
+    undo.previous = column.spans[id];
+
+    const bool indexed = (field == ENTRY_NAME || field == ENTRY_USERNAME);
+    if (indexed) indexErase(id);
+
+    // Previous characters are kept until commit, so that they can be restored
+    column.spans[id] = append(value);
+    undoLog.push_back(undo);
+
+    if (indexed) indexInsert(id);
+    ++changes;
+
+    if (!transaction) commit();
+}
+
+void EntryStore::setField(const EntryId id, const EntryField field, const QString &value)
+{
+    QByteArray valueUtf8 = value.toUtf8();
+    setField(id, field, std::string_view(valueUtf8.constData(), valueUtf8.size()));
+    sodium_memzero(valueUtf8.data(), valueUtf8.size());
+}
+
+void EntryStore::begin()
+{
+    transaction = true;
+}
+
+void EntryStore::commit()
+{
+    for (const Undo &undo : undoLog)
+    {
+        switch (undo.op)
+        {
+        case UNDO_REMOVE:
+            for (int field = 0 ; field < ENTRY_NBFIELDS ; ++field)
+                release(columns[field].spans[undo.id]);
+            break;
+        case UNDO_SET:
+            release(undo.previous);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Dropping removed entries from order in a single pass
+    if (removedInOrder > 0)
+    {
+        order.erase(std::remove_if(order.begin(), order.end(), [this](const EntryId id) { return !alive[id]; }), order.end());
+        removedInOrder = 0;
+    }
+
+    undoLog.clear();
+    transaction = false;
+    compactIfNeeded();
+}
+
+void EntryStore::rollback()
+{
+    if (!undoLog.empty()) ++changes;
+
+    // Undoing mutations from last to first, so that each one is undone on the state it produced
+    for (auto undo = undoLog.rbegin() ; undo != undoLog.rend() ; ++undo)
+    {
+        switch (undo->op)
+        {
+        case UNDO_ADD:
+            // Entry was the last one when added
+            indexErase(undo->id);
+            order.pop_back();
+            alive[undo->id] = 0;
+            for (int field = 0 ; field < ENTRY_NBFIELDS ; ++field)
+                release(columns[field].spans[undo->id]);
+            break;
+        case UNDO_REMOVE:
+            // Entry is still in order
+            alive[undo->id] = 1;
+            --removedInOrder;
+            indexInsert(undo->id);
+            break;
+        case UNDO_SET:
+        {
+            const bool indexed = (undo->field == ENTRY_NAME || undo->field == ENTRY_USERNAME);
+            if (indexed) indexErase(undo->id);
+            release(columns[undo->field].spans[undo->id]);
+            columns[undo->field].spans[undo->id] = undo->previous;
+            if (indexed) indexInsert(undo->id);
+            break;
+        }
+        }
+    }
+
+    undoLog.clear();
+    transaction = false;
+    compactIfNeeded();
+}
+
+void EntryStore::reserve(const int nbEntries)
+{
+    // Arena grows by slabs, which never move characters
+    for (auto &column : columns)
+        column.spans.reserve(nbEntries);
+
+    order.reserve(nbEntries);
+    alive.reserve(nbEntries);
+    nameIndex.reserve(nbEntries);
+    entrynamePrefixes.reserve(nbEntries);
+    usernamePrefixes.reserve(nbEntries);
+}
+
+void EntryStore::clear()
+{
+    // Every plaintext field is in arena, wiped at once
+    arena.release();
+    garbage = 0;
+    for (auto &column : columns)
+        std::vector<Span>().swap(column.spans);
+
+    order.clear();
+    removedInOrder = 0;
+    alive.clear();
+    undoLog.clear();
+    nameIndex.clear();
+    entrynamePrefixes.clear();
+    usernamePrefixes.clear();
+    transaction = false;
+    ++changes;
+}
+
+void EntryStore::swap(EntryStore &other)
+{
+    // Spans keep pointing to the same slabs
+    arena.swap(other.arena);
+    std::swap(garbage, other.garbage);
+    for (int field = 0 ; field < ENTRY_NBFIELDS ; ++field)
+        columns[field].spans.swap(other.columns[field].spans);
+
+    order.swap(other.order);
+    std::swap(removedInOrder, other.removedInOrder);
+    alive.swap(other.alive);
+    undoLog.swap(other.undoLog);
+    nameIndex.swap(other.nameIndex);
+    entrynamePrefixes.swap(other.entrynamePrefixes);
+    usernamePrefixes.swap(other.usernamePrefixes);
+    std::swap(transaction, other.transaction);
+    ++changes;
+    ++other.changes;
+}
+
+void EntryStore::assign(const EntryStore &other)
+{
+    if (&other == this) return;
+
+    clear();
+
+    // Spans of [other] point to its own arena: copying its existing entries only
+    arena.reserve(other.arena.size() - other.garbage);
+    for (auto &column : columns)
+        column.spans.resize(other.alive.size());
+    for (const EntryId id : other.order)
+    {
+        for (int field = 0 ; field < ENTRY_NBFIELDS ; ++field)
+            columns[field].spans[id] = append(other.view(id, static_cast<EntryField>(field)));
+    }
+
+    order = other.order;
+    alive = other.alive;
+    nameIndex = other.nameIndex;
+    entrynamePrefixes.assign(other.entrynamePrefixes);
+    usernamePrefixes.assign(other.usernamePrefixes);
+}
+
+size_t EntryStore::memoryUsage() const
+{
+    size_t usage = order.capacity() * sizeof(EntryId) + alive.capacity() + undoLog.capacity() * sizeof(Undo);
+
+    // Index: bucket array, and a node (next pointer, key and id) per entry
+    usage += nameIndex.bucket_count() * sizeof(void *) + nameIndex.size() * (sizeof(void *) + sizeof(size_t) + sizeof(EntryId));
+    usage += entrynamePrefixes.memoryUsage() + usernamePrefixes.memoryUsage();
+
+    usage += arena.capacity();
+    for (const auto &column : columns)
+        usage += column.spans.capacity() * sizeof(Span);
+
+    return usage;
+}
+
+EntryStore::Span EntryStore::append(const std::string_view value)
+{
+    Span span;
+    span.data = const_cast<char *>(arena.store(value).data());
+    span.length = static_cast<quint32>(value.size());
+    return span;
+}
+
+void EntryStore::release(const Span span)
+{
+    if (span.length == 0) return;
+
+    sodium_memzero(span.data, span.length);
+    garbage += span.length;
+}
+
+size_t EntryStore::nameKey(const std::string_view entryname, const std::string_view username)
+{
+    const std::hash<std::string_view> hash;
+    const size_t entrynameHash = hash(entryname);
+
+    return entrynameHash ^ (hash(username) + 0x9e3779b97f4a7c15ULL + (entrynameHash << 6) + (entrynameHash >> 2));
+}
+
+void EntryStore::indexInsert(const EntryId id)
+{
+    nameIndex.emplace(nameKey(view(id, ENTRY_NAME), view(id, ENTRY_USERNAME)), id);
+    entrynamePrefixes.insert(view(id, ENTRY_NAME), id);
+    usernamePrefixes.insert(view(id, ENTRY_USERNAME), id);
+}
+
+void EntryStore::indexErase(const EntryId id)
+{
+    entrynamePrefixes.erase(view(id, ENTRY_NAME), id);
+    usernamePrefixes.erase(view(id, ENTRY_USERNAME), id);
+
+    const auto range = nameIndex.equal_range(nameKey(view(id, ENTRY_NAME), view(id, ENTRY_USERNAME)));
+
+    for (auto it = range.first ; it != range.second ; ++it)
+    {
+        if (it->second == id)
+        {
+            nameIndex.erase(it);
+            return;
+        }
+    }
+}
+
+void EntryStore::copyEntries(SecureArena &target)
+{
+    // Ids follow entries order, and fields of an entry stay next to each other
+    for (EntryId id = 0 ; id < alive.size() ; ++id)
+    {
+        for (auto &column : columns)
+        {
+            Span &span = column.spans[id];
+            if (!alive[id])
+            {
+                // Removed entries keep no characters
+                span = Span();
+                continue;
+            }
+
+            span.data = const_cast<char *>(target.store(std::string_view(span.data, span.length)).data());
+        }
+    }
+}
+
+void EntryStore::compact()
+{
+    SecureArena compacted;
+    compacted.reserve(arena.size() - garbage);
+
+    copyEntries(compacted);
+
+    // Previous slabs are wiped when released
+    arena.swap(compacted);
+    garbage = 0;
+}
+
+void EntryStore::compactIfNeeded()
+{
+    // Spans kept by undo log refer to current arena
+    if (transaction) return;
+
+    if (garbage > ENTRYSTORE_COMPACT_MINGARBAGE && garbage > arena.size() / 2)
+        compact();
+}
+
+} // namespace pwm
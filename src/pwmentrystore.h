@@ -0,0 +1,254 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMENTRYSTORE_H
+#define PWMENTRYSTORE_H
+
+#include <QString>
+#include <QStringList>
+#include <QDebug>
+
+#include <sodium.h>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "pwmprefixindex.h"
+#include "pwmrecord.h"
+#include "pwmsecurearena.h"
+
+// Id returned when an entry does not exist
+#define ENTRY_NOID 0xFFFFFFFFu
+
+// Arena is compacted when unreferenced bytes exceed both this size and half of its bytes
+#define ENTRYSTORE_COMPACT_MINGARBAGE 4096
+
+
+namespace pwm {
+
+/**
+ * @brief Columnar in-memory store of entries.
+ *
+ * Each field is a column of views: UTF-8 characters of every field are stored in a single
+ * SecureArena (guarded, locked memory), fields of an entry next to each other, and each entry
+ * refers to its characters with a pointer and a length. Modified fields are appended to the
+ * arena, which never moves characters: it is compacted into a new arena once it holds too many
+ * unreferenced bytes. Unreferenced bytes are wiped, and every byte is wiped by clear() and on destruction.
+ * Password field holds the raw bytes of sealed passwords once unlocked (see sealPassword()).
+ *
+ * Entries are identified by an id which does not change while the entry exists,
+ * whatever the entries added or removed before it. Ids are not reused until clear().
+ * Entries are indexed by entry and user names, and index is updated by every mutation
+ * (and rollback), so that find() does not depend on the number of entries.
+ * Entry and user names are also indexed by prefix, ignoring case (see PrefixIndex).
+ *
+ * Mutations can be grouped in a transaction (begin(), commit(), rollback()): rollback
+ * restores previous offsets and order, so that no copy of entries is needed.
+ * Mutations outside of a transaction are committed immediately.
+ * Removed entries stay in order until commit, which drops them all in a single pass:
+ * removing k of N entries in a transaction costs O(N + k), not O(k * N).
+ *
+ * @attention Views returned by view() are invalidated by any mutation.
+ */
+class EntryStore
+{
+public:
+    EntryStore() = default;
+    ~EntryStore();
+    EntryStore(const EntryStore &) = delete;
+    EntryStore &operator=(const EntryStore &) = delete;
+
+    /**
+     * @return Number of entries.
+     */
+    int size() const { return static_cast<int>(order.size()) - removedInOrder; }
+    bool isEmpty() const { return size() == 0; }
+    /**
+     * @return Id of the entry at given position (entries keep the order they were added in).
+     */
+    EntryId id(const int index) const { return (removedInOrder == 0) ? order[index] : idInTransaction(index); }
+    /**
+     * @return Position of given entry, in logarithmic time; -1 if entry does not exist.
+     */
+    int indexOf(const EntryId id) const;
+    /**
+     * @return True if given entry exists.
+     */
+    bool contains(const EntryId id) const { return id < alive.size() && alive[id]; }
+
+    /**
+     * @return View of UTF-8 characters of given field.
+     */
+    std::string_view view(const EntryId id, const EntryField field) const;
+    /**
+     * @return Given field as a string.
+     */
+    QString field(const EntryId id, const EntryField field) const;
+    /**
+     * @return Given field of every entry, in entries order.
+     */
+    QStringList column(const EntryField field) const;
+
+    /**
+     * @brief Find an entry from its entry and user names, in constant time.
+     * @return Id of the entry; ENTRY_NOID if entry does not exist.
+     */
+    EntryId find(const QString &entryname, const QString &username) const;
+    EntryId find(const std::string_view entryname, const std::string_view username) const;
+    /**
+     * @brief Find first entry whose given field is equal to given value.
+     * @return Id of the entry; ENTRY_NOID if no entry matches.
+     */
+    EntryId find(const EntryField field, const QString &value) const;
+
+    /**
+     * @brief Find entries whose entry name or user name starts with given prefix, ignoring case.
+     * @param ids: Vector where ids are going to be stored, in entries order (previous content is removed).
+     */
+    void findPrefix(const QString &prefix, std::vector<EntryId> &ids) const;
+    /**
+     * @return True if entry name or user name of given entry starts with given prefix, ignoring case.
+     */
+    bool matchesPrefix(const EntryId id, const QString &prefix) const;
+    /**
+     * @brief Complete an entry name.
+     * @param prefix: Beginning of entry name, case is ignored.
+     * @param maxCount: Maximum number of completions.
+     * @return Distinct entry names starting with [prefix], in alphabetical order (ignoring case).
+     */
+    QStringList completeEntryname(const QString &prefix, const int maxCount) const;
+
+    /**
+     * @brief Add an entry at the end of entries.
+     * @param fields: UTF-8 characters of each field (see ENTRY_SCHEMA), sealed bytes for password.
+     * @return Id of the new entry.
+     */
+    EntryId add(const std::string_view fields[ENTRY_NBFIELDS]);
+    EntryId add(const QString &entryname, const QString &username, const std::string_view password, const QString &date);
+    /**
+     * @brief Remove an entry. Does nothing if entry does not exist.
+     */
+    void remove(const EntryId id);
+    /**
+     * @brief Replace a field of an entry. Does nothing if entry does not exist.
+     */
+    void setField(const EntryId id, const EntryField field, const std::string_view value);
+    void setField(const EntryId id, const EntryField field, const QString &value);
+
+    /**
+     * @brief Start grouping mutations. Does nothing if a transaction is already started.
+     */
+    void begin();
+    /**
+     * @brief Keep mutations made since begin(), and wipe replaced fields.
+     */
+    void commit();
+    /**
+     * @brief Undo mutations made since begin().
+     */
+    void rollback();
+    bool inTransaction() const { return transaction; }
+    /**
+     * @return Number of changes of entries since store creation, so that copies of entries can tell if they are outdated.
+     */
+    quint64 generation() const { return changes; }
+
+    /**
+     * @brief Allocate memory for given number of entries, so that adding them does not reallocate.
+     */
+    void reserve(const int nbEntries);
+    /**
+     * @brief Wipe and remove every entry.
+     */
+    void clear();
+    /**
+     * @brief Exchange entries with another store, without copying them.
+     */
+    void swap(EntryStore &other);
+    /**
+     * @brief Replace entries by a copy of committed entries of another store.
+     * Used to hand a snapshot of entries to another thread. [other] must not be in a transaction.
+     */
+    void assign(const EntryStore &other);
+
+    /**
+     * @return Number of bytes allocated for entries.
+     */
+    size_t memoryUsage() const;
+
+private:
+    struct Span
+    {
+        char *data = nullptr; // in [arena]
+        quint32 length = 0;
+    };
+
+    struct Column
+    {
+        std::vector<Span> spans; // characters of each entry, indexed by id
+    };
+
+    enum UndoOp : unsigned char { UNDO_ADD, UNDO_REMOVE, UNDO_SET };
+
+    struct Undo
+    {
+        UndoOp op;
+        EntryId id;
+        int field = 0;  // UNDO_SET: field replaced
+        Span previous;  // UNDO_SET: previous characters
+    };
+
+    /**
+     * @brief Position lookup of id(), skipping entries removed since begin().
+     */
+    EntryId idInTransaction(const int index) const;
+    /**
+     * @brief Copy characters to arena.
+     */
+    Span append(const std::string_view value);
+    /**
+     * @brief Wipe unreferenced characters and mark them as garbage.
+     */
+    void release(const Span span);
+    /**
+     * @brief Hash of entry and user names, used as key of [nameIndex].
+     */
+    static size_t nameKey(const std::string_view entryname, const std::string_view username);
+    /**
+     * @brief Add an entry to [nameIndex] and prefix indexes, with its current entry and user names.
+     */
+    void indexInsert(const EntryId id);
+    /**
+     * @brief Remove an entry from [nameIndex] and prefix indexes. Must be called before its names are changed or released.
+     */
+    void indexErase(const EntryId id);
+    /**
+     * @brief Copy fields of existing entries to [target], and point spans to them.
+     */
+    void copyEntries(SecureArena &target);
+    /**
+     * @brief Move referenced characters to a new arena and wipe previous one.
+     */
+    void compact();
+    /**
+     * @brief Compact arena if it holds too many unreferenced bytes.
+     */
+    void compactIfNeeded();
+
+    SecureArena arena;                 // UTF-8 characters of every field
+    size_t garbage = 0;                // bytes of [arena] no longer referenced by any entry
+    Column columns[ENTRY_NBFIELDS];
+    std::vector<EntryId> order;        // id of each entry, in entries order, which is increasing id order
+    int removedInOrder = 0;            // entries removed since begin(), still in [order] until commit()
+    std::vector<unsigned char> alive;  // 1 if entry exists, indexed by id
+    std::vector<Undo> undoLog;         // mutations since begin(), or since last mutation outside of a transaction
+    std::unordered_multimap<size_t, EntryId> nameIndex; // existing entries, keyed by nameKey()
+    PrefixIndex entrynamePrefixes;     // existing entries, by entry name
+    PrefixIndex usernamePrefixes;      // existing entries, by user name
+    bool transaction = false;
+    quint64 changes = 0;
+};
+
+} // namespace pwm
+
+#endif // PWMENTRYSTORE_H
@@ -0,0 +1,297 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "pwmfuzzysearch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FUZZY_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define FUZZY_SIMD_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace pwm {
+
+/**
+ * @return Index of lowest set bit of a non zero mask.
+ */
+static inline int firstBit(const unsigned int mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/**
+ * @return True if a character following [c] starts a word.
+ */
+static inline bool isBoundary(const char c)
+{
+    return c == ' ' || c == '.' || c == '-' || c == '_' || c == '@' || c == '/' || c == ':' || c == '+';
+}
+
+const char *FuzzySearch::findByte(const char *begin, const char *end, const char c)
+{
+    const char *p = begin;
+
+#if defined(FUZZY_SIMD_AVX2)
+    const __m256i needle = _mm256_set1_epi8(c);
+    for ( ; end - p >= 32 ; p += 32)
+    {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        const unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+        if (mask != 0) return p + firstBit(mask);
+    }
+#elif defined(FUZZY_SIMD_SSE2)
+    const __m128i needle = _mm_set1_epi8(c);
+    for ( ; end - p >= 16 ; p += 16)
+    {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        const unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+        if (mask != 0) return p + firstBit(mask);
+    }
+#endif
+
+    // Remaining characters (or every character without SIMD)
+    for ( ; p < end ; ++p)
+    {
+        if (*p == c) return p;
+    }
+
+    return end;
+}
+
+int FuzzySearch::score(const std::string_view text, const std::string_view query)
+{
+    if (query.empty() || query.size() > text.size()) return FUZZY_NOMATCH;
+
+    // Forward pass: shortest prefix of text containing query
+    size_t textIndex = 0;
+    size_t queryIndex = 0;
+    for ( ; textIndex < text.size() && queryIndex < query.size() ; ++textIndex)
+    {
+        if (text[textIndex] == query[queryIndex]) ++queryIndex;
+    }
+    if (queryIndex < query.size()) return FUZZY_NOMATCH;
+    const size_t end = textIndex;
+
+    // Backward pass: latest start of a match ending at [end] (fewer gaps), scoring matched characters
+    int score = 0;
+    size_t start = end;
+    size_t next = end; // position of following matched character
+    queryIndex = query.size();
+    while (queryIndex > 0)
+    {
+        --start;
+        if (text[start] != query[queryIndex - 1]) continue;
+
+        score += FUZZY_SCORE_MATCH;
+        if (start == 0 || isBoundary(text[start - 1])) score += FUZZY_BONUS_BOUNDARY;
+
+        // Following matched character is consecutive, or separated by a gap
+        if (next != end)
+        {
+            const size_t gap = next - start - 1;
+            if (gap == 0) score += FUZZY_BONUS_CONSECUTIVE;
+            else score -= FUZZY_PENALTY_GAPSTART + static_cast<int>(gap - 1) * FUZZY_PENALTY_GAPEXTENSION;
+        }
+
+        next = start;
+        --queryIndex;
+    }
+
+    if (query.size() == text.size()) score += FUZZY_BONUS_EXACT;
+
+    return std::max(score, 0); // long gaps must not look like FUZZY_NOMATCH
+}
+
+void FuzzySearch::search(const QString &query, const int maxCount, std::vector<EntryId> &ids)
+{
+    searchFolded(PrefixIndex::fold(query), maxCount, ids);
+}
+
+void FuzzySearch::searchFolded(const std::string_view foldedQuery, const int maxCount, std::vector<EntryId> &ids)
+{
+    ids.clear();
+    if (foldedQuery.empty() || maxCount <= 0) return;
+
+    update();
+
+    for (const Field &field : fields)
+        scan(field, foldedQuery);
+
+    // Keeping best entries, then entries order for equal scores
+    const auto better = [this](const quint32 a, const quint32 b) {
+        return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+    };
+    const size_t count = std::min(touched.size(), static_cast<size_t>(maxCount));
+    std::partial_sort(touched.begin(), touched.begin() + count, touched.end(), better);
+
+    ids.reserve(count);
+    for (size_t rank = 0 ; rank < count ; ++rank)
+        ids.push_back(this->ids[touched[rank]]);
+
+    // Resetting scores for next query
+    for (const quint32 entry : touched)
+        scores[entry] = FUZZY_NOMATCH;
+    touched.clear();
+}
+
+bool FuzzySearch::matches(const EntryId id, const QString &query) const
+{
+    if (!entries->contains(id)) return false;
+
+    const std::string foldedQuery = PrefixIndex::fold(query);
+    std::string entryname = PrefixIndex::fold(entries->view(id, ENTRY_NAME));
+    std::string username = PrefixIndex::fold(entries->view(id, ENTRY_USERNAME));
+    const bool found = score(entryname, foldedQuery) != FUZZY_NOMATCH || score(username, foldedQuery) != FUZZY_NOMATCH;
+
+    // Folded names are copies of entry fields
+    sodium_memzero(&entryname[0], entryname.size());
+    sodium_memzero(&username[0], username.size());
+    return found;
+}
+
+void FuzzySearch::clear()
+{
+    for (Field &field : fields)
+    {
+        field.arena.release();
+        field.folded = std::string_view();
+        std::vector<quint32>().swap(field.starts);
+        std::vector<quint64>().swap(field.masks);
+    }
+
+    std::vector<EntryId>().swap(ids);
+    std::vector<int>().swap(scores);
+    touched.clear();
+    built = false;
+}
+
+quint64 FuzzySearch::mask(const std::string_view text)
+{
+    quint64 mask = 0;
+    for (const char c : text)
+        mask |= quint64(1) << (static_cast<unsigned char>(c) & 63);
+    return mask;
+}
+
+void FuzzySearch::update()
+{
+    if (built && generation == entries->generation()) return;
+
+    const EntryField indexedFields[2] = {ENTRY_NAME, ENTRY_USERNAME};
+    const int nbEntries = entries->size();
+
+    ids.resize(nbEntries);
+    for (int entry = 0 ; entry < nbEntries ; ++entry)
+        ids[entry] = entries->id(entry);
+
+    // Folded names are first gathered in a temporary arena, to size each buffer
+    SecureArena scratch;
+    std::vector<std::string_view> folded(nbEntries);
+
+    for (int field = 0 ; field < 2 ; ++field)
+    {
+        Field &indexed = fields[field];
+        indexed.starts.resize(nbEntries + 1);
+        indexed.masks.resize(nbEntries);
+        std::fill(std::begin(indexed.counts), std::end(indexed.counts), 0);
+
+        size_t size = 0;
+        for (int entry = 0 ; entry < nbEntries ; ++entry)
+        {
+            folded[entry] = PrefixIndex::fold(entries->view(ids[entry], indexedFields[field]), scratch);
+
+            indexed.starts[entry] = static_cast<quint32>(size);
+            indexed.masks[entry] = mask(folded[entry]);
+            for (const char c : folded[entry])
+                ++indexed.counts[static_cast<unsigned char>(c)];
+
+            size += folded[entry].size() + 1;
+        }
+        indexed.starts[nbEntries] = static_cast<quint32>(size);
+
+        // Previous names are wiped, slabs are kept for the new buffer
+        indexed.arena.wipe();
+        char *buffer = (size == 0) ? nullptr : indexed.arena.allocate(size);
+        for (int entry = 0 ; entry < nbEntries ; ++entry)
+        {
+            char *p = buffer + indexed.starts[entry];
+            if (!folded[entry].empty()) memcpy(p, folded[entry].data(), folded[entry].size());
+            p[folded[entry].size()] = '\0';
+        }
+        indexed.folded = std::string_view(buffer, size);
+
+        scratch.wipe();
+    }
+
+    scores.assign(nbEntries, FUZZY_NOMATCH);
+    touched.clear();
+
+    generation = entries->generation();
+    built = true;
+}
+
+void FuzzySearch::scan(const Field &field, const std::string_view query)
+{
+    // Searching least frequent query character skips most entries that cannot match
+    char anchor = query[0];
+    for (const char c : query)
+    {
+        if (field.counts[static_cast<unsigned char>(c)] < field.counts[static_cast<unsigned char>(anchor)])
+            anchor = c;
+    }
+    if (field.counts[static_cast<unsigned char>(anchor)] == 0) return;
+
+    const quint64 queryMask = mask(query);
+    const char *begin = field.folded.data();
+    const char *end = begin + field.folded.size();
+    const char *p = begin;
+    quint32 entry = 0;
+
+    while ((p = findByte(p, end, anchor)) != end)
+    {
+        // Entry containing found character: following entries are tried before a binary search
+        const quint32 position = static_cast<quint32>(p - begin);
+        int steps = 0;
+        while (field.starts[entry + 1] <= position && steps < 8)
+        {
+            ++entry;
+            ++steps;
+        }
+        if (field.starts[entry + 1] <= position)
+            entry = static_cast<quint32>(std::upper_bound(field.starts.begin() + entry, field.starts.end(), position) - field.starts.begin() - 1);
+
+        const quint32 start = field.starts[entry];
+        const quint32 next = field.starts[entry + 1];
+
+        if ((field.masks[entry] & queryMask) == queryMask)
+        {
+            const int entryScore = score(std::string_view(begin + start, next - start - 1), query); // without '\0'
+            if (entryScore != FUZZY_NOMATCH && entryScore > scores[entry])
+            {
+                if (scores[entry] == FUZZY_NOMATCH) touched.push_back(entry);
+                scores[entry] = entryScore;
+            }
+        }
+
+        // Next entry
+        p = begin + next;
+    }
+}
+
+} // namespace pwm
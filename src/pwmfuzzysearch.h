@@ -0,0 +1,112 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMFUZZYSEARCH_H
+#define PWMFUZZYSEARCH_H
+
+#include <QString>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pwmentrystore.h"
+#include "pwmsecurearena.h"
+
+// Fuzzy match scores (see FuzzySearch::score())
+#define FUZZY_SCORE_MATCH 16       // each matched character
+#define FUZZY_BONUS_BOUNDARY 8     // matched character starts a word
+#define FUZZY_BONUS_CONSECUTIVE 4  // matched character follows previous matched character
+#define FUZZY_BONUS_EXACT 16       // whole field matched
+#define FUZZY_PENALTY_GAPSTART 3   // first unmatched character between two matched characters
+#define FUZZY_PENALTY_GAPEXTENSION 1 // following unmatched characters
+#define FUZZY_NOMATCH (-1)
+
+
+namespace pwm {
+
+/**
+ * @brief Fuzzy search of entries by entry and user names.
+ *
+ * An entry matches if characters of query appear in its entry or user name,
+ * in the same order, ignoring case. Matches are scored in the style of fzf:
+ * consecutive characters and characters starting a word score higher, gaps lower.
+ *
+ * Case folded names of every entry are copied into one contiguous buffer per field,
+ * in secure memory (see SecureArena), wiped and rebuilt when store has changed since last search. A query scans each buffer for its
+ * least frequent character with SIMD instructions (AVX2 if enabled at compile time, SSE2 on x86-64,
+ * scalar otherwise); entries containing it are scored if they contain every query character.
+ */
+class FuzzySearch
+{
+public:
+    FuzzySearch(const EntryStore *entries) : entries(entries) {}
+
+    /**
+     * @brief Find best matching entries.
+     * @param query: Searched characters, case is ignored.
+     * @param maxCount: Maximum number of entries.
+     * @param ids: Vector where ids are going to be stored, best first (previous content is removed).
+     */
+    void search(const QString &query, const int maxCount, std::vector<EntryId> &ids);
+    /**
+     * @brief Same as search(), with an already case folded query.
+     */
+    void searchFolded(const std::string_view foldedQuery, const int maxCount, std::vector<EntryId> &ids);
+    /**
+     * @return True if entry or user name of given entry matches query.
+     */
+    bool matches(const EntryId id, const QString &query) const;
+    /**
+     * @brief Wipe and free copied names, until next search.
+     */
+    void clear();
+
+    /**
+     * @brief Score a case folded field against a case folded query.
+     * @return Score; FUZZY_NOMATCH if characters of query do not appear in [text] in order.
+     */
+    static int score(const std::string_view text, const std::string_view query);
+
+    /**
+     * @return Position of first occurrence of [c] in [begin, end); [end] if not found.
+     */
+    static const char *findByte(const char *begin, const char *end, const char c);
+
+private:
+    struct Field
+    {
+        SecureArena arena;           // holds [folded]
+        std::string_view folded;     // case folded field of each entry, each followed by '\0'
+        std::vector<quint32> starts; // offset of each entry in [folded], then size of [folded]
+        std::vector<quint64> masks;  // characters of each entry, see mask()
+        size_t counts[256];          // number of occurrences of each byte in [folded]
+    };
+
+    /**
+     * @return Set of characters of [text], as bits of a 64 bits mask (several characters share a bit).
+     */
+    static quint64 mask(const std::string_view text);
+
+    /**
+     * @brief Copy case folded names of entries if store has changed.
+     */
+    void update();
+    /**
+     * @brief Score every entry of a field containing first query character.
+     */
+    void scan(const Field &field, const std::string_view query);
+
+    const EntryStore *entries;
+    quint64 generation = 0;
+    bool built = false;
+
+    Field fields[2];              // entry names, user names
+    std::vector<EntryId> ids;     // id of each entry, in buffers order
+    std::vector<int> scores;      // best score of each entry for current query
+    std::vector<quint32> touched; // entries scored for current query
+};
+
+} // namespace pwm
+
+#endif // PWMFUZZYSEARCH_H
@@ -0,0 +1,585 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "pwmjournal.h"
+
+#include <QFile>
+#include <QtEndian>
+#include <cstring>
+
+#define JOURNAL_NPUBBYTES crypto_aead_xchacha20poly1305_ietf_NPUBBYTES
+#define JOURNAL_ABYTES crypto_aead_xchacha20poly1305_ietf_ABYTES
+// Additional data: base id + sequence number + MAC of previous record
+#define JOURNAL_ADBYTES (JOURNAL_BASEIDBYTES + sizeof(quint64) + JOURNAL_ABYTES)
+// Records follow base id and both head slots
+#define JOURNAL_RECORDSOFFSET (JOURNAL_BASEIDBYTES + 2 * JOURNAL_HEADBYTES)
+
+namespace pwm {
+
+/**
+ * @brief Read base id (stream header) of entries file.
+ * @return 0 if successfully read base id; -1 otherwise.
+ */
+static int readBaseId(unsigned char baseId[JOURNAL_BASEIDBYTES])
+{
+    EntriesHeader header;
+    if (readEntriesHeader(header) != 0) return -1;
+
+    memcpy(baseId, header.streamHeader, JOURNAL_BASEIDBYTES);
+    return 0;
+}
+
+/**
+ * @brief Build additional data authenticating a record's position.
+ */
+static void journalAd(unsigned char ad[JOURNAL_ADBYTES], const unsigned char baseId[JOURNAL_BASEIDBYTES], const quint64 sequence, const unsigned char previousMac[JOURNAL_ABYTES])
+{
+    memcpy(ad, baseId, JOURNAL_BASEIDBYTES);
+    qToLittleEndian<quint64>(sequence, ad + JOURNAL_BASEIDBYTES);
+    memcpy(ad + JOURNAL_BASEIDBYTES + sizeof sequence, previousMac, JOURNAL_ABYTES);
+}
+
+/**
+ * @brief Acknowledged state of journal, stored in a head slot.
+ */
+struct JournalHead
+{
+    quint64 generation = 0; // incremented by every batch, selects slot (generation % 2)
+    quint64 count = 0;      // number of acknowledged records
+};
+
+/**
+ * @brief Encode a head slot: generation, count, then MAC of base id, generation and count.
+ */
+static void encodeHead(unsigned char slot[JOURNAL_HEADBYTES], const SessionKey &key, const unsigned char baseId[JOURNAL_BASEIDBYTES], const JournalHead &head)
+{
+    unsigned char headKey[crypto_generichash_KEYBYTES];
+    crypto_generichash_state state;
+
+    qToLittleEndian<quint64>(head.generation, slot);
+    qToLittleEndian<quint64>(head.count, slot + sizeof(quint64));
+
+    crypto_kdf_derive_from_key(headKey, sizeof headKey, JOURNAL_KDF_SUBKEY_HEAD, JOURNAL_KDF_CONTEXT, key.data());
+    crypto_generichash_init(&state, headKey, sizeof headKey, JOURNAL_HEADMACBYTES);
+    crypto_generichash_update(&state, baseId, JOURNAL_BASEIDBYTES);
+    crypto_generichash_update(&state, slot, 2 * sizeof(quint64));
+    crypto_generichash_final(&state, slot + 2 * sizeof(quint64), JOURNAL_HEADMACBYTES);
+    sodium_memzero(headKey, sizeof headKey);
+}
+
+/**
+ * @brief Read both head slots of an open journal, positioned after base id, and keep the latest valid one.
+ * @return 0 if a head is valid; -1 otherwise.
+ */
+static int readHead(FILE * journalFile, const SessionKey &key, const unsigned char baseId[JOURNAL_BASEIDBYTES], JournalHead &head)
+{
+    unsigned char headSlots[2][JOURNAL_HEADBYTES];
+    unsigned char expected[JOURNAL_HEADBYTES];
+    int nbValid = 0;
+
+    if (fread(headSlots, 1, sizeof headSlots, journalFile) != sizeof headSlots)
+    {
+        qCritical() << "Journal head is incomplete.";
+        return -1;
+    }
+
+    for (const auto &slot : headSlots)
+    {
+        JournalHead candidate;
+        candidate.generation = qFromLittleEndian<quint64>(slot);
+        candidate.count = qFromLittleEndian<quint64>(slot + sizeof(quint64));
+
+        encodeHead(expected, key, baseId, candidate);
+        if (sodium_memcmp(expected, slot, JOURNAL_HEADBYTES) != 0) continue;
+
+        if (nbValid == 0 || candidate.generation > head.generation) head = candidate;
+        ++nbValid;
+    }
+
+    if (nbValid == 0)
+    {
+        qCritical() << "Failed to authenticate journal head.";
+        return -1;
+    }
+    // Both slots are valid once written: the other one was being written, or was altered
+    if (nbValid == 1) qWarning() << "Journal head slot is invalid. Kept latest valid head.";
+
+    return 0;
+}
+
+/**
+ * @brief Write head of given generation to its slot, and flush journal to disk.
+ * @return 0 if successfully wrote head; -1 otherwise.
+ */
+static int writeHead(FILE * journalFile, const SessionKey &key, const unsigned char baseId[JOURNAL_BASEIDBYTES], const JournalHead &head)
+{
+    unsigned char slot[JOURNAL_HEADBYTES];
+    encodeHead(slot, key, baseId, head);
+
+    if (fseek(journalFile, JOURNAL_BASEIDBYTES + (head.generation % 2) * JOURNAL_HEADBYTES, SEEK_SET) != 0
+        || fwrite(slot, 1, sizeof slot, journalFile) != sizeof slot
+        || syncFile(journalFile) != 0)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * @brief Create an empty journal for given entries file, replacing any previous one.
+ * @return 0 if successfully created journal; -1 otherwise.
+ */
+static int createJournal(const SessionKey &key, const unsigned char baseId[JOURNAL_BASEIDBYTES])
+{
+    FILE * journalFile = fopen(JOURNAL_TMPFILE, "wb");
+    if (journalFile == NULL) return -1;
+
+    // Both slots are valid from the start, without any record
+    JournalHead previous;
+    JournalHead head;
+    head.generation = 1;
+    int returnValue = -1;
+
+    if (fwrite(baseId, 1, JOURNAL_BASEIDBYTES, journalFile) == JOURNAL_BASEIDBYTES
+        && writeHead(journalFile, key, baseId, previous) == 0
+        && writeHead(journalFile, key, baseId, head) == 0)
+        returnValue = 0;
+
+    if (fclose(journalFile) != 0) returnValue = -1;
+    if (returnValue == 0 && replaceFile(JOURNAL_TMPFILE, "entries.journal") != 0) returnValue = -1;
+    if (returnValue != 0) remove(JOURNAL_TMPFILE);
+
+    return returnValue;
+}
+
+/**
+ * @brief Read length of next record.
+ * @return True if a whole length was read.
+ */
+static bool readLength(FILE * journalFile, quint32 &length)
+{
+    unsigned char lengthLE[sizeof(quint32)];
+    if (fread(lengthLE, 1, sizeof lengthLE, journalFile) != sizeof lengthLE) return false;
+
+    length = qFromLittleEndian<quint32>(lengthLE);
+    return true;
+}
+
+/**
+ * @return Number of fields of a change of type [op]; -1 if [op] is unknown.
+ */
+static int journalFieldCount(const JournalOp op)
+{
+    switch (op)
+    {
+    case JOURNAL_ADD:
+    case JOURNAL_REGENERATE:
+    case JOURNAL_RENAME:
+        return JOURNAL_MAXFIELDS;
+    case JOURNAL_DELETE:
+        return 2;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Encode the first [NbFields] fields as a record, after op byte of [plain].
+ */
+template <int NbFields>
+static void encodeFields(const QList<QByteArray> &bytes, QByteArray &plain)
+{
+    std::string_view fields[NbFields];
+    for (int field = 0 ; field < NbFields ; ++field)
+        fields[field] = std::string_view(bytes[field].constData(), bytes[field].size());
+
+    plain.resize(1 + RecordCodec<NbFields>::encodedLength(fields));
+    RecordCodec<NbFields>::encode(reinterpret_cast<unsigned char *>(plain.data()) + 1, fields);
+}
+
+/**
+ * @brief Encode a change as record plaintext: op, then its fields as a record.
+ * Change must have the number of fields of its op (see journalFieldCount()).
+ */
+static void encodeChange(const JournalChange &change, QByteArray &plain)
+{
+    if (journalFieldCount(change.op) == JOURNAL_MAXFIELDS)
+        encodeFields<JOURNAL_MAXFIELDS>(change.fields, plain);
+    else
+        encodeFields<2>(change.fields, plain);
+    plain[0] = static_cast<char>(change.op);
+}
+
+/**
+ * @brief Apply a decrypted record to entries.
+ * @return 0 if record is well formed; -1 otherwise.
+ */
+static int applyRecord(const unsigned char *plain, const size_t plainLength, EntryStore &entries)
+{
+    const JournalOp op = static_cast<JournalOp>(plain[0]);
+    const int expectedFields = journalFieldCount(op);
+    std::string_view fields[JOURNAL_MAXFIELDS];
+
+    if (expectedFields == -1)
+    {
+        qCritical() << "Unknown journal record type" << op << ".";
+        return -1;
+    }
+
+    const int nbFields = JournalRecord::decode(plain + 1, plainLength - 1, fields);
+
+    if (nbFields != expectedFields)
+    {
+        qCritical() << "Journal record has" << nbFields << "fields instead of" << expectedFields << ".";
+        return -1;
+    }
+
+    const EntryId id = entries.find(fields[0], fields[1]);
+
+    if (op != JOURNAL_ADD && id == ENTRY_NOID)
+    {
+        // Should never happen since records are written after their entry exists
+        qWarning() << "Journal record refers to a missing entry. Skipped record.";
+        return 0;
+    }
+
+    switch (op)
+    {
+    case JOURNAL_ADD:
+    {
+        if (id != ENTRY_NOID)
+        {
+            qWarning() << "Journal record adds an existing entry. Skipped record.";
+            break;
+        }
+        std::string_view entryFields[ENTRY_NBFIELDS];
+        entryFields[ENTRY_NAME] = fields[0];
+        entryFields[ENTRY_USERNAME] = fields[1];
+        entryFields[ENTRY_PASSWORD] = fields[2];
+        entryFields[ENTRY_DATE] = fields[3];
+        entries.add(entryFields);
+        break;
+    }
+    case JOURNAL_DELETE:
+        entries.remove(id);
+        break;
+    case JOURNAL_REGENERATE:
+        entries.setField(id, ENTRY_PASSWORD, fields[2]);
+        entries.setField(id, ENTRY_DATE, fields[3]);
+        break;
+    case JOURNAL_RENAME:
+    {
+        // Renames are checked before they are journaled: two entries never share names
+        const EntryId existing = entries.find(fields[2], fields[3]);
+        if (existing != ENTRY_NOID && existing != id)
+        {
+            qWarning() << "Journal record renames an entry as another existing entry. Skipped record.";
+            break;
+        }
+        entries.setField(id, ENTRY_NAME, fields[2]);
+        entries.setField(id, ENTRY_USERNAME, fields[3]);
+        break;
+    }
+    }
+
+    return 0;
+}
+
+int appendJournal(const SessionKey &key, const JournalOp op, const QList<QByteArray> &fields)
+{
+    JournalChange change;
+    change.op = op;
+    change.fields = fields;
+
+    return appendJournal(key, QVector<JournalChange>{change});
+}
+
+int appendJournal(const SessionKey &key, const QVector<JournalChange> &changes)
+{
+    int returnValue = -1;
+
+    if (!key.isValid())
+    {
+        qCritical() << "Session key is not derived. Aborted before journal writing.";
+        return returnValue;
+    }
+
+    // Whole batch is rejected before any record is written
+    for (const JournalChange &change : changes)
+    {
+        const int nbFields = journalFieldCount(change.op);
+        if (nbFields == -1 || change.fields.size() != nbFields)
+        {
+            qCritical() << "Journal change of type" << change.op << "has" << change.fields.size() << "fields. Aborted before journal writing.";
+            return returnValue;
+        }
+    }
+
+    unsigned char baseId[JOURNAL_BASEIDBYTES];
+    if (readBaseId(baseId) != 0)
+    {
+        qCritical() << "Failed to read entries file header. Aborted before journal writing.";
+        return returnValue;
+    }
+
+    unsigned char journalId[JOURNAL_BASEIDBYTES];
+    unsigned char previousMac[JOURNAL_ABYTES] = {0};
+    JournalHead head;
+    quint64 sequence = 0;
+    long validEnd = JOURNAL_RECORDSOFFSET;
+    quint32 length;
+
+    // Journal applies to a previous entries file, or does not exist: starting over
+    FILE * journalFile = fopen("entries.journal", "r+b");
+    if (journalFile != NULL
+        && (fread(journalId, 1, sizeof journalId, journalFile) != sizeof journalId
+            || sodium_memcmp(journalId, baseId, sizeof baseId) != 0))
+    {
+        fclose(journalFile);
+        journalFile = NULL;
+    }
+    if (journalFile == NULL)
+    {
+        if (createJournal(key, baseId) != 0
+            || (journalFile = fopen("entries.journal", "r+b")) == NULL
+            || fseek(journalFile, JOURNAL_BASEIDBYTES, SEEK_SET) != 0)
+        {
+            qCritical() << "Failed to create journal file. Aborted journal writing.";
+            if (journalFile != NULL) fclose(journalFile);
+            return returnValue;
+        }
+    }
+
+    if (readHead(journalFile, key, baseId, head) != 0)
+    {
+        qCritical() << "Journal head is corrupted. Aborted journal writing.";
+        goto ret;
+    }
+
+    // Walking acknowledged records to find previous MAC
+    while (sequence < head.count)
+    {
+        if (!readLength(journalFile, length)
+            || length <= JOURNAL_ABYTES || length > JOURNAL_RECORD_MAXLEN
+            || fseek(journalFile, JOURNAL_NPUBBYTES + length - JOURNAL_ABYTES, SEEK_CUR) != 0
+            || fread(previousMac, 1, sizeof previousMac, journalFile) != sizeof previousMac)
+        {
+            qCritical() << "Journal holds" << sequence << "records of" << head.count << ". Aborted journal writing.";
+            goto ret;
+        }
+        ++sequence;
+    }
+    validEnd = ftell(journalFile);
+
+    // Dropping records of a batch interrupted before its head was written
+    fseek(journalFile, 0, SEEK_END);
+    if (ftell(journalFile) > validEnd)
+    {
+        qWarning() << "Journal ends with unacknowledged records. Records dropped.";
+        fclose(journalFile);
+        if (!QFile::resize("entries.journal", validEnd)
+            || (journalFile = fopen("entries.journal", "r+b")) == NULL)
+        {
+            qCritical() << "Failed to drop unacknowledged journal records. Aborted journal writing.";
+            return returnValue;
+        }
+    }
+
+    if (fseek(journalFile, validEnd, SEEK_SET) != 0)
+    {
+        qCritical() << "Failed to seek end of journal. Aborted journal writing.";
+        goto ret;
+    }
+
+    {
+        unsigned char journalKey[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
+        unsigned char nonce[JOURNAL_NPUBBYTES];
+        unsigned char ad[JOURNAL_ADBYTES];
+        unsigned char lengthLE[sizeof(quint32)];
+        QByteArray recordPlain;
+        QByteArray recordCipher;
+        bool written = true;
+
+        crypto_kdf_derive_from_key(journalKey, sizeof journalKey, JOURNAL_KDF_SUBKEY, JOURNAL_KDF_CONTEXT, key.data());
+
+        for (const JournalChange &change : changes)
+        {
+            // Encrypting record, chained to previous one
+            encodeChange(change, recordPlain);
+            recordCipher.resize(recordPlain.size() + JOURNAL_ABYTES);
+            qToLittleEndian<quint32>(recordCipher.size(), lengthLE);
+
+            randombytes_buf(nonce, sizeof nonce);
+            journalAd(ad, baseId, sequence, previousMac);
+
+            crypto_aead_xchacha20poly1305_ietf_encrypt(
+                reinterpret_cast<unsigned char *>(recordCipher.data()), NULL,
+                reinterpret_cast<const unsigned char *>(recordPlain.constData()), recordPlain.size(),
+                ad, sizeof ad,
+                NULL, nonce, journalKey);
+
+            sodium_memzero(recordPlain.data(), recordPlain.size());
+
+            // Writing record after previous one
+            if (fwrite(lengthLE, 1, sizeof lengthLE, journalFile) != sizeof lengthLE
+                || fwrite(nonce, 1, sizeof nonce, journalFile) != sizeof nonce
+                || fwrite(recordCipher.constData(), 1, recordCipher.size(), journalFile) != static_cast<size_t>(recordCipher.size()))
+            {
+                written = false;
+                break;
+            }
+
+            memcpy(previousMac, recordCipher.constData() + recordCipher.size() - JOURNAL_ABYTES, JOURNAL_ABYTES);
+            ++sequence;
+        }
+
+        sodium_memzero(journalKey, sizeof journalKey);
+
+        // Whole batch reaches disk before it is acknowledged by next head
+        if (!written || syncFile(journalFile) != 0)
+        {
+            qCritical() << "Failed to write journal records. Aborted journal writing.";
+            goto ret;
+        }
+    }
+
+    // Commit point
+    head.generation += 1;
+    head.count = sequence;
+    if (writeHead(journalFile, key, baseId, head) != 0)
+    {
+        qCritical() << "Failed to write journal head. Aborted journal writing.";
+        goto ret;
+    }
+
+    returnValue = 0;
+ret:
+    fclose(journalFile);
+    return returnValue;
+}
+
+int replayJournal(const SessionKey &key, const unsigned char baseId[JOURNAL_BASEIDBYTES], EntryStore &entries)
+{
+    FILE * journalFile = fopen("entries.journal", "rb");
+    if (journalFile == NULL) return 0; // no change since entries file was written
+
+    int returnValue = -1;
+    unsigned char journalId[JOURNAL_BASEIDBYTES];
+    unsigned char journalKey[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
+    unsigned char previousMac[JOURNAL_ABYTES] = {0};
+    unsigned char nonce[JOURNAL_NPUBBYTES];
+    unsigned char ad[JOURNAL_ADBYTES];
+    QByteArray recordCipher;
+    QByteArray recordPlain;
+    JournalHead head;
+    quint64 sequence = 0;
+    quint32 length;
+
+    if (fread(journalId, 1, sizeof journalId, journalFile) != sizeof journalId
+        || sodium_memcmp(journalId, baseId, sizeof journalId) != 0)
+    {
+        // Entries file has been re-written after last journal record: it already contains all changes
+        qWarning() << "Journal does not apply to entries file. Journal ignored.";
+        fclose(journalFile);
+        return 0;
+    }
+
+    crypto_kdf_derive_from_key(journalKey, sizeof journalKey, JOURNAL_KDF_SUBKEY, JOURNAL_KDF_CONTEXT, key.data());
+
+    if (readHead(journalFile, key, baseId, head) != 0)
+    {
+        qCritical() << "Journal head is corrupted. Aborted journal replay.";
+        goto ret;
+    }
+
+    // Records pull: only acknowledged ones, every one of them
+    while (sequence < head.count)
+    {
+        if (!readLength(journalFile, length))
+        {
+            qCritical() << "Journal holds" << sequence << "records of" << head.count << ". Aborted journal replay.";
+            goto ret;
+        }
+        if (length <= JOURNAL_ABYTES || length > JOURNAL_RECORD_MAXLEN)
+        {
+            qCritical() << "Journal record has an invalid length. Aborted journal replay.";
+            goto ret;
+        }
+
+        recordCipher.resize(length);
+        recordPlain.resize(length - JOURNAL_ABYTES);
+
+        if (fread(nonce, 1, sizeof nonce, journalFile) != sizeof nonce
+            || fread(recordCipher.data(), 1, length, journalFile) != length)
+        {
+            qCritical() << "Journal record" << sequence << "is incomplete. Aborted journal replay.";
+            goto ret;
+        }
+
+        journalAd(ad, baseId, sequence, previousMac);
+
+        if (crypto_aead_xchacha20poly1305_ietf_decrypt(
+                reinterpret_cast<unsigned char *>(recordPlain.data()), NULL, NULL,
+                reinterpret_cast<const unsigned char *>(recordCipher.constData()), length,
+                ad, sizeof ad,
+                nonce, journalKey) != 0)
+        {
+            // Corrupted, moved or removed record
+            qCritical() << "Failed to authenticate journal record" << sequence << ". Aborted journal replay.";
+            goto ret;
+        }
+
+        if (applyRecord(reinterpret_cast<const unsigned char *>(recordPlain.constData()), recordPlain.size(), entries) != 0)
+        {
+            qCritical() << "Failed to apply journal record" << sequence << ". Aborted journal replay.";
+            goto ret;
+        }
+
+        memcpy(previousMac, recordCipher.constData() + length - JOURNAL_ABYTES, JOURNAL_ABYTES);
+        ++sequence;
+    }
+
+    returnValue = 0;
+ret:
+    sodium_memzero(journalKey, sizeof journalKey);
+    sodium_memzero(recordPlain.data(), recordPlain.size());
+    fclose(journalFile);
+    return returnValue;
+}
+
+int resetJournal()
+{
+    FILE * journalFile = fopen("entries.journal", "rb");
+    if (journalFile == NULL) return 0;
+    fclose(journalFile);
+
+    if (remove("entries.journal") != 0)
+    {
+        qWarning() << "Failed to remove journal file.";
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Size of a file in bytes; 0 if it does not exist.
+ */
+static long fileSize(const char *fileName)
+{
+    FILE * file = fopen(fileName, "rb");
+    if (file == NULL) return 0;
+
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fclose(file);
+
+    return size;
+}
+
+bool journalNeedsCompaction()
+{
+    const long journalSize = fileSize("entries.journal");
+    return journalSize > JOURNAL_MAXSIZE || journalSize > fileSize("entries.cipher");
+}
+
+} // namespace pwm
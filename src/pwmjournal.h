@@ -0,0 +1,156 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMJOURNAL_H
+#define PWMJOURNAL_H
+
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+#include <QDebug>
+
+#include <sodium.h>
+#include <cstdio>
+
+#include "pwmsecurity.h"
+#include "pwmrecord.h"
+
+// Journal records are sealed with a subkey of session key, journal head is authenticated with another one
+#define JOURNAL_KDF_CONTEXT "pwmjrnal"
+#define JOURNAL_KDF_SUBKEY 1
+#define JOURNAL_KDF_SUBKEY_HEAD 2
+
+// Journal is compacted into entries file when it grows beyond entries file size or this size
+#define JOURNAL_MAXSIZE 65536
+// Records bigger than this are considered corrupted
+#define JOURNAL_RECORD_MAXLEN 65536
+
+#define JOURNAL_BASEIDBYTES crypto_secretstream_xchacha20poly1305_HEADERBYTES
+// Journal head slot: generation, record count, MAC
+#define JOURNAL_HEADMACBYTES crypto_generichash_BYTES
+#define JOURNAL_HEADBYTES (2 * sizeof(quint64) + JOURNAL_HEADMACBYTES)
+// New journal being written, renamed once complete
+#define JOURNAL_TMPFILE "entries.journal.tmp"
+
+// Most fields of a change (see JournalOp)
+#define JOURNAL_MAXFIELDS 4
+
+
+namespace pwm {
+
+/**
+ * @brief Type of change stored in a journal record.
+ *
+ * Fields of each type:
+ * JOURNAL_ADD:        entryname, username, password, date
+ * JOURNAL_DELETE:     entryname, username
+ * JOURNAL_REGENERATE: entryname, username, password, date
+ * JOURNAL_RENAME:     old entryname, old username, new entryname, new username
+ *
+ * Names and dates are UTF-8, passwords are journaled as they are stored: sealed (see sealPassword()).
+ * Fields may hold any byte, tabs and line breaks included (see JournalRecord).
+ */
+enum JournalOp : unsigned char
+{
+    JOURNAL_ADD = 1,
+    JOURNAL_DELETE = 2,
+    JOURNAL_REGENERATE = 3,
+    JOURNAL_RENAME = 4
+};
+
+// Fields of journal records
+using JournalRecord = RecordCodec<JOURNAL_MAXFIELDS>;
+
+/**
+ * @brief Change stored in a journal record.
+ */
+struct JournalChange
+{
+    JournalOp op;
+    QList<QByteArray> fields; // see JournalOp
+};
+
+/**
+ * @brief Append a change to entries journal file.
+ *
+ * @param key: Session key used for encryption.
+ * @param op: Type of change.
+ * @param fields: Fields of the change (see JournalOp).
+ * @return 0 if successfully appended record; -1 otherwise, e.g. if [fields] does not match [op].
+ *
+ * Only the change is encrypted and written, whatever the number of entries.
+ * Journal is started over if it does not apply to current entries file.
+ *
+ * File structure:
+ * base id   (unsigned char, header of the entries file the journal applies to)
+ * head 0
+ * head 1
+ * record 1
+ * record 2
+ * ...
+ *
+ * Head structure:
+ * generation (quint64, little endian)
+ * count      (quint64, little endian, number of acknowledged records)
+ * MAC        (unsigned char, JOURNAL_HEADMACBYTES, keyed hash of base id, generation and count)
+ *
+ * Record structure:
+ * length    (quint32, little endian, length of cipher)
+ * nonce     (unsigned char)
+ * cipher    (unsigned char, MAC included)
+ *
+ * Record plaintext:
+ * op        (unsigned char, JournalOp)
+ * fields    (JournalRecord of the fields of op)
+ *
+ * Each record is authenticated with base id, its sequence number and MAC of
+ * previous record, so that records cannot be moved, removed or replayed on another
+ * entries file. Once records are flushed to disk, record count is written to the head
+ * slot of next generation, then flushed again: it is the commit point of the batch.
+ * Heads alternate between two slots, so that an interrupted head write leaves the
+ * previous one valid. Journal is created complete (see replaceFile()), with both heads.
+ */
+int appendJournal(const SessionKey &key, const JournalOp op, const QList<QByteArray> &fields);
+
+/**
+ * @brief Append several changes to entries journal file, in their order.
+ *
+ * @param key: Session key used for encryption.
+ * @param changes: Changes to append.
+ * @return 0 if successfully appended every record; -1 otherwise.
+ *
+ * Journal file is opened and flushed to disk once for all changes (see appendJournal()).
+ */
+int appendJournal(const SessionKey &key, const QVector<JournalChange> &changes);
+
+/**
+ * @brief Apply journal records to entries read from entries file.
+ *
+ * @param key: Session key used for decryption.
+ * @param baseId: Header of entries file [entries] were read from.
+ * @param entries: Entries read from entries file, updated in place.
+ * @return 0 if journal was successfully applied or does not apply to entries file; -1 otherwise.
+ *
+ * Records are read, verified and applied one at a time, up to the record count of the
+ * valid head with the highest generation.
+ * Records applied before an error are kept: group replay in an EntryStore transaction to undo them.
+ * Records after that count (interrupted batch) are ignored. A journal holding fewer records
+ * than that count has been cut, and is rejected, so that acknowledged changes are never rolled back.
+ */
+int replayJournal(const SessionKey &key, const unsigned char baseId[JOURNAL_BASEIDBYTES], EntryStore &entries);
+
+/**
+ * @brief Remove journal file. Called once entries file contains all changes.
+ * @return 0 if journal file was removed or did not exist; -1 otherwise.
+ */
+int resetJournal();
+
+/**
+ * @brief Tell if journal should be compacted into entries file.
+ * @return True if journal is bigger than entries file or JOURNAL_MAXSIZE.
+ */
+bool journalNeedsCompaction();
+
+} // namespace pwm
+
+#endif // PWMJOURNAL_H
@@ -0,0 +1,205 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "pwmkeyfile.h"
+#include "pwmsecurity.h"
+
+#include <cstring>
+
+namespace pwm {
+
+/**
+ * @brief Associated data of a slot: file magic, version and slot kind.
+ */
+static void slotAd(unsigned char ad[KEYFILE_MAGICBYTES + 2], const quint8 kind)
+{
+    memcpy(ad, KEYFILE_MAGIC, KEYFILE_MAGICBYTES);
+    ad[KEYFILE_MAGICBYTES] = KEYFILE_VERSION;
+    ad[KEYFILE_MAGICBYTES + 1] = kind;
+}
+
+const KeySlot *KeyFile::find(const KeySlotKind kind) const
+{
+    for (const KeySlot &slot : keySlots)
+    {
+        if (slot.kind == kind) return &slot;
+    }
+    return nullptr;
+}
+
+bool keyFileExists()
+{
+    FILE * keyFile = fopen(KEYFILE_NAME, "rb");
+    if (keyFile == NULL) return false;
+
+    fclose(keyFile);
+    return true;
+}
+
+int readKeyFile(KeyFile &keyFile, const char *fileName)
+{
+    FILE * file = fopen(fileName, "rb");
+    unsigned char header[KEYFILE_HEADERBYTES];
+    int returnValue = -1;
+
+    keyFile.keySlots.clear();
+
+    if (file == NULL)
+    {
+        qCritical() << "Failed to open key file.";
+        return returnValue;
+    }
+
+    if (fread(header, 1, sizeof header, file) != sizeof header
+        || memcmp(header, KEYFILE_MAGIC, KEYFILE_MAGICBYTES) != 0)
+    {
+        qCritical() << "Failed to read key file header.";
+        goto ret;
+    }
+    if (header[4] != KEYFILE_VERSION)
+    {
+        qCritical() << "Key file version" << header[4] << "is not supported.";
+        goto ret;
+    }
+    if (header[5] > KEYFILE_MAXSLOTS)
+    {
+        qCritical() << "Key file has too many slots.";
+        goto ret;
+    }
+
+    keyFile.keySlots.resize(header[5]);
+    for (KeySlot &slot : keyFile.keySlots)
+    {
+        unsigned char slotHeader[4];
+        if (fread(slotHeader, 1, sizeof slotHeader, file) != sizeof slotHeader
+            || fread(slot.nonce, 1, sizeof slot.nonce, file) != sizeof slot.nonce
+            || fread(slot.wrapped, 1, sizeof slot.wrapped, file) != sizeof slot.wrapped)
+        {
+            qCritical() << "Failed to read key slot.";
+            keyFile.keySlots.clear();
+            goto ret;
+        }
+        slot.kind = slotHeader[0];
+    }
+
+    returnValue = 0;
+ret:
+    fclose(file);
+    return returnValue;
+}
+
+int writeKeyFile(const KeyFile &keyFile, const char *fileName)
+{
+    if (keyFile.keySlots.empty() || keyFile.keySlots.size() > KEYFILE_MAXSLOTS)
+    {
+        qCritical() << "Invalid number of key slots. Aborted key file writing.";
+        return -1;
+    }
+
+    FILE * file = fopen(fileName, "wb");
+    unsigned char header[KEYFILE_HEADERBYTES] = {0};
+    int returnValue = -1;
+
+    if (file == NULL)
+    {
+        qCritical() << "Failed to open key file. Aborted key file writing.";
+        return returnValue;
+    }
+
+    memcpy(header, KEYFILE_MAGIC, KEYFILE_MAGICBYTES);
+    header[4] = KEYFILE_VERSION;
+    header[5] = static_cast<unsigned char>(keyFile.keySlots.size());
+    if (fwrite(header, 1, sizeof header, file) != sizeof header)
+    {
+        qCritical() << "Failed to write key file header. Aborted key file writing.";
+        goto ret;
+    }
+
+    for (const KeySlot &slot : keyFile.keySlots)
+    {
+        const unsigned char slotHeader[4] = {slot.kind, 0, 0, 0};
+        if (fwrite(slotHeader, 1, sizeof slotHeader, file) != sizeof slotHeader
+            || fwrite(slot.nonce, 1, sizeof slot.nonce, file) != sizeof slot.nonce
+            || fwrite(slot.wrapped, 1, sizeof slot.wrapped, file) != sizeof slot.wrapped)
+        {
+            qCritical() << "Failed to write key slot. Aborted key file writing.";
+            goto ret;
+        }
+    }
+
+    if (syncFile(file) != 0)
+    {
+        qCritical() << "Failed to flush key file to disk. Aborted key file writing.";
+        goto ret;
+    }
+
+    returnValue = 0;
+ret:
+    if (fclose(file) != 0) returnValue = -1;
+    return returnValue;
+}
+
+int wrapDataKey(KeyFile &keyFile, const KeySlotKind kind, const unsigned char *dataKey, const unsigned char *wrappingKey)
+{
+    KeySlot slot;
+    unsigned char ad[KEYFILE_MAGICBYTES + 2];
+
+    slot.kind = kind;
+    slotAd(ad, kind);
+    randombytes_buf(slot.nonce, sizeof slot.nonce);
+
+    if (crypto_aead_xchacha20poly1305_ietf_encrypt(
+            slot.wrapped, NULL,
+            dataKey, KEYFILE_DATAKEYBYTES,
+            ad, sizeof ad,
+            NULL, slot.nonce, wrappingKey) != 0)
+    {
+        qCritical() << "Failed to wrap data key.";
+        return -1;
+    }
+
+    // At most one slot per kind
+    for (KeySlot &existing : keyFile.keySlots)
+    {
+        if (existing.kind == kind)
+        {
+            existing = slot;
+            return 0;
+        }
+    }
+    if (keyFile.keySlots.size() >= KEYFILE_MAXSLOTS)
+    {
+        qCritical() << "Key file has no free slot.";
+        return -1;
+    }
+    keyFile.keySlots.push_back(slot);
+    return 0;
+}
+
+int unwrapDataKey(unsigned char *dataKey, const KeyFile &keyFile, const KeySlotKind kind, const unsigned char *wrappingKey)
+{
+    const KeySlot *slot = keyFile.find(kind);
+    unsigned char ad[KEYFILE_MAGICBYTES + 2];
+
+    if (slot == nullptr)
+    {
+        qCritical() << "Key file has no slot of kind" << kind << ".";
+        return -1;
+    }
+
+    slotAd(ad, kind);
+    if (crypto_aead_xchacha20poly1305_ietf_decrypt(
+            dataKey, NULL, NULL,
+            slot->wrapped, sizeof slot->wrapped,
+            ad, sizeof ad,
+            slot->nonce, wrappingKey) != 0)
+    {
+        // Wrong wrapping key or corrupted slot
+        sodium_memzero(dataKey, KEYFILE_DATAKEYBYTES);
+        return -1;
+    }
+
+    return 0;
+}
+
+} // namespace pwm
@@ -0,0 +1,126 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMKEYFILE_H
+#define PWMKEYFILE_H
+
+#include <QtGlobal>
+#include <QDebug>
+
+#include <sodium.h>
+#include <cstdio>
+#include <vector>
+
+// Key file format
+#define KEYFILE_NAME "vault.key"
+#define KEYFILE_TMPFILE "vault.key.tmp"
+#define KEYFILE_MAGIC "PWMK"
+#define KEYFILE_MAGICBYTES 4
+#define KEYFILE_HEADERBYTES 8
+#define KEYFILE_VERSION 1
+#define KEYFILE_MAXSLOTS 16
+
+// Data key encrypting the vault, and its wrapped copies
+#define KEYFILE_DATAKEYBYTES crypto_aead_xchacha20poly1305_ietf_KEYBYTES
+#define KEYFILE_WRAPPEDBYTES (KEYFILE_DATAKEYBYTES + crypto_aead_xchacha20poly1305_ietf_ABYTES)
+#define KEYFILE_SLOTBYTES (4 + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES + KEYFILE_WRAPPEDBYTES)
+
+
+namespace pwm {
+
+/**
+ * @brief Kind of key a slot is wrapped with.
+ */
+enum KeySlotKind : quint8
+{
+    KEYSLOT_MASTER = 1 // key derived from master password (see SessionKey)
+};
+
+/**
+ * @brief Copy of the data key, encrypted with a wrapping key.
+ */
+struct KeySlot
+{
+    quint8 kind = KEYSLOT_MASTER;
+    unsigned char nonce[crypto_aead_xchacha20poly1305_ietf_NPUBBYTES] = {0};
+    unsigned char wrapped[KEYFILE_WRAPPEDBYTES] = {0};
+};
+
+/**
+ * @brief Wrapped copies of the data key encrypting entries file and journal.
+ *
+ * The vault is encrypted with a random data key, which never changes with master password:
+ * changing master password or crypto parameters only re-wraps the data key, whatever the
+ * number of entries. Only the master slot is written: file format leaves room for several
+ * slots wrapping the same data key, at most one per kind.
+ *
+ * File structure:
+ * magic          (char, KEYFILE_MAGIC)
+ * version        (quint8)
+ * nbSlots        (quint8)
+ * reserved       (quint16)
+ * slot 1
+ * slot 2
+ * ...
+ *
+ * Slot structure:
+ * kind           (quint8, KeySlotKind)
+ * reserved       (3 bytes)
+ * nonce          (unsigned char)
+ * wrapped key    (unsigned char, data key encrypted with xchacha20poly1305, authenticated
+ *                 with file magic, version and slot kind)
+ */
+struct KeyFile
+{
+    std::vector<KeySlot> keySlots;
+
+    /**
+     * @return Slot of given kind; null if there is none.
+     */
+    const KeySlot *find(const KeySlotKind kind) const;
+};
+
+/**
+ * @return True if key file exists, i.e. vault is encrypted with a data key.
+ */
+bool keyFileExists();
+
+/**
+ * @brief Read key file.
+ * @param keyFile: Key file where slots are going to be stored.
+ * @param fileName: Name of key file.
+ * @return 0 if successfully read key file; -1 otherwise.
+ */
+int readKeyFile(KeyFile &keyFile, const char *fileName = KEYFILE_NAME);
+
+/**
+ * @brief Write key file, flushed to disk.
+ * @param keyFile: Slots to write.
+ * @param fileName: Name of the file to write (see replaceFile() to replace key file).
+ * @return 0 if successfully wrote key file; -1 otherwise.
+ */
+int writeKeyFile(const KeyFile &keyFile, const char *fileName);
+
+/**
+ * @brief Wrap data key into a slot of key file, replacing the slot of same kind if any.
+ * @param keyFile: Key file to update.
+ * @param kind: Kind of [wrappingKey].
+ * @param dataKey: Data key (KEYFILE_DATAKEYBYTES bytes).
+ * @param wrappingKey: Key encrypting data key (crypto_aead_xchacha20poly1305_ietf_KEYBYTES bytes).
+ * @return 0 if successfully wrapped key; -1 otherwise.
+ */
+int wrapDataKey(KeyFile &keyFile, const KeySlotKind kind, const unsigned char *dataKey, const unsigned char *wrappingKey);
+
+/**
+ * @brief Unwrap data key from the slot of given kind.
+ * @param dataKey: Array where data key is going to be stored (KEYFILE_DATAKEYBYTES bytes).
+ * @param keyFile: Key file to read.
+ * @param kind: Kind of [wrappingKey].
+ * @param wrappingKey: Key the slot was wrapped with.
+ * @return 0 if successfully unwrapped key; -1 if there is no such slot or it does not authenticate.
+ */
+int unwrapDataKey(unsigned char *dataKey, const KeyFile &keyFile, const KeySlotKind kind, const unsigned char *wrappingKey);
+
+} // namespace pwm
+
+#endif // PWMKEYFILE_H
@@ -0,0 +1,250 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "pwmmappedentries.h"
+#include "pwmblockcipher.h"
+#include "pwmsealedpassword.h"
+
+#include <QtEndian>
+#include <QtConcurrent>
+
+namespace pwm {
+
+MappedEntries::~MappedEntries()
+{
+    close();
+}
+
+int MappedEntries::open(const SessionKey &key)
+{
+    close();
+
+    if (!key.isValid())
+    {
+        qCritical() << "Session key is not derived. Aborted before entries file reading.";
+        return -1;
+    }
+
+    QFile entriesFile("entries.cipher");
+    if (!entriesFile.open(QIODevice::ReadOnly))
+    {
+        qCritical() << "Failed to open entries file. Aborted entries file reading.";
+        return -1;
+    }
+
+    const qint64 fileSize = entriesFile.size();
+    uchar * map = (fileSize > 0) ? entriesFile.map(0, fileSize) : nullptr;
+    if (map == nullptr)
+    {
+        qCritical() << "Failed to map entries file. Aborted entries file reading.";
+        return -1;
+    }
+
+    size_t position = 0;
+    int returnValue = -1;
+
+    // Header pull
+    if (parseEntriesHeader(map, fileSize, entriesHeader, position) != 0 || entriesHeader.version != ENTRIES_VERSION)
+    {
+        qCritical() << "Failed to read header. Aborted entries file reading.";
+        goto ret;
+    }
+
+    // Decrypted blocks and copied passwords are always shorter than encrypted file
+    arenaSize = fileSize - position;
+    arena = static_cast<unsigned char *>(sodium_malloc(arenaSize > 0 ? arenaSize : 1));
+    if (arena == nullptr)
+    {
+        qCritical() << "Failed to allocate secure memory for entries. Aborted entries file reading.";
+        goto ret;
+    }
+
+    // Blocks are decrypted in parallel
+    if (openBlocks(key, map, fileSize, position) != 0) goto ret;
+
+    // Plaintext is not modified anymore
+    sodium_mprotect_readonly(arena);
+
+    returnValue = 0;
+ret:
+    entriesFile.unmap(map);
+    if (returnValue != 0) close();
+    return returnValue;
+}
+
+void MappedEntries::close()
+{
+    // sodium_free() also zeroes memory before releasing it
+    if (arena != nullptr) sodium_free(arena);
+    arena = nullptr;
+    arenaSize = 0;
+
+    fields.clear();
+    entriesHeader = EntriesHeader();
+}
+
+/**
+ * @brief Block of entries file, located in mapping and arena.
+ */
+struct MappedBlock
+{
+    size_t cipherPosition; // in mapping
+    size_t cipherLength;
+    size_t plainPosition;  // in arena
+    quint64 index;
+    bool authentic;
+};
+
+int MappedEntries::openBlocks(const SessionKey &key, const unsigned char *map, const size_t mapSize, size_t position)
+{
+    EntryBlockCipher blockCipher(key, entriesHeader);
+    std::vector<MappedBlock> blocks;
+    std::vector<std::pair<size_t, size_t>> passwords; // position in mapping and length of each sealed password
+    size_t arenaLength = 0;
+    unsigned char mac[BLOCK_MACBYTES];
+
+    if (!blockCipher.isValid())
+    {
+        qCritical() << "Failed to recognize header. Aborted entries file reading.";
+        return -1;
+    }
+
+    // Locating blocks, up to empty end marker
+    for (;;)
+    {
+        if (mapSize - position < sizeof(quint32))
+        {
+            qCritical() << "Entries file is truncated. Aborted entries file reading.";
+            return -1;
+        }
+        const quint32 length = qFromLittleEndian<quint32>(map + position);
+        position += sizeof(quint32);
+
+        if (length == 0) break;
+        if (length < BLOCK_ABYTES || length > ENTRIES_CHUNK_MAXLEN || length > mapSize - position)
+        {
+            qCritical() << "Block has an invalid length. Aborted entries file reading.";
+            return -1;
+        }
+
+        blocks.push_back({position, length, arenaLength, blocks.size(), false});
+        blockCipher.authenticate(map + position, length);
+        position += length;
+        arenaLength += length - BLOCK_ABYTES;
+    }
+
+    // Locating sealed passwords, up to file MAC: they are authenticated in place, and never opened here
+    while (mapSize - position > BLOCK_MACBYTES)
+    {
+        if (mapSize - position < sizeof(quint32) + BLOCK_MACBYTES)
+        {
+            qCritical() << "Entries file is truncated. Aborted entries file reading.";
+            return -1;
+        }
+        const quint32 length = qFromLittleEndian<quint32>(map + position);
+        position += sizeof(quint32);
+
+        if (length < PASSWORD_SEALBYTES || length > mapSize - position - BLOCK_MACBYTES)
+        {
+            qCritical() << "Sealed password has an invalid length. Aborted entries file reading.";
+            return -1;
+        }
+
+        passwords.emplace_back(position, length);
+        blockCipher.authenticatePassword(map + position, length);
+        position += length;
+    }
+
+    // File MAC: every block and password is there, in order, before any block is decrypted
+    if (mapSize - position != BLOCK_MACBYTES)
+    {
+        qCritical() << "Entries file has an invalid length. Aborted entries file reading.";
+        return -1;
+    }
+    blockCipher.finalMac(mac);
+    if (sodium_memcmp(mac, map + position, BLOCK_MACBYTES) != 0)
+    {
+        qCritical() << "Entries file failed authentication. Aborted entries file reading.";
+        return -1;
+    }
+
+    // Blocks are independent: decrypted on the global thread pool, straight from mapping into arena
+    QtConcurrent::blockingMap(blocks, [this, &blockCipher, map](MappedBlock &block) {
+        block.authentic = (blockCipher.open(arena + block.plainPosition, map + block.cipherPosition, block.cipherLength, block.index) == 0);
+    });
+
+    // Slicing records in file order
+    for (const MappedBlock &block : blocks)
+    {
+        if (!block.authentic)
+        {
+            qCritical() << "Failed to decrypt block" << block.index << ". Aborted entries file reading.";
+            return -1;
+        }
+        if (sliceChunk(arena + block.plainPosition, block.cipherLength - BLOCK_ABYTES) != 0) return -1;
+    }
+
+    // Sealed passwords are copied after blocks, and replace empty password fields of records
+    if (passwords.size() != static_cast<size_t>(size()))
+    {
+        qCritical() << "Entries file has" << passwords.size() << "passwords for" << size() << "entries. Aborted entries file reading.";
+        return -1;
+    }
+    for (size_t record = 0 ; record < passwords.size() ; ++record)
+    {
+        memcpy(arena + arenaLength, map + passwords[record].first, passwords[record].second);
+        fields[record * ENTRY_NBFIELDS + ENTRY_PASSWORD] = std::string_view(reinterpret_cast<const char *>(arena + arenaLength), passwords[record].second);
+        arenaLength += passwords[record].second;
+    }
+
+    return 0;
+}
+
+int MappedEntries::sliceChunk(const unsigned char *chunk, const size_t chunkLength)
+{
+    size_t chunkPosition = 0;
+    while (chunkPosition < chunkLength)
+    {
+        if (chunkLength - chunkPosition < sizeof(quint32))
+        {
+            qCritical() << "Chunk is malformed. Aborted entries file reading.";
+            return -1;
+        }
+        const size_t paddedLength = qFromLittleEndian<quint32>(chunk + chunkPosition);
+        chunkPosition += sizeof(quint32);
+        if (chunkLength - chunkPosition < paddedLength)
+        {
+            qCritical() << "Chunk is malformed. Aborted entries file reading.";
+            return -1;
+        }
+
+        // Removing padding
+        size_t recordLength = paddedLength;
+        if (entriesHeader.padding > 0
+            && sodium_unpad(&recordLength, chunk + chunkPosition, paddedLength, entriesHeader.padding) != 0)
+        {
+            qCritical() << "Record has an invalid padding. Aborted entries file reading.";
+            return -1;
+        }
+
+        if (decodeRecord(chunk + chunkPosition, recordLength) != 0)
+        {
+            qCritical() << "Record is malformed. Aborted entries file reading.";
+            return -1;
+        }
+        chunkPosition += paddedLength;
+    }
+
+    return 0;
+}
+
+int MappedEntries::decodeRecord(const unsigned char *record, const size_t recordLength)
+{
+    std::string_view recordFields[ENTRY_NBFIELDS];
+    if (EntryRecord::decode(record, recordLength, recordFields) < 0) return -1;
+
+    fields.insert(fields.end(), std::begin(recordFields), std::end(recordFields));
+    return 0;
+}
+
+} // namespace pwm
@@ -0,0 +1,95 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMMAPPEDENTRIES_H
+#define PWMMAPPEDENTRIES_H
+
+#include <QFile>
+#include <QDebug>
+
+#include <sodium.h>
+#include <string_view>
+#include <vector>
+
+#include "pwmsecurity.h"
+
+
+namespace pwm {
+
+/**
+ * @brief Zero-copy reader of entries file (not legacy files, see readEntries()).
+ *
+ * Entries file is memory-mapped read-only, and each block is decrypted
+ * directly from the mapping into a single plaintext arena allocated in
+ * guarded, locked memory (sodium_malloc). Records are never copied: fields
+ * are exposed as views of UTF-8 characters into the arena.
+ * Sealed passwords are copied to the arena as they are, without being opened:
+ * decryption only depends on the size of names, user names and dates.
+ * Arena is made read-only once decrypted, and wiped by close() or on destruction.
+ * Blocks are decrypted on the global thread pool (see EntryBlockCipher).
+ *
+ * @attention Views are invalidated by open() and close().
+ */
+class MappedEntries
+{
+public:
+    MappedEntries() = default;
+    ~MappedEntries();
+    MappedEntries(const MappedEntries &) = delete;
+    MappedEntries &operator=(const MappedEntries &) = delete;
+
+    /**
+     * @brief Map and decrypt entries file.
+     * @param key: Session key used for decryption.
+     * @return 0 if file MAC and every block were successfully authenticated; -1 otherwise.
+     */
+    int open(const SessionKey &key);
+    /**
+     * @brief Wipe and release plaintext arena.
+     */
+    void close();
+
+    /**
+     * @return Header of decrypted entries file.
+     */
+    const EntriesHeader &header() const { return entriesHeader; }
+    /**
+     * @return Number of records.
+     */
+    int size() const { return static_cast<int>(fields.size() / ENTRY_NBFIELDS); }
+    /**
+     * @return Views of UTF-8 characters of every field of given record (see ENTRY_SCHEMA).
+     */
+    const std::string_view *record(const int record) const { return fields.data() + static_cast<size_t>(record) * ENTRY_NBFIELDS; }
+    /**
+     * @return View of UTF-8 characters of given field (sealed bytes for ENTRY_PASSWORD, see sealPassword()).
+     */
+    std::string_view field(const int record, const EntryField field) const { return this->record(record)[field]; }
+
+private:
+    /**
+     * @brief Check file MAC, then decrypt independent blocks into arena in parallel, and copy sealed passwords after them.
+     * @param position: Offset of first block in [map].
+     * @return 0 if file MAC and every block were authenticated; -1 otherwise.
+     */
+    int openBlocks(const SessionKey &key, const unsigned char *map, const size_t mapSize, size_t position);
+    /**
+     * @brief Slice the records of a decrypted chunk into field views.
+     * @return 0 if chunk is well formed; -1 otherwise.
+     */
+    int sliceChunk(const unsigned char *chunk, const size_t chunkLength);
+    /**
+     * @brief Decode a record into field views (see EntryRecord).
+     * @return 0 if record is well formed; -1 otherwise.
+     */
+    int decodeRecord(const unsigned char *record, const size_t recordLength);
+
+    EntriesHeader entriesHeader;
+    unsigned char *arena = nullptr; // decrypted blocks, then sealed passwords, contiguous
+    size_t arenaSize = 0;
+    std::vector<std::string_view> fields; // views into [arena], ENTRY_NBFIELDS per record
+};
+
+} // namespace pwm
+
+#endif // PWMMAPPEDENTRIES_H
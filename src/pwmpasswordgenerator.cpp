@@ -0,0 +1,201 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "pwmpasswordgenerator.h"
+
+#include <array>
+
+namespace pwm {
+
+namespace {
+
+// Characters of each class, in PasswordClass order
+constexpr const char *CLASS_CHARACTERS[PASSWORD_NBCLASSES] = {
+    "abcdefghijklmnopqrstuvwxyz",
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ",
+    "0123456789",
+    "!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~"
+};
+
+/**
+ * @brief Characters allowed by a combination of classes.
+ */
+struct Charset
+{
+    char characters[PASSWORD_MAXCHARACTERS] = {};
+    unsigned char classOf[PASSWORD_MAXCHARACTERS] = {}; // PasswordClass flag of each character
+    int size = 0;
+    int limit = 0; // random bytes below this limit are mapped to a character, others are skipped
+};
+
+constexpr Charset makeCharset(const unsigned int classes)
+{
+    Charset charset;
+
+    for (int passwordClass = 0 ; passwordClass < PASSWORD_NBCLASSES ; ++passwordClass)
+    {
+        if (!(classes & (1u << passwordClass))) continue;
+
+        for (const char *c = CLASS_CHARACTERS[passwordClass] ; *c != '\0' ; ++c)
+        {
+            charset.characters[charset.size] = *c;
+            charset.classOf[charset.size] = static_cast<unsigned char>(1u << passwordClass);
+            ++charset.size;
+        }
+    }
+
+    // Largest multiple of size not above 256, so that every character gets as many byte values
+    if (charset.size > 0) charset.limit = 256 - 256 % charset.size;
+
+    return charset;
+}
+
+constexpr std::array<Charset, (1 << PASSWORD_NBCLASSES)> makeCharsets()
+{
+    std::array<Charset, (1 << PASSWORD_NBCLASSES)> charsets = {};
+    for (unsigned int classes = 0 ; classes < charsets.size() ; ++classes)
+        charsets[classes] = makeCharset(classes);
+    return charsets;
+}
+
+// Table of allowed characters, indexed by PasswordClass flags
+constexpr std::array<Charset, (1 << PASSWORD_NBCLASSES)> CHARSETS = makeCharsets();
+
+static_assert(CHARSETS[PASSWORD_LOWCASE | PASSWORD_UPCASE | PASSWORD_NUMBERS | PASSWORD_SPECIALS].size == PASSWORD_MAXCHARACTERS,
+              "Every printable ASCII character except space must be allowed");
+static_assert(CHARSETS[PASSWORD_NUMBERS].limit == 250, "Rejection limit must be a multiple of charset size");
+
+} // namespace
+
+int passwordClassCount(const unsigned int classes)
+{
+    int count = 0;
+    for (int passwordClass = 0 ; passwordClass < PASSWORD_NBCLASSES ; ++passwordClass)
+    {
+        if (classes & (1u << passwordClass)) ++count;
+    }
+    return count;
+}
+
+PasswordPolicy passwordPolicyOf(const std::string_view password)
+{
+    PasswordPolicy policy;
+
+    for (const char c : password)
+    {
+        if (c >= 'a' && c <= 'z') policy.classes |= PASSWORD_LOWCASE;
+        else if (c >= 'A' && c <= 'Z') policy.classes |= PASSWORD_UPCASE;
+        else if (c >= '0' && c <= '9') policy.classes |= PASSWORD_NUMBERS;
+        else if (c > ' ' && c <= '~') policy.classes |= PASSWORD_SPECIALS;
+    }
+
+    if (policy.classes == 0)
+    {
+        policy.classes = PASSWORD_LOWCASE | PASSWORD_UPCASE | PASSWORD_NUMBERS | PASSWORD_SPECIALS;
+        policy.length = PASSWORD_DEFAULT_LENGTH;
+    }
+    else
+        policy.length = static_cast<int>(password.size());
+
+    policy.everyClass = (policy.length >= passwordClassCount(policy.classes));
+    return policy;
+}
+
+/**
+ * @brief Check that passwords can be generated with given policy.
+ * @return 0 if policy can be followed; -1 otherwise.
+ */
+static int checkPolicy(const PasswordPolicy &policy, const int count)
+{
+    const unsigned int allClasses = (1u << PASSWORD_NBCLASSES) - 1;
+
+    if (policy.classes == 0 || (policy.classes & ~allClasses) != 0)
+    {
+        // All booleans are false
+        qCritical() << "Cannot generate password without any charater. Aborted password generation.";
+        return -1;
+    }
+    if (policy.length <= 0 || count < 0 || static_cast<long long>(count) * policy.length > PASSWORD_MAXBATCH)
+    {
+        qCritical() << "Invalid password length or count. Aborted password generation.";
+        return -1;
+    }
+    if (policy.everyClass && policy.length < passwordClassCount(policy.classes))
+    {
+        qCritical() << "Password is too short to contain every selected class. Aborted password generation.";
+        return -1;
+    }
+
+    return 0;
+}
+
+int generatePasswords(const PasswordPolicy &policy, const int count, char *passwords)
+{
+    if (checkPolicy(policy, count) != 0) return -1;
+
+    const Charset &charset = CHARSETS[policy.classes];
+    unsigned char random[PASSWORD_RANDOM_BLOCK];
+    size_t used = sizeof random; // block is drawn on first use
+
+    for (int password = 0 ; password < count ; ++password)
+    {
+        char *characters = passwords + static_cast<size_t>(password) * policy.length;
+        unsigned int classes;
+
+        do
+        {
+            classes = 0;
+            for (int character = 0 ; character < policy.length ; ++character)
+            {
+                // Skipping bytes which would favour first characters
+                unsigned char byte;
+                do
+                {
+                    if (used == sizeof random)
+                    {
+                        randombytes_buf(random, sizeof random);
+                        used = 0;
+                    }
+                    byte = random[used++];
+                } while (byte >= charset.limit);
+
+                const int index = byte % charset.size;
+                characters[character] = charset.characters[index];
+                classes |= charset.classOf[index];
+            }
+        } while (policy.everyClass && classes != policy.classes);
+    }
+
+    sodium_memzero(random, sizeof random);
+    return 0;
+}
+
+int generatePasswords(const PasswordPolicy &policy, const int count, QStringList &passwords)
+{
+    if (checkPolicy(policy, count) != 0) return -1;
+    if (count == 0) return 0;
+
+    // Passwords are generated in locked memory, wiped once converted
+    const size_t size = static_cast<size_t>(count) * policy.length;
+    char *buffer = static_cast<char *>(sodium_malloc(size));
+    if (buffer == NULL)
+    {
+        qCritical() << "Failed to allocate secure memory for passwords. Aborted password generation.";
+        return -1;
+    }
+
+    if (generatePasswords(policy, count, buffer) != 0)
+    {
+        sodium_free(buffer);
+        return -1;
+    }
+
+    passwords.reserve(passwords.size() + count);
+    for (int password = 0 ; password < count ; ++password)
+        passwords.append(QString::fromLatin1(buffer + static_cast<size_t>(password) * policy.length, policy.length));
+
+    sodium_free(buffer); // zeroes memory before releasing it
+    return 0;
+}
+
+} // namespace pwm
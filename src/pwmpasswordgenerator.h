@@ -0,0 +1,95 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMPASSWORDGENERATOR_H
+#define PWMPASSWORDGENERATOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QDebug>
+
+#include <sodium.h>
+#include <string_view>
+
+// Number of character classes (see PasswordClass) and characters of all classes
+#define PASSWORD_NBCLASSES 4
+#define PASSWORD_MAXCHARACTERS 94
+
+// Random bytes are drawn by blocks of this size
+#define PASSWORD_RANDOM_BLOCK 1024
+
+// Maximum number of characters generated by a single call
+#define PASSWORD_MAXBATCH (1 << 24)
+
+// Length of passwords replacing a password without any known class (see passwordPolicyOf())
+#define PASSWORD_DEFAULT_LENGTH 20
+
+
+namespace pwm {
+
+/**
+ * @brief Classes of characters a password can be made of, as flags.
+ */
+enum PasswordClass : unsigned int
+{
+    PASSWORD_LOWCASE = 1,  // abcdefghijklmnopqrstuvwxyz
+    PASSWORD_UPCASE = 2,   // ABCDEFGHIJKLMNOPQRSTUVWXYZ
+    PASSWORD_NUMBERS = 4,  // 0123456789
+    PASSWORD_SPECIALS = 8  // printable ASCII punctuation
+};
+
+/**
+ * @brief Rules followed by generated passwords.
+ */
+struct PasswordPolicy
+{
+    int length = 0;           // number of characters of each password
+    unsigned int classes = 0; // PasswordClass flags of allowed characters
+    bool everyClass = false;  // true if each password must contain a character of every allowed class
+};
+
+/**
+ * @return Number of classes set in [classes] (PasswordClass flags).
+ */
+int passwordClassCount(const unsigned int classes);
+
+/**
+ * @brief Policy of a password replacing given one: same length and same classes of characters.
+ * @param password: UTF-8 characters of the password to replace.
+ * @return Policy requiring every class of [password] if long enough. Passwords without any
+ * character of a known class are replaced by PASSWORD_DEFAULT_LENGTH characters of every class.
+ */
+PasswordPolicy passwordPolicyOf(const std::string_view password);
+
+/**
+ * @brief Generate unpredictible passwords.
+ *
+ * @param policy: Rules followed by every password.
+ * @param count: Number of passwords to generate.
+ * @param passwords: Buffer of at least [count] * [policy.length] characters, where passwords are
+ * going to be stored one after the other (no separator, no end character).
+ * @return 0 if successfully generated passwords; -1 if policy cannot be followed.
+ *
+ * Allowed characters are read from a table computed at compile time for each combination of classes.
+ * Random bytes are drawn by blocks of PASSWORD_RANDOM_BLOCK bytes, and each byte is mapped to a character
+ * by rejection sampling: bytes beyond the largest multiple of the number of characters are skipped,
+ * so that every character is equally likely. Passwords missing a class are drawn again when
+ * [policy.everyClass] is set, so that every valid password remains equally likely.
+ */
+int generatePasswords(const PasswordPolicy &policy, const int count, char *passwords);
+
+/**
+ * @brief Generate unpredictible passwords.
+ *
+ * @param policy: Rules followed by every password.
+ * @param count: Number of passwords to generate.
+ * @param passwords: List where passwords are going to be appended.
+ * @return 0 if successfully generated passwords; -1 otherwise.
+ *
+ * @see generatePasswords(const PasswordPolicy &, const int, char *)
+ */
+int generatePasswords(const PasswordPolicy &policy, const int count, QStringList &passwords);
+
+} // namespace pwm
+
+#endif // PWMPASSWORDGENERATOR_H
@@ -0,0 +1,210 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "pwmprefixindex.h"
+
+#include <QByteArray>
+#include <algorithm>
+#include <utility>
+
+namespace pwm {
+
+/**
+ * @return Case folded UTF-8 characters of non ASCII UTF-8 characters; UTF-16 copies are wiped.
+ */
+static QByteArray foldUnicode(const std::string_view value)
+{
+    QString utf16 = QString::fromUtf8(value.data(), static_cast<int>(value.size()));
+    QString folded = utf16.toCaseFolded();
+    const QByteArray foldedUtf8 = folded.toUtf8();
+
+    sodium_memzero(folded.data(), folded.size() * sizeof(QChar));
+    sodium_memzero(utf16.data(), utf16.size() * sizeof(QChar));
+    return foldedUtf8;
+}
+
+/**
+ * @return True if every character of [value] is ASCII.
+ */
+static bool isAscii(const std::string_view value)
+{
+    for (const char c : value)
+    {
+        if (static_cast<unsigned char>(c) >= 0x80) return false;
+    }
+    return true;
+}
+
+std::string PrefixIndex::fold(const std::string_view value)
+{
+    // ASCII characters are folded without conversion to UTF-16
+    if (!isAscii(value))
+    {
+        QByteArray foldedUtf8 = foldUnicode(value);
+        const std::string folded(foldedUtf8.constData(), foldedUtf8.size());
+        sodium_memzero(foldedUtf8.data(), foldedUtf8.size());
+        return folded;
+    }
+
+    std::string folded(value);
+    for (char &c : folded)
+    {
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    }
+
+    return folded;
+}
+
+std::string PrefixIndex::fold(const QString &value)
+{
+    const QByteArray foldedUtf8 = value.toCaseFolded().toUtf8();
+    return std::string(foldedUtf8.constData(), foldedUtf8.size());
+}
+
+std::string_view PrefixIndex::fold(const std::string_view value, SecureArena &arena)
+{
+    if (value.empty()) return std::string_view();
+
+    if (!isAscii(value))
+    {
+        QByteArray foldedUtf8 = foldUnicode(value);
+        const std::string_view folded = arena.store(std::string_view(foldedUtf8.constData(), foldedUtf8.size()));
+        sodium_memzero(foldedUtf8.data(), foldedUtf8.size());
+        return folded;
+    }
+
+    // ASCII characters are folded straight into arena
+    char *folded = arena.allocate(value.size());
+    for (size_t i = 0 ; i < value.size() ; ++i)
+    {
+        const char c = value[i];
+        folded[i] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c + 'a' - 'A') : c;
+    }
+
+    return std::string_view(folded, value.size());
+}
+
+void PrefixIndex::insert(const std::string_view value, const EntryId id)
+{
+    Key key;
+    key.folded = fold(value, arena);
+    key.id = id;
+
+    // Appending in order keeps keys sorted (e.g. entries file written in name order)
+    const bool inOrder = (sortedCount == keys.size() && (keys.empty() || !(key < keys.back())));
+    keys.push_back(key);
+    if (inOrder) sortedCount = keys.size();
+}
+
+void PrefixIndex::erase(const std::string_view value, const EntryId id)
+{
+    std::string folded = fold(value);
+
+    Key key;
+    key.folded = folded;
+    key.id = id;
+
+    // Sorted keys, then keys appended since last search
+    const auto sortedEnd = keys.begin() + sortedCount;
+    auto found = std::lower_bound(keys.begin(), sortedEnd, key);
+    if (found != sortedEnd && found->id == id && found->folded == key.folded)
+        --sortedCount;
+    else
+        found = std::find_if(sortedEnd, keys.end(), [&key](const Key &other) { return other.id == key.id && other.folded == key.folded; });
+
+    // Folded value is a copy of an entry field
+    sodium_memzero(&folded[0], folded.size());
+    if (found == keys.end()) return;
+
+    if (!found->folded.empty())
+    {
+        sodium_memzero(const_cast<char *>(found->folded.data()), found->folded.size());
+        garbage += found->folded.size();
+    }
+    keys.erase(found);
+
+    compactIfNeeded();
+}
+
+void PrefixIndex::find(const std::string &foldedPrefix, std::vector<EntryId> &ids, const int maxCount) const
+{
+    sort();
+
+    Key first;
+    first.folded = foldedPrefix;
+    first.id = 0;
+
+    // Keys starting with prefix are contiguous, from first key not lower than prefix
+    int count = 0;
+    for (auto it = std::lower_bound(keys.begin(), keys.end(), first) ; it != keys.end() ; ++it)
+    {
+        if (it->folded.compare(0, foldedPrefix.size(), foldedPrefix) != 0) break;
+        if (maxCount >= 0 && count >= maxCount) break;
+
+        ids.push_back(it->id);
+        ++count;
+    }
+}
+
+void PrefixIndex::clear()
+{
+    // Every folded key is in arena, wiped at once
+    arena.release();
+    garbage = 0;
+    std::vector<Key>().swap(keys);
+    sortedCount = 0;
+}
+
+void PrefixIndex::swap(PrefixIndex &other)
+{
+    // Keys keep pointing to the same slabs
+    arena.swap(other.arena);
+    std::swap(garbage, other.garbage);
+    keys.swap(other.keys);
+    std::swap(sortedCount, other.sortedCount);
+}
+
+void PrefixIndex::assign(const PrefixIndex &other)
+{
+    if (&other == this) return;
+
+    clear();
+
+    // Keys of [other] point to its own arena
+    arena.reserve(other.arena.size() - other.garbage);
+    keys = other.keys;
+    for (Key &key : keys)
+        key.folded = arena.store(key.folded);
+    sortedCount = other.sortedCount;
+}
+
+size_t PrefixIndex::memoryUsage() const
+{
+    return keys.capacity() * sizeof(Key) + arena.capacity();
+}
+
+void PrefixIndex::sort() const
+{
+    if (sortedCount == keys.size()) return;
+
+    const auto sortedEnd = keys.begin() + sortedCount;
+    std::sort(sortedEnd, keys.end());
+    std::inplace_merge(keys.begin(), sortedEnd, keys.end());
+    sortedCount = keys.size();
+}
+
+void PrefixIndex::compactIfNeeded()
+{
+    if (garbage <= PREFIXINDEX_COMPACT_MINGARBAGE || garbage <= arena.size() / 2) return;
+
+    SecureArena compacted;
+    compacted.reserve(arena.size() - garbage);
+    for (Key &key : keys)
+        key.folded = compacted.store(key.folded);
+
+    // Previous slabs are wiped when released
+    arena.swap(compacted);
+    garbage = 0;
+}
+
+} // namespace pwm
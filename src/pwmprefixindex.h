@@ -0,0 +1,101 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMPREFIXINDEX_H
+#define PWMPREFIXINDEX_H
+
+#include <QString>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pwmsecurearena.h"
+
+// Arena is compacted when bytes of removed keys exceed both this size and half of its bytes
+#define PREFIXINDEX_COMPACT_MINGARBAGE 4096
+
+
+namespace pwm {
+
+typedef quint32 EntryId;
+
+/**
+ * @brief Case insensitive prefix index of a field of entries.
+ *
+ * Keys are case folded UTF-8 strings, kept in a sorted array so that entries
+ * starting with a prefix are found by binary search, in a time depending on the
+ * number of matches rather than on the number of entries.
+ *
+ * Inserted keys are appended unsorted, then sorted and merged by the next search:
+ * adding many entries (e.g. while reading entries file) costs a single sort.
+ *
+ * Folded keys are copies of entry fields: they are stored in a SecureArena,
+ * zeroed when removed, and wiped by clear() and compaction.
+ */
+class PrefixIndex
+{
+public:
+    /**
+     * @return Case folded UTF-8 characters of given UTF-8 characters.
+     */
+    static std::string fold(const std::string_view value);
+    static std::string fold(const QString &value);
+    /**
+     * @return Case folded UTF-8 characters of given UTF-8 characters, stored in [arena].
+     */
+    static std::string_view fold(const std::string_view value, SecureArena &arena);
+
+    /**
+     * @brief Index an entry with its field value.
+     */
+    void insert(const std::string_view value, const EntryId id);
+    /**
+     * @brief Remove an entry indexed with given field value.
+     */
+    void erase(const std::string_view value, const EntryId id);
+
+    /**
+     * @brief Gather entries whose field starts with given prefix.
+     * @param foldedPrefix: Prefix, case folded (see fold()).
+     * @param ids: Vector where ids are going to be appended, sorted by folded field value.
+     * @param maxCount: Maximum number of ids appended; -1 for no limit.
+     */
+    void find(const std::string &foldedPrefix, std::vector<EntryId> &ids, const int maxCount = -1) const;
+
+    void reserve(const int nbEntries) { keys.reserve(nbEntries); }
+    void clear();
+    void swap(PrefixIndex &other);
+    /**
+     * @brief Replace keys with a copy of keys of another index.
+     */
+    void assign(const PrefixIndex &other);
+    size_t memoryUsage() const;
+
+private:
+    struct Key
+    {
+        std::string_view folded; // in [arena]
+        EntryId id;
+
+        bool operator<(const Key &other) const { return folded < other.folded || (folded == other.folded && id < other.id); }
+    };
+
+    /**
+     * @brief Sort keys appended since last search, and merge them with sorted keys.
+     */
+    void sort() const;
+    /**
+     * @brief Copy keys into a new arena if it holds too many bytes of removed keys.
+     */
+    void compactIfNeeded();
+
+    SecureArena arena;               // folded characters of every key
+    size_t garbage = 0;              // bytes of [arena] no longer referenced by any key
+    mutable std::vector<Key> keys;   // sorted up to [sortedCount], then appended keys
+    mutable size_t sortedCount = 0;
+};
+
+} // namespace pwm
+
+#endif // PWMPREFIXINDEX_H
@@ -0,0 +1,161 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMRECORD_H
+#define PWMRECORD_H
+
+#include <QtEndian>
+
+#include <algorithm>
+#include <iterator>
+#include <string_view>
+
+// Record structure (see RecordCodec)
+#define RECORD_HEADERBYTES 1
+#define RECORD_LENGTHBYTES sizeof(quint32)
+#define RECORD_MAXFIELDS 255
+
+
+namespace pwm {
+
+/**
+ * @brief Fields of an entry, in the order they are stored in entries file.
+ */
+enum EntryField : int
+{
+    ENTRY_NAME = 0,
+    ENTRY_USERNAME = 1,
+    ENTRY_PASSWORD = 2, // sealed once unlocked (see sealPassword())
+    ENTRY_DATE = 3
+};
+
+/**
+ * @brief Description of a field of entries.
+ */
+struct FieldSchema
+{
+    EntryField field;
+    const char *name; // e.g. for exports
+};
+
+/**
+ * @brief Fields of an entry, in record order.
+ *
+ * Adding a field only takes a new EntryField and a new line here: the store, the records
+ * of entries file and their decoding all follow this schema. Records written before a field
+ * was added are decoded with this field empty.
+ */
+inline constexpr FieldSchema ENTRY_SCHEMA[] = {
+    {ENTRY_NAME, "entryname"},
+    {ENTRY_USERNAME, "username"},
+    {ENTRY_PASSWORD, "password"},
+    {ENTRY_DATE, "date"}
+};
+
+/**
+ * @return True if fields of [schema] are listed in the order of their value.
+ */
+template <size_t NbFields>
+constexpr bool isOrdered(const FieldSchema (&schema)[NbFields])
+{
+    for (size_t field = 0 ; field < NbFields ; ++field)
+    {
+        if (schema[field].field != static_cast<EntryField>(field)) return false;
+    }
+    return true;
+}
+
+static_assert(isOrdered(ENTRY_SCHEMA), "ENTRY_SCHEMA must list fields in EntryField order");
+
+} // namespace pwm
+
+// Number of fields of an entry (see ENTRY_SCHEMA)
+#define ENTRY_NBFIELDS static_cast<int>(std::size(pwm::ENTRY_SCHEMA))
+
+
+namespace pwm {
+
+/**
+ * @brief Encoder and decoder of records holding a fixed number of UTF-8 fields.
+ *
+ * Record structure:
+ * number of fields (unsigned char)
+ * field 1          (quint32 length, then UTF-8 characters)
+ * field 2
+ * ...
+ *
+ * Fields are written straight into, and decoded as views of, caller buffers: nothing is
+ * copied nor allocated, so that plaintext only lives in the buffers the caller wipes.
+ */
+template <int NbFields>
+class RecordCodec
+{
+    static_assert(NbFields > 0 && NbFields <= RECORD_MAXFIELDS, "Number of fields must fit in record header");
+
+public:
+    /**
+     * @return Number of bytes of the record of given fields.
+     */
+    static size_t encodedLength(const std::string_view (&fields)[NbFields])
+    {
+        size_t length = RECORD_HEADERBYTES;
+        for (const std::string_view &field : fields)
+            length += RECORD_LENGTHBYTES + field.size();
+        return length;
+    }
+
+    /**
+     * @brief Encode fields as a record.
+     * @param record: Where record is going to be stored; must hold encodedLength() bytes.
+     */
+    static void encode(unsigned char *record, const std::string_view (&fields)[NbFields])
+    {
+        record[0] = static_cast<unsigned char>(NbFields);
+        size_t position = RECORD_HEADERBYTES;
+
+        for (const std::string_view &field : fields)
+        {
+            qToLittleEndian<quint32>(static_cast<quint32>(field.size()), record + position);
+            position += RECORD_LENGTHBYTES;
+            std::copy(field.begin(), field.end(), record + position);
+            position += field.size();
+        }
+    }
+
+    /**
+     * @brief Decode a record into views of its fields.
+     * @param fields: Where views into [record] are going to be stored. Fields missing from
+     * record (written before they were added to schema) are empty; extra fields are ignored.
+     * @return Number of fields of record; -1 if record is malformed.
+     */
+    static int decode(const unsigned char *record, const size_t recordLength, std::string_view (&fields)[NbFields])
+    {
+        if (recordLength < RECORD_HEADERBYTES) return -1;
+
+        const int nbFields = record[0];
+        size_t position = RECORD_HEADERBYTES;
+
+        for (int field = 0 ; field < nbFields ; ++field)
+        {
+            if (recordLength - position < RECORD_LENGTHBYTES) return -1;
+            const quint32 fieldLength = qFromLittleEndian<quint32>(record + position);
+            position += RECORD_LENGTHBYTES;
+
+            if (recordLength - position < fieldLength) return -1;
+            if (field < NbFields) fields[field] = std::string_view(reinterpret_cast<const char *>(record + position), fieldLength);
+            position += fieldLength;
+        }
+
+        for (int field = nbFields ; field < NbFields ; ++field)
+            fields[field] = std::string_view();
+
+        return (position == recordLength) ? nbFields : -1;
+    }
+};
+
+// Records of entries file
+using EntryRecord = RecordCodec<ENTRY_NBFIELDS>;
+
+} // namespace pwm
+
+#endif // PWMRECORD_H
@@ -0,0 +1,146 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "pwmsealedpassword.h"
+
+namespace pwm {
+
+/**
+ * @brief Derive the key sealing passwords from data key.
+ * @return 0 if successfully derived key; -1 if session key is not derived.
+ */
+static int passwordKey(unsigned char subkey[crypto_aead_xchacha20poly1305_ietf_KEYBYTES], const SessionKey &key)
+{
+    if (!key.isValid()) return -1;
+    return crypto_kdf_derive_from_key(subkey, crypto_aead_xchacha20poly1305_ietf_KEYBYTES, PASSWORD_KDF_SUBKEY, PASSWORD_KDF_CONTEXT, key.data());
+}
+
+int sealPassword(const SessionKey &key, const std::string_view password, QByteArray &sealed)
+{
+    unsigned char subkey[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
+    unsigned char *box;
+    int returnValue = -1;
+
+    sealed.clear();
+
+    if (passwordKey(subkey, key) != 0)
+    {
+        qCritical() << "Session key is not derived. Aborted password sealing.";
+        goto ret;
+    }
+
+    // Nonce, then cipher
+    sealed.resize(PASSWORD_SEALBYTES + password.size());
+    box = reinterpret_cast<unsigned char *>(sealed.data());
+    randombytes_buf(box, crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
+    if (crypto_aead_xchacha20poly1305_ietf_encrypt(
+            box + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES, NULL,
+            reinterpret_cast<const unsigned char *>(password.data()), password.size(),
+            NULL, 0,
+            NULL, box, subkey) != 0)
+    {
+        qCritical() << "Failed to seal password.";
+        sealed.clear();
+        goto ret;
+    }
+
+    returnValue = 0;
+ret:
+    sodium_memzero(subkey, sizeof subkey);
+    return returnValue;
+}
+
+int sealPassword(const SessionKey &key, const QString &password, QByteArray &sealed)
+{
+    QByteArray passwordUtf8 = password.toUtf8();
+
+    const int returnValue = sealPassword(key, std::string_view(passwordUtf8.constData(), passwordUtf8.size()), sealed);
+    sodium_memzero(passwordUtf8.data(), passwordUtf8.size());
+
+    return returnValue;
+}
+
+int sealPasswords(const SessionKey &key, EntryStore &entries)
+{
+    QByteArray sealed;
+
+    // Plaintext is wiped on commit, and kept on failure
+    entries.begin();
+    for (int entry = 0 ; entry < entries.size() ; ++entry)
+    {
+        const EntryId id = entries.id(entry);
+        if (sealPassword(key, entries.view(id, ENTRY_PASSWORD), sealed) != 0)
+        {
+            qCritical() << "Failed to seal password of entry" << entry << ". Kept plaintext passwords.";
+            entries.rollback();
+            return -1;
+        }
+        entries.setField(id, ENTRY_PASSWORD, std::string_view(sealed.constData(), sealed.size()));
+    }
+    entries.commit();
+
+    return 0;
+}
+
+OpenedPassword::~OpenedPassword()
+{
+    wipe();
+}
+
+int OpenedPassword::open(const SessionKey &key, const std::string_view sealed)
+{
+    unsigned char subkey[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
+    const unsigned char *box = reinterpret_cast<const unsigned char *>(sealed.data());
+    int returnValue = -1;
+
+    wipe();
+
+    if (sealed.size() < PASSWORD_SEALBYTES)
+    {
+        qCritical() << "Sealed password is malformed.";
+        goto ret;
+    }
+    if (passwordKey(subkey, key) != 0)
+    {
+        qCritical() << "Session key is not derived. Aborted password opening.";
+        goto ret;
+    }
+
+    length = sealed.size() - PASSWORD_SEALBYTES;
+    plain = static_cast<char *>(sodium_malloc(length > 0 ? length : 1));
+    if (plain == nullptr)
+    {
+        qCritical() << "Failed to allocate secure memory for password.";
+        goto ret;
+    }
+
+    if (crypto_aead_xchacha20poly1305_ietf_decrypt(
+            reinterpret_cast<unsigned char *>(plain), NULL, NULL,
+            box + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES, sealed.size() - crypto_aead_xchacha20poly1305_ietf_NPUBBYTES,
+            NULL, 0,
+            box, subkey) != 0)
+    {
+        // Wrong key or corrupted password
+        qCritical() << "Failed to open sealed password.";
+        goto ret;
+    }
+
+    // Plaintext is not modified anymore
+    sodium_mprotect_readonly(plain);
+
+    returnValue = 0;
+ret:
+    sodium_memzero(subkey, sizeof subkey);
+    if (returnValue != 0) wipe();
+    return returnValue;
+}
+
+void OpenedPassword::wipe()
+{
+    // sodium_free() also zeroes memory before releasing it
+    if (plain != nullptr) sodium_free(plain);
+    plain = nullptr;
+    length = 0;
+}
+
+} // namespace pwm
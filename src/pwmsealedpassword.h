@@ -0,0 +1,100 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMSEALEDPASSWORD_H
+#define PWMSEALEDPASSWORD_H
+
+#include <QByteArray>
+#include <QString>
+#include <QDebug>
+
+#include <sodium.h>
+#include <string_view>
+
+#include "pwmsecurity.h"
+#include "pwmentrystore.h"
+
+// Passwords are sealed with a subkey of data key
+#define PASSWORD_KDF_CONTEXT "pwmpassw"
+#define PASSWORD_KDF_SUBKEY 1
+
+#define PASSWORD_SEALBYTES (crypto_aead_xchacha20poly1305_ietf_NPUBBYTES + crypto_aead_xchacha20poly1305_ietf_ABYTES)
+
+
+namespace pwm {
+
+/**
+ * @brief Seal a password on its own, so that it stays encrypted in memory until needed.
+ *
+ * @param key: Session key of the vault.
+ * @param password: UTF-8 characters of password.
+ * @param sealed: Where sealed password is going to be stored (previous content is removed).
+ * @return 0 if successfully sealed password; -1 otherwise.
+ *
+ * Sealed structure (raw bytes, PASSWORD_SEALBYTES longer than password):
+ * nonce          (unsigned char, random)
+ * cipher         (unsigned char, xchacha20poly1305 of password, MAC included)
+ *
+ * Sealed passwords are stored and journaled as they are, in the password field of entries,
+ * and written to the password segment of entries file, which is not decrypted at unlock
+ * (see readEntries()). They are not bound to their entry, so that renaming an entry does
+ * not reseal its password; entries file MAC authenticates them in place.
+ */
+int sealPassword(const SessionKey &key, const std::string_view password, QByteArray &sealed);
+int sealPassword(const SessionKey &key, const QString &password, QByteArray &sealed);
+
+/**
+ * @brief Seal every password of a store, read from a legacy entries file.
+ *
+ * @param key: Session key of the vault, with its final data key.
+ * @param entries: Entries whose passwords are plaintext; passwords are replaced by sealed ones.
+ * @return 0 if every password was sealed; -1 otherwise, and [entries] is left unchanged.
+ *
+ * Plaintext passwords are wiped from store once replaced (see EntryStore::commit()).
+ */
+int sealPasswords(const SessionKey &key, EntryStore &entries);
+
+/**
+ * @brief Password opened from its sealed form, only for as long as it is needed.
+ *
+ * Plaintext is stored in guarded, locked memory (sodium_malloc), and wiped by wipe()
+ * or on destruction: open it right before use (e.g. copy to clipboard), in the smallest scope.
+ */
+class OpenedPassword
+{
+public:
+    OpenedPassword() = default;
+    ~OpenedPassword();
+    OpenedPassword(const OpenedPassword &) = delete;
+    OpenedPassword &operator=(const OpenedPassword &) = delete;
+
+    /**
+     * @brief Decrypt a sealed password (see sealPassword()).
+     * @param key: Session key of the vault.
+     * @param sealed: Sealed password.
+     * @return 0 if password is authentic and was decrypted; -1 otherwise.
+     */
+    int open(const SessionKey &key, const std::string_view sealed);
+    /**
+     * @brief Wipe plaintext from memory.
+     */
+    void wipe();
+
+    /**
+     * @return View of UTF-8 characters of password; empty if not opened.
+     */
+    std::string_view view() const { return std::string_view(plain, length); }
+    /**
+     * @return Password as a string, e.g. for clipboard.
+     * @attention Returned string is not wiped.
+     */
+    QString toString() const { return QString::fromUtf8(plain, static_cast<int>(length)); }
+
+private:
+    char *plain = nullptr; // [length] bytes in secure memory
+    size_t length = 0;
+};
+
+} // namespace pwm
+
+#endif // PWMSEALEDPASSWORD_H
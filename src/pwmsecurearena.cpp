@@ -0,0 +1,95 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#include "pwmsecurearena.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <utility>
+
+namespace pwm {
+
+SecureArena::~SecureArena()
+{
+    release();
+}
+
+char *SecureArena::allocate(const size_t size)
+{
+    // Slabs after current one are empty: they were wiped
+    while (current < slabs.size() && slabs[current].size - slabs[current].used < size)
+        ++current;
+    if (current == slabs.size()) addSlab(size);
+
+    Slab &slab = slabs[current];
+    char *bytes = slab.data + slab.used;
+    slab.used += size;
+    used += size;
+    return bytes;
+}
+
+std::string_view SecureArena::store(const std::string_view value)
+{
+    if (value.empty()) return std::string_view();
+
+    char *bytes = allocate(value.size());
+    memcpy(bytes, value.data(), value.size());
+    return std::string_view(bytes, value.size());
+}
+
+void SecureArena::reserve(const size_t size)
+{
+    for (size_t slab = current ; slab < slabs.size() ; ++slab)
+    {
+        if (slabs[slab].size - slabs[slab].used >= size) return;
+    }
+    addSlab(size);
+}
+
+void SecureArena::wipe()
+{
+    for (Slab &slab : slabs)
+    {
+        sodium_memzero(slab.data, slab.used);
+        slab.used = 0;
+    }
+    current = 0;
+    used = 0;
+}
+
+void SecureArena::release()
+{
+    // sodium_free() also zeroes memory before releasing it
+    for (const Slab &slab : slabs)
+        sodium_free(slab.data);
+
+    slabs.clear();
+    current = 0;
+    used = 0;
+    allocated = 0;
+}
+
+void SecureArena::swap(SecureArena &other)
+{
+    slabs.swap(other.slabs);
+    std::swap(current, other.current);
+    std::swap(used, other.used);
+    std::swap(allocated, other.allocated);
+}
+
+void SecureArena::addSlab(const size_t size)
+{
+    // Few slabs, whatever the number of fields: each sodium_malloc() costs guard pages
+    const size_t nextSize = slabs.empty() ? SECUREARENA_SLABSIZE : std::min<size_t>(2 * slabs.back().size, SECUREARENA_MAXSLABSIZE);
+    const size_t slabSize = std::max(size, nextSize);
+
+    char *data = static_cast<char *>(sodium_malloc(slabSize));
+    if (data == nullptr) throw std::bad_alloc();
+
+    slabs.push_back({data, slabSize, 0});
+    allocated += slabSize;
+    current = slabs.size() - 1;
+}
+
+} // namespace pwm
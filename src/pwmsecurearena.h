@@ -0,0 +1,98 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+#ifndef PWMSECUREARENA_H
+#define PWMSECUREARENA_H
+
+#include <QtGlobal>
+
+#include <sodium.h>
+#include <string_view>
+#include <vector>
+
+// Size of first slab; each new slab doubles previous one, up to SECUREARENA_MAXSLABSIZE
+#define SECUREARENA_SLABSIZE 65536
+#define SECUREARENA_MAXSLABSIZE (16 << 20)
+
+
+namespace pwm {
+
+/**
+ * @brief Bump allocator of plaintext, in guarded, locked memory.
+ *
+ * Memory is allocated in a few large slabs (sodium_malloc), so that plaintext never
+ * reaches swap, is stored contiguously, and costs no allocation per field.
+ * Bytes are handed out in order and never moved nor freed one by one: wipe() zeroes
+ * every slab at once and makes them reusable, release() also frees them.
+ *
+ * @attention Pointers and views handed out are invalidated by wipe(), release() and destruction.
+ */
+class SecureArena
+{
+public:
+    SecureArena() = default;
+    ~SecureArena();
+    SecureArena(const SecureArena &) = delete;
+    SecureArena &operator=(const SecureArena &) = delete;
+
+    /**
+     * @brief Hand out uninitialized bytes.
+     * @param size: Number of bytes.
+     * @return Bytes, valid until next wipe().
+     * @throw std::bad_alloc if secure memory cannot be allocated, like standard containers.
+     */
+    char *allocate(const size_t size);
+    /**
+     * @brief Copy characters into arena.
+     * @return View of copied characters.
+     */
+    std::string_view store(const std::string_view value);
+    /**
+     * @brief Make sure that next [size] bytes are allocated without a new slab.
+     */
+    void reserve(const size_t size);
+
+    /**
+     * @brief Zero every byte handed out, and keep slabs for next allocations.
+     */
+    void wipe();
+    /**
+     * @brief Zero and free every slab.
+     */
+    void release();
+    /**
+     * @brief Exchange slabs with another arena. Pointers handed out stay valid.
+     */
+    void swap(SecureArena &other);
+
+    /**
+     * @return Number of bytes handed out since last wipe().
+     */
+    size_t size() const { return used; }
+    /**
+     * @return Number of bytes of every slab.
+     */
+    size_t capacity() const { return allocated; }
+
+private:
+    struct Slab
+    {
+        char *data;
+        size_t size;
+        size_t used;
+    };
+
+    /**
+     * @brief Allocate a new slab of at least [size] bytes, and make it current.
+     */
+    void addSlab(const size_t size);
+
+    std::vector<Slab> slabs;
+    size_t current = 0;   // index in [slabs] of slab being filled
+    size_t used = 0;
+    size_t allocated = 0;
+};
+
+} // namespace pwm
+
+#endif // PWMSECUREARENA_H
@@ -2,193 +2,411 @@
 // SPDX-License-Identifier: LGPL-3.0-only
 
 #include "pwmsecurity.h"
+#include "pwmjournal.h"
+#include "pwmmappedentries.h"
+#include "pwmblockcipher.h"
+#include "pwmsealedpassword.h"
+#include "pwmpasswordgenerator.h"
+
+#include <QtEndian>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace pwm {
 
-int updateMasterHash(const QString &password)
+SessionKey::SessionKey()
 {
-    FILE * masterHashFile = fopen("master.hash", "wb");
-    int returnValue = -1;
+    key = static_cast<unsigned char *>(sodium_malloc(4 * crypto_kdf_KEYBYTES));
+    if (key == NULL)
+    {
+        qCritical() << "Failed to allocate secure memory for session key.";
+        verifier = NULL;
+        wrapping = NULL;
+        scratch = NULL;
+        return;
+    }
+    verifier = key + crypto_kdf_KEYBYTES;
+    wrapping = verifier + crypto_kdf_KEYBYTES;
+    scratch = wrapping + crypto_kdf_KEYBYTES;
+}
 
-    // Generating hash
-    char hash[crypto_pwhash_STRBYTES];
-    if (crypto_pwhash_str(
-            hash,
-            password.toStdString().c_str(),
-            password.size(),
-            crypto_pwhash_OPSLIMIT_INTERACTIVE,
-            crypto_pwhash_MEMLIMIT_INTERACTIVE) != 0)
-    {
-        // Out of memory
-        qCritical() << "Failed to generate hash for given password. Aborted before master hash file update.";
-        goto ret;
+SessionKey::~SessionKey()
+{
+    // sodium_free() also zeroes memory before releasing it
+    if (key != NULL) sodium_free(key);
+}
+
+int SessionKey::derive(const QString &master, const bool legacy)
+{
+    CryptoParams params;
+
+    wipe();
+
+    if (readCryptoParams(params) != 0)
+    {
+        qCritical() << "Failed to read crypto parameters. Aborted key derivation.";
+        return -1;
     }
 
-    // Writing hash in file
-    if (fwrite(hash, sizeof hash[0], sizeof hash, masterHashFile) == 0)
+    return derive(master, params, legacy);
+}
+
+int SessionKey::derive(const QString &master, const CryptoParams &params, const bool legacy)
+{
+    wipe();
+
+    if (key == NULL)
     {
-        // Error in file opening
-        qCritical() << "Failed to write password hash in file. Aborted master hash file update.";
-        goto ret;
+        qCritical() << "No secure memory for session key. Aborted key derivation.";
+        return -1;
     }
 
-    returnValue = 0;
-ret:
-    fclose(masterHashFile);
-    return returnValue;
+    // Single key derivation: root key is stored in [scratch] then split into subkeys
+    if (generateSecretKey(scratch, master, params, legacy) != 0)
+    {
+        qCritical() << "Failed to generate session key.";
+        wipe();
+        return -1;
+    }
 
+    if (legacy)
+        memcpy(key, scratch, crypto_kdf_KEYBYTES); // legacy files are encrypted with root key
+    else
+        crypto_kdf_derive_from_key(key, crypto_kdf_KEYBYTES, KDF_SUBKEY_ENCRYPTION, KDF_CONTEXT, scratch);
+    crypto_kdf_derive_from_key(verifier, crypto_kdf_KEYBYTES, KDF_SUBKEY_VERIFIER, KDF_CONTEXT, scratch);
+    crypto_kdf_derive_from_key(wrapping, crypto_kdf_KEYBYTES, KDF_SUBKEY_WRAPPING, KDF_CONTEXT, scratch);
+    sodium_memzero(scratch, crypto_kdf_KEYBYTES);
+
+    this->legacy = legacy;
+    valid = true;
+    return 0;
 }
 
-int updateCryptoParams()
+int SessionKey::unwrap(const KeyFile &keyFile)
 {
-    FILE * cryptoFile = fopen("crypto.params", "wb");
-    int returnValue = -1;
+    if (!valid)
+    {
+        qCritical() << "Session key is not derived. Aborted data key unwrapping.";
+        return -1;
+    }
 
-    // Generating unpredictible salt
-    unsigned char salt[crypto_pwhash_SALTBYTES];
-    randombytes_buf(salt, crypto_pwhash_SALTBYTES);
+    if (unwrapDataKey(scratch, keyFile, KEYSLOT_MASTER, wrapping) != 0)
+    {
+        qCritical() << "Failed to unwrap data key from key file.";
+        return -1;
+    }
+
+    memcpy(key, scratch, crypto_kdf_KEYBYTES);
+    sodium_memzero(scratch, crypto_kdf_KEYBYTES);
 
-    // Defining parameters
-    unsigned long long opslimit = crypto_pwhash_OPSLIMIT_INTERACTIVE;
-    size_t memlimit = crypto_pwhash_MEMLIMIT_INTERACTIVE;
-    int alg = crypto_pwhash_ALG_DEFAULT;
+    legacy = false;
+    enveloped = true;
+    return 0;
+}
 
-    // Writing parameters in file
-    if (fwrite(salt, sizeof salt[0], sizeof salt, cryptoFile) == 0)
+int SessionKey::wrap(KeyFile &keyFile) const
+{
+    if (!valid || !enveloped)
     {
-        qCritical() << "Failed to write salt in file. Aborted crypto parameters update.";
-        goto ret;
+        qCritical() << "Session key has no data key. Aborted data key wrapping.";
+        return -1;
     }
-    if (fwrite(&opslimit, sizeof opslimit, 1, cryptoFile) == 0)
+
+    return wrapDataKey(keyFile, KEYSLOT_MASTER, key, wrapping);
+}
+
+int SessionKey::generateDataKey()
+{
+    if (!valid)
     {
-        qCritical() << "Failed to write opslimit in file. Aborted crypto parameters update.";
-        goto ret;
+        qCritical() << "Session key is not derived. Aborted data key generation.";
+        return -1;
     }
-    if (fwrite(&memlimit, sizeof memlimit, 1, cryptoFile) == 0)
+
+    randombytes_buf(key, crypto_kdf_KEYBYTES);
+
+    legacy = false;
+    enveloped = true;
+    return 0;
+}
+
+int SessionKey::adoptDataKey(const SessionKey &other)
+{
+    if (!valid || !other.valid || !other.enveloped)
+    {
+        qCritical() << "Session keys are not derived. Aborted data key copy.";
+        return -1;
+    }
+
+    memcpy(key, other.key, crypto_kdf_KEYBYTES);
+
+    legacy = false;
+    enveloped = true;
+    return 0;
+}
+
+void SessionKey::masterHash(unsigned char hash[crypto_generichash_BYTES]) const
+{
+    crypto_generichash(hash, crypto_generichash_BYTES, verifier, crypto_kdf_KEYBYTES, NULL, 0);
+}
+
+void SessionKey::wipe()
+{
+    if (key != NULL) sodium_memzero(key, 4 * crypto_kdf_KEYBYTES);
+    valid = false;
+    legacy = false;
+    enveloped = false;
+}
+
+void SessionKey::swap(SessionKey &other)
+{
+    std::swap(key, other.key);
+    std::swap(verifier, other.verifier);
+    std::swap(wrapping, other.wrapping);
+    std::swap(scratch, other.scratch);
+    std::swap(valid, other.valid);
+    std::swap(legacy, other.legacy);
+    std::swap(enveloped, other.enveloped);
+}
+
+/**
+ * @brief Write master hash of a session key to a file, flushed to disk.
+ * @return 0 if successfully wrote hash; -1 otherwise.
+ */
+static int writeMasterHash(const SessionKey &key, const char *fileName)
+{
+    FILE * masterHashFile = fopen(fileName, "wb");
+    int returnValue = -1;
+
+    if (masterHashFile == NULL)
     {
-        qCritical() << "Failed to write memlimit in file. Aborted crypto parameters update.";
+        qCritical() << "Failed to open master hash file. Aborted master hash file update.";
+        return returnValue;
+    }
+
+    // Generating hash
+    unsigned char hash[crypto_generichash_BYTES];
+    key.masterHash(hash);
+
+    // Writing hash in file
+    if (fwrite(hash, sizeof hash[0], sizeof hash, masterHashFile) != sizeof hash)
+    {
+        // Error in file opening
+        qCritical() << "Failed to write password hash in file. Aborted master hash file update.";
         goto ret;
     }
-    if (fwrite(&alg, sizeof alg, 1, cryptoFile) == 0)
+    if (syncFile(masterHashFile) != 0)
     {
-        qCritical() << "Failed to write algorithm in file. Aborted crypto parameters update.";
+        qCritical() << "Failed to flush password hash to disk. Aborted master hash file update.";
         goto ret;
     }
 
     returnValue = 0;
 ret:
-    fclose(cryptoFile);
+    if (fclose(masterHashFile) != 0) returnValue = -1;
     return returnValue;
 }
 
-QString generatePassword(const int passwordLength, const bool hasLowCase, const bool hasUpCase, const bool hasNumbers, const bool hasSpecials)
+int updateMasterHash(const SessionKey &key)
 {
-    QString characters = "";
-    QString password = "";
-    int nbCharacters = 0;
+    if (!key.isValid())
+    {
+        qCritical() << "Session key is not derived. Aborted before master hash file update.";
+        return -1;
+    }
 
-    if (hasLowCase) characters.append("abcdefghijklmnopqrstuvwxyz");
-    if (hasUpCase) characters.append("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
-    if (hasNumbers) characters.append("0123456789");
-    if (hasSpecials) characters.append("!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~");
+    if (writeMasterHash(key, MASTER_HASH_TMPFILE) != 0
+        || replaceFile(MASTER_HASH_TMPFILE, "master.hash") != 0)
+    {
+        qCritical() << "Failed to replace master hash file. Kept previous master hash file.";
+        remove(MASTER_HASH_TMPFILE);
+        return -1;
+    }
+
+    return 0;
+}
 
-    if (characters.isEmpty())
+int updateCryptoParams()
+{
+    CryptoParams params;
+
+    // Generating unpredictible salt
+    randombytes_buf(params.salt, sizeof params.salt);
+
+    if (writeCryptoParams(params, CRYPTO_PARAMS_TMPFILE) != 0
+        || replaceFile(CRYPTO_PARAMS_TMPFILE, CRYPTO_PARAMS_FILE) != 0)
     {
-        // All booleans are false
-        qCritical() << "Cannot generate password without any charater. Returned empty password.";
-        return "";
+        qCritical() << "Failed to replace crypto parameters file. Kept previous crypto parameters file.";
+        remove(CRYPTO_PARAMS_TMPFILE);
+        return -1;
     }
 
-    nbCharacters = characters.size();
+    return 0;
+}
 
-    // Generating unpredictible password from selected characters
-    while (password.size() < passwordLength)
-        password.append(characters[randombytes_uniform(nbCharacters-1)]);
+QString generatePassword(const int passwordLength, const bool hasLowCase, const bool hasUpCase, const bool hasNumbers, const bool hasSpecials)
+{
+    PasswordPolicy policy;
+    QStringList passwords;
+
+    policy.length = passwordLength;
+    if (hasLowCase) policy.classes |= PASSWORD_LOWCASE;
+    if (hasUpCase) policy.classes |= PASSWORD_UPCASE;
+    if (hasNumbers) policy.classes |= PASSWORD_NUMBERS;
+    if (hasSpecials) policy.classes |= PASSWORD_SPECIALS;
+
+    // Every selected class appears as soon as password is long enough
+    policy.everyClass = (passwordLength >= passwordClassCount(policy.classes));
 
-    return password;
+    if (generatePasswords(policy, 1, passwords) != 0) return "";
+
+    return passwords.first();
 }
 
 int generateSecretKey(unsigned char secretKey[crypto_secretstream_xchacha20poly1305_KEYBYTES], const QString &master)
 {
-    unsigned char salt[crypto_pwhash_SALTBYTES];
-    unsigned long long opslimit;
-    size_t memlimit;
-    int alg;
-
-    FILE * cryptoFile;
-    cryptoFile = fopen("crypto.params", "rb");
-    int returnValue = -1;
+    CryptoParams params;
 
-    // Reading crypto parameters file
-    if (fread(salt, sizeof salt[0], sizeof salt, cryptoFile) == 0)
+    if (readCryptoParams(params) != 0)
     {
-        qCritical() << "Failed to read salt from file. Aborted before key generation.";
-        goto ret;
+        qCritical() << "Failed to read crypto parameters. Aborted before key generation.";
+        return -1;
     }
-    if (fread(&opslimit, sizeof opslimit, 1, cryptoFile) == 0)
+
+    return generateSecretKey(secretKey, master, params);
+}
+
+int generateSecretKey(unsigned char secretKey[crypto_secretstream_xchacha20poly1305_KEYBYTES], const QString &master, const CryptoParams &params, const bool legacy)
+{
+    QByteArray utf8 = master.toUtf8();
+    // Legacy keys were derived from as many UTF-8 bytes as UTF-16 code units
+    const size_t passwordLength = legacy ? static_cast<size_t>(master.size()) : static_cast<size_t>(utf8.size());
+
+    // Generating secret key from parameters and password
+    const int status = hashPassword(
+        secretKey,
+        crypto_secretstream_xchacha20poly1305_KEYBYTES,
+        utf8.constData(),
+        passwordLength,
+        params);
+    sodium_memzero(utf8.data(), utf8.size());
+
+    if (status != 0)
     {
-        qCritical() << "Failed to read opslimit from file. Aborted before key generation.";
-        goto ret;
+        qCritical() << "Failed to generate secret key from given password and parameters. Aborted key generation.";
+        return -1;
     }
-    if (fread(&memlimit, sizeof memlimit, 1, cryptoFile) == 0)
+
+    return 0;
+}
+
+int parseEntriesHeader(const unsigned char *data, const size_t size, EntriesHeader &header, size_t &headerLength)
+{
+    header = EntriesHeader();
+    headerLength = 0;
+
+    if (size >= ENTRIES_MAGICBYTES && memcmp(data, ENTRIES_MAGIC, ENTRIES_MAGICBYTES) == 0)
     {
-        qCritical() << "Failed to read memlimie from file. Aborted before key generation.";
-        goto ret;
+        if (size < ENTRIES_FILEHEADERBYTES)
+        {
+            qCritical() << "Failed to read entries file header.";
+            return -1;
+        }
+
+        memcpy(header.bytes, data, ENTRIES_FILEHEADERBYTES);
+        header.version = header.bytes[4];
+        header.padding = qFromLittleEndian<quint16>(header.bytes + 6);
+        header.algorithm = header.bytes[5];
+        headerLength = ENTRIES_FILEHEADERBYTES;
+
+        if (header.version != ENTRIES_VERSION)
+        {
+            qCritical() << "Entries file version" << header.version << "is not supported.";
+            return -1;
+        }
     }
-    if (fread(&alg, sizeof alg, 1, cryptoFile) == 0)
+    // Legacy file otherwise: starts with stream header
+
+    if (size - headerLength < sizeof header.streamHeader)
     {
-        qCritical() << "Failed to read algorithm from file. Aborted before key generation.";
-        goto ret;
+        qCritical() << "Failed to read stream header.";
+        return -1;
     }
 
-    // Generating secret key from parameters and password
-    if (crypto_pwhash(
-            secretKey,
-            crypto_secretstream_xchacha20poly1305_KEYBYTES,
-            master.toStdString().c_str(),
-            master.size(),
-            salt,
-            opslimit,
-            memlimit,
-            alg) != 0)
+    memcpy(header.streamHeader, data + headerLength, sizeof header.streamHeader);
+    headerLength += sizeof header.streamHeader;
+
+    return 0;
+}
+
+/**
+ * @brief Read header of an open entries file, and move to the first chunk.
+ * @return 0 if successfully read header of a supported version; -1 otherwise.
+ */
+static int readHeader(FILE * entriesFile, EntriesHeader &header)
+{
+    unsigned char headerBytes[ENTRIES_FILEHEADERBYTES + crypto_secretstream_xchacha20poly1305_HEADERBYTES];
+    const size_t nbRead = fread(headerBytes, 1, sizeof headerBytes, entriesFile);
+    size_t headerLength;
+
+    if (parseEntriesHeader(headerBytes, nbRead, header, headerLength) != 0
+        || fseek(entriesFile, headerLength, SEEK_SET) != 0)
+        return -1;
+
+    return 0;
+}
+
+int readEntriesHeader(EntriesHeader &header)
+{
+    FILE * entriesFile = fopen("entries.cipher", "rb");
+    if (entriesFile == NULL)
     {
-        qCritical() << "Failed to generate secret key from given password and parameters. Aborted key generation.";
-        goto ret;
+        qCritical() << "Failed to open entries file.";
+        return -1;
     }
 
-    returnValue = 0;
-ret:
-    fclose(cryptoFile);
+    const int returnValue = readHeader(entriesFile, header);
+    fclose(entriesFile);
     return returnValue;
 }
 
-QStringList readEntries(const QString &master)
+/**
+ * @brief Read entries from a legacy entries file.
+ * @return 0 if successfully read entries; -1 otherwise.
+ */
+static int readLegacyEntries(const SessionKey &key, QStringList &entries)
 {
-    QStringList entries;
-
     FILE * entriesFile = fopen("entries.cipher", "rb");
+    if (entriesFile == NULL)
+    {
+        qCritical() << "Failed to open entries file. Aborted entries file reading.";
+        return -1;
+    }
 
-    unsigned char entryPlain[ENTRY_MAXLEN];
-    unsigned char entryCipher[ENTRY_MAXLEN + crypto_secretstream_xchacha20poly1305_ABYTES];
-    unsigned char header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
+    EntriesHeader header;
     crypto_secretstream_xchacha20poly1305_state state;
+    unsigned char entryPlain[LEGACY_ENTRY_MAXLEN];
+    unsigned char entryCipher[LEGACY_ENTRY_MAXLEN + crypto_secretstream_xchacha20poly1305_ABYTES];
     unsigned char tag = 0;
-
-    // Generating decryption key
-    unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
-    if (generateSecretKey(key, master) != 0)
-    {
-        qCritical() << "Failed to generate secret key. Aborted before entries file reading.";
-        goto ret;
-    }
+    int returnValue = -1;
 
     // Header pull
-    if (fread(header, sizeof header[0], sizeof header, entriesFile) == 0)
+    if (readHeader(entriesFile, header) != 0)
     {
         qCritical() << "Failed to read header. Aborted entries file reading.";
         goto ret;
     }
-    if (crypto_secretstream_xchacha20poly1305_init_pull(&state, header, key) != 0)
+    if (crypto_secretstream_xchacha20poly1305_init_pull(&state, header.streamHeader, key.data()) != 0)
     {
         // Incomplete header
         qCritical() << "Failed to recognize header. Aborted entries file reading.";
@@ -202,7 +420,7 @@ QStringList readEntries(const QString &master)
         if (fread(entryCipher, 1, sizeof entryCipher, entriesFile) == 0)
         {
             // End of file
-            goto ret;
+            break;
         }
 
         // Decrypting entry
@@ -216,7 +434,7 @@ QStringList readEntries(const QString &master)
         // Converting UChar entry to QString and appending to entries list
         QString entryAsString;
         int c = 0;
-        while(entryPlain[c] != '\0')
+        while(c < LEGACY_ENTRY_MAXLEN && entryPlain[c] != '\0')
         {
             entryAsString.append(QChar(entryPlain[c]));
             c++;
@@ -224,114 +442,698 @@ QStringList readEntries(const QString &master)
         entries << entryAsString;
     }
 
+    returnValue = 0;
 ret:
+    sodium_memzero(entryPlain, sizeof entryPlain);
     fclose(entriesFile);
-    return entries;
+    return returnValue;
 }
 
-int writeEntries(const QString &master, const QStringList &entrynames, const QStringList &usernames, const QStringList &passwords, const QStringList &dates)
+/**
+ * @brief Encode fields of an entry as an index record (see EntryRecord), without its password.
+ * @param record: Array where record is going to be stored (previous content is wiped).
+ * @param padding: Bytes to allocate after record, so that padding it does not reallocate.
+ */
+static void encodeRecord(const EntryStore &entries, const EntryId id, QByteArray &record, const size_t padding)
 {
-    int returnValue = -1;
+    std::string_view fields[ENTRY_NBFIELDS];
+    for (int field = 0 ; field < ENTRY_NBFIELDS ; ++field)
+        fields[field] = entries.view(id, static_cast<EntryField>(field));
+    // Sealed passwords are written to password segment
+    fields[ENTRY_PASSWORD] = std::string_view();
 
-    const int nbEntries = entrynames.size();
+    // Growing array would release previous bytes without wiping them
+    const size_t recordLength = EntryRecord::encodedLength(fields);
+    sodium_memzero(record.data(), record.size());
+    if (static_cast<size_t>(record.capacity()) < recordLength + padding)
+    {
+        record.clear();
+        record.reserve(recordLength + padding);
+    }
+    record.resize(recordLength);
+
+    EntryRecord::encode(reinterpret_cast<unsigned char *>(record.data()), fields);
+}
 
-    // Checking size equality
-    if (!(nbEntries == usernames.size() && nbEntries == passwords.size() && nbEntries == dates.size()))
+int readEntries(const SessionKey &key, EntryStore &entries)
+{
+    if (!key.isValid())
     {
-        qCritical() << "Number of elements of each entry fields do not match. Aborted before entries file writing";
-        return returnValue;
+        qCritical() << "Session key is not derived. Aborted before entries file reading.";
+        return -1;
     }
 
-    FILE * entriesFile = fopen("entries.cipher", "wb");
-    unsigned char entryPlain[ENTRY_MAXLEN];
-    unsigned char entryCipher[ENTRY_MAXLEN + crypto_secretstream_xchacha20poly1305_ABYTES];
-    unsigned char header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
-    crypto_secretstream_xchacha20poly1305_state state;
-    unsigned char tag;
+    EntriesHeader header;
+    if (readEntriesHeader(header) != 0)
+    {
+        qCritical() << "Failed to read header. Aborted entries file reading.";
+        return -1;
+    }
+
+    // Entries are only kept if whole file and journal are read
+    entries.begin();
 
-    // Generating decryption key
-    unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
-    if (generateSecretKey(key, master) != 0)
+    if (header.version == 0)
     {
-        qCritical() << "Failed to generate secret key. Aborted before entries file writing.";
-        goto ret;
+        QStringList lines;
+        if (readLegacyEntries(key, lines) != 0)
+        {
+            entries.rollback();
+            return -1;
+        }
+
+        for (int line = 0 ; line < lines.size() ; ++line)
+        {
+            const QStringList entryFields = lines[line].split('\t');
+            if (entryFields.size() != LEGACY_ENTRY_NBFIELDS)
+                qWarning() << "Format of entry" << line << "is incorrect. Skipped entry.";
+            else
+            {
+                // Plaintext password, sealed once data key is final (see sealPasswords())
+                QByteArray password = entryFields[ENTRY_PASSWORD].toUtf8();
+                entries.add(entryFields[ENTRY_NAME], entryFields[ENTRY_USERNAME], std::string_view(password.constData(), password.size()), entryFields[ENTRY_DATE]);
+                sodium_memzero(password.data(), password.size());
+            }
+        }
+    }
+    else
+    {
+        // Decrypting whole file into a single locked arena
+        MappedEntries mappedEntries;
+        if (mappedEntries.open(key) != 0)
+        {
+            entries.rollback();
+            return -1;
+        }
+
+        // Copying UTF-8 fields straight from arena into store
+        entries.reserve(entries.size() + mappedEntries.size());
+        for (int record = 0 ; record < mappedEntries.size() ; ++record)
+            entries.add(mappedEntries.record(record));
     }
 
+    // Applying changes saved since entries file was written
+    if (replayJournal(key, header.streamHeader, entries) != 0)
+    {
+        qCritical() << "Failed to replay journal. Aborted entries file reading.";
+        entries.rollback();
+        return -1;
+    }
+
+    entries.commit();
+    return 0;
+}
+
+/**
+ * @brief Encrypt a block and write it to entries file.
+ * @return 0 if successfully wrote block; -1 otherwise.
+ */
+static int pushBlock(FILE * entriesFile, EntryBlockCipher &blockCipher, const QByteArray &blockPlain, QByteArray &blockCipherText)
+{
+    const quint32 length = blockPlain.size() + BLOCK_ABYTES;
+    const quint32 lengthLE = qToLittleEndian(length);
+
+    blockCipherText.resize(length);
+    if (blockCipher.seal(reinterpret_cast<unsigned char *>(blockCipherText.data()),
+                         reinterpret_cast<const unsigned char *>(blockPlain.constData()), blockPlain.size()) != 0)
+        return -1;
+
+    if (fwrite(&lengthLE, sizeof lengthLE, 1, entriesFile) != 1
+        || fwrite(blockCipherText.constData(), 1, length, entriesFile) != length)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * @brief Block algorithm of entries file to write: the one chosen when current entries file was first written.
+ */
+static quint8 entriesAlgorithm()
+{
+    EntriesHeader header;
+    if (readEntriesHeader(header) == 0 && header.version == ENTRIES_VERSION && blockAlgorithmAvailable(header.algorithm))
+        return header.algorithm;
+
+    return preferredBlockAlgorithm();
+}
+
+/**
+ * @brief Write entries to a new entries file, flushed to disk (see writeEntries()).
+ * @return 0 if successfully wrote file; -1 otherwise.
+ */
+static int writeEntriesFile(const SessionKey &key, const EntryStore &entries, const char *fileName)
+{
+    int returnValue = -1;
+
+    FILE * entriesFile = fopen(fileName, "wb");
+    if (entriesFile == NULL)
+    {
+        qCritical() << "Failed to open temporary entries file. Aborted entries file writing.";
+        return returnValue;
+    }
+
+    EntriesHeader header;
+    QByteArray record;
+    QByteArray chunk;
+    QByteArray chunkCipher;
+    const quint32 endMarker = 0;
+    unsigned char mac[BLOCK_MACBYTES];
+
+    chunk.reserve(ENTRIES_CHUNK_SIZE);
+
+    // File header, and random file id: nonces of blocks are derived from it
+    header.version = ENTRIES_VERSION;
+    header.padding = ENTRIES_PADDING;
+    header.algorithm = entriesAlgorithm();
+    memcpy(header.bytes, ENTRIES_MAGIC, ENTRIES_MAGICBYTES);
+    header.bytes[4] = ENTRIES_VERSION;
+    header.bytes[5] = header.algorithm;
+    qToLittleEndian<quint16>(header.padding, header.bytes + 6);
+    randombytes_buf(header.streamHeader, sizeof header.streamHeader);
+    EntryBlockCipher blockCipher(key, header);
+
     // Header push
-    crypto_secretstream_xchacha20poly1305_init_push(&state, header, key);
-    if (fwrite(header, sizeof header[0], sizeof header, entriesFile) == 0)
+    if (!blockCipher.isValid()
+        || fwrite(header.bytes, 1, sizeof header.bytes, entriesFile) != sizeof header.bytes
+        || fwrite(header.streamHeader, 1, sizeof header.streamHeader, entriesFile) != sizeof header.streamHeader)
     {
         qCritical() << "Failed to write header. Aborted entries file writing.";
         goto ret;
     }
 
     // Entries push
-    for (int entry = 0 ; entry < nbEntries ; ++entry)
+    for (int entry = 0 ; entry < entries.size() ; ++entry)
     {
-        // Concatenating entry fields as an entry
-        QString entryAsString;
-        int entryLength; // without '\0'
-        entryAsString.append(entrynames[entry]);
-        entryAsString.append('\t');
-        entryAsString.append(usernames[entry]);
-        entryAsString.append("\t");
-        entryAsString.append(passwords[entry]);
-        entryAsString.append("\t");
-        entryAsString.append(dates[entry]);
-        entryLength = entryAsString.size();
-
-        if (entryLength + 1 > ENTRY_MAXLEN) // +1 to consider '\0'
+        // Encoding entry fields as a record
+        encodeRecord(entries, entries.id(entry), record, header.padding);
+
+        // Padding record
+        size_t recordLength = record.size();
+        if (header.padding > 0)
         {
-            // Should never happen if max lengths are respected during entry creation
-            qWarning() << "Entry is too long. Skipping entry.";
+            const size_t unpaddedLength = recordLength;
+            record.resize(unpaddedLength + header.padding);
+            sodium_pad(&recordLength, reinterpret_cast<unsigned char *>(record.data()), unpaddedLength, header.padding, record.size());
         }
 
-        // Writing QString entry into UChar
-        for (int c = 0 ; c < entryLength ; c++)
-            entryPlain[c] = (unsigned char)entryAsString[c].toLatin1();
-        entryPlain[entryLength] = '\0'; // used to ignore characters beyond [entryLength] when reading
+        // Encrypting and writing full block to entries file
+        if (!chunk.isEmpty() && chunk.size() + sizeof(quint32) + recordLength > ENTRIES_CHUNK_SIZE)
+        {
+            if (pushBlock(entriesFile, blockCipher, chunk, chunkCipher) != 0)
+            {
+                qCritical() << "Failed to write entries. Aborted entries file writing.";
+                goto ret;
+            }
+            sodium_memzero(chunk.data(), chunk.size());
+            chunk.clear();
+        }
+
+        // Packing record into block
+        unsigned char paddedLength[sizeof(quint32)];
+        qToLittleEndian<quint32>(recordLength, paddedLength);
+        chunk.append(reinterpret_cast<const char *>(paddedLength), sizeof paddedLength);
+        chunk.append(record.constData(), recordLength);
+    }
+
+    // Last block
+    if (!chunk.isEmpty() && pushBlock(entriesFile, blockCipher, chunk, chunkCipher) != 0)
+    {
+        qCritical() << "Failed to write entries. Aborted entries file writing.";
+        goto ret;
+    }
 
-        // Checking for last entry to update tag
-        tag = (entry == (nbEntries - 1)) ? crypto_secretstream_xchacha20poly1305_TAG_FINAL : 0;
+    if (fwrite(&endMarker, sizeof endMarker, 1, entriesFile) != 1)
+    {
+        qCritical() << "Failed to write entries. Aborted entries file writing.";
+        goto ret;
+    }
 
-        // Encrypting entry
-        crypto_secretstream_xchacha20poly1305_push(&state, entryCipher, NULL, entryPlain, sizeof entryPlain, NULL, 0, tag);
+    // Password segment: sealed passwords are written as they are, in entries order
+    for (int entry = 0 ; entry < entries.size() ; ++entry)
+    {
+        const std::string_view sealed = entries.view(entries.id(entry), ENTRY_PASSWORD);
+        const quint32 lengthLE = qToLittleEndian<quint32>(sealed.size());
+        if (sealed.size() < PASSWORD_SEALBYTES)
+        {
+            qCritical() << "Password of entry" << entry << "is not sealed. Aborted entries file writing.";
+            goto ret;
+        }
 
-        // Writing entry to entries file
-        if (fwrite(entryCipher, 1, sizeof entryCipher, entriesFile) == 0)
+        blockCipher.authenticatePassword(reinterpret_cast<const unsigned char *>(sealed.data()), sealed.size());
+        if (fwrite(&lengthLE, sizeof lengthLE, 1, entriesFile) != 1
+            || fwrite(sealed.data(), 1, sealed.size(), entriesFile) != sealed.size())
         {
-            qCritical() << "Failed to write entry. Aborted entries file writing.";
+            qCritical() << "Failed to write passwords. Aborted entries file writing.";
             goto ret;
         }
     }
 
+    // File MAC: removed, reordered or truncated blocks and passwords are detected
+    blockCipher.finalMac(mac);
+    if (fwrite(mac, 1, sizeof mac, entriesFile) != sizeof mac)
+    {
+        qCritical() << "Failed to write file MAC. Aborted entries file writing.";
+        goto ret;
+    }
+
+    if (syncFile(entriesFile) != 0)
+    {
+        qCritical() << "Failed to flush entries to disk. Aborted entries file writing.";
+        goto ret;
+    }
+
     returnValue = 0;
 ret:
-    fclose(entriesFile);
+    sodium_memzero(record.data(), record.size());
+    sodium_memzero(chunk.data(), chunk.size());
+    if (fclose(entriesFile) != 0) returnValue = -1;
     return returnValue;
 }
 
-const bool masterIsCorrect(const QString &master)
+int writeEntries(const SessionKey &key, const EntryStore &entries)
 {
-    char hash[crypto_pwhash_STRBYTES];
+    if (!key.isValid())
+    {
+        qCritical() << "Session key is not derived. Aborted before entries file writing.";
+        return -1;
+    }
+
+    // Writing next to entries file, which is only replaced once new file is complete
+    if (writeEntriesFile(key, entries, ENTRIES_TMPFILE) != 0)
+    {
+        remove(ENTRIES_TMPFILE);
+        return -1;
+    }
+    if (replaceFile(ENTRIES_TMPFILE, "entries.cipher") != 0)
+    {
+        qCritical() << "Failed to replace entries file. Kept previous entries file.";
+        remove(ENTRIES_TMPFILE);
+        return -1;
+    }
+
+    // Entries file now contains every change: journal is no longer needed
+    resetJournal();
+
+    return 0;
+}
+
+int syncFile(FILE *file)
+{
+    if (fflush(file) != 0) return -1;
+
+#ifdef Q_OS_WIN
+    if (_commit(_fileno(file)) != 0) return -1;
+#else
+    if (fsync(fileno(file)) != 0) return -1;
+#endif
+
+    return 0;
+}
+
+int replaceFile(const char *temporaryName, const char *fileName)
+{
+#ifdef Q_OS_WIN
+    if (!MoveFileExA(temporaryName, fileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        return -1;
+#else
+    if (rename(temporaryName, fileName) != 0)
+        return -1;
+
+    // Flushing directory so that renaming itself survives a crash
+    syncDirectory();
+#endif
+
+    return 0;
+}
+
+void syncDirectory()
+{
+#ifndef Q_OS_WIN
+    const int directory = open(".", O_RDONLY);
+    if (directory != -1)
+    {
+        fsync(directory);
+        close(directory);
+    }
+#endif
+}
+
+int unlock(SessionKey &key, const QString &master)
+{
+    char hash[crypto_pwhash_STRBYTES] = {0}; // large enough for both hash formats
     FILE * masterHashFile = fopen("master.hash", "rb");
 
+    if (masterHashFile == NULL)
+    {
+        qCritical() << "Failed to open master hash file.";
+        return -1;
+    }
+
     // Reading hash from file
-    if (fread(hash, sizeof hash[0], sizeof hash, masterHashFile) == 0)
+    size_t hashLength = fread(hash, sizeof hash[0], sizeof hash, masterHashFile);
+    fclose(masterHashFile);
+    if (hashLength == 0)
     {
         // Error in file reading
         qCritical() << "Failed to read master hash.";
-        return false;
+        return -1;
+    }
+
+    if (strncmp(hash, MASTER_HASH_LEGACY_PREFIX, strlen(MASTER_HASH_LEGACY_PREFIX)) == 0)
+    {
+        // Verifying password with legacy hash, which was computed over as many UTF-8 bytes as UTF-16 code units
+        QByteArray utf8 = master.toUtf8();
+        const int status = crypto_pwhash_str_verify(hash, utf8.constData(), master.size());
+        sodium_memzero(utf8.data(), utf8.size());
+        if (status != 0) return 1;
+
+        return (key.derive(master, true) == 0) ? 0 : -1;
+    }
+
+    if (hashLength != crypto_generichash_BYTES)
+    {
+        qCritical() << "Master hash file has an unexpected size.";
+        return -1;
+    }
+
+    if (key.derive(master) != 0) return -1;
+
+    // Verifying password with verifier subkey hash
+    unsigned char expectedHash[crypto_generichash_BYTES];
+    key.masterHash(expectedHash);
+    if (sodium_memcmp(expectedHash, hash, crypto_generichash_BYTES) != 0)
+    {
+        key.wipe();
+        return 1;
+    }
+
+    // Vault encrypted with a data key (files written before key files use encryption subkey)
+    if (keyFileExists())
+    {
+        KeyFile keyFile;
+        if (readKeyFile(keyFile) != 0 || key.unwrap(keyFile) != 0)
+        {
+            qCritical() << "Failed to read data key. Key file may be corrupted.";
+            key.wipe();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+UnlockResult unlockEntries(const QString &master, const QString &newMaster)
+{
+    UnlockResult result;
+    result.key = std::make_shared<SessionKey>();
+    result.entries = std::make_shared<EntryStore>();
+
+    // Another process would write entries and journal from its own copy of entries.
+    // Lock is only handed over on success: any aborted unlock releases it on return.
+    std::shared_ptr<QLockFile> lock = std::make_shared<QLockFile>(VAULT_LOCKFILE);
+    lock->setStaleLockTime(0); // only locks of processes that no longer run are stale
+    if (!lock->tryLock(0))
+    {
+        const bool lockedByOther = (lock->error() == QLockFile::LockFailedError);
+        qCritical() << (lockedByOther ? "Vault is already open in another process. Aborted unlock."
+                                      : "Failed to lock vault. Aborted unlock.");
+        if (lockedByOther) result.status = 2;
+        return result;
+    }
+
+    // Files must match each other before reading any of them
+    if (recoverRekey() != 0) return result;
+
+    QElapsedTimer timer;
+    timer.start();
+    result.status = unlock(*result.key, master);
+    result.unlockTime = timer.elapsed();
+    if (result.status != 0) return result;
+
+    EntriesHeader header;
+    if (readEntriesHeader(header) != 0 || readEntries(*result.key, *result.entries) != 0)
+    {
+        // Entries file must not be re-written
+        qCritical() << "Failed to read entries. Aborted unlock.";
+        result.key->wipe();
+        result.entries->clear();
+        result.status = -1;
+        return result;
+    }
+    result.outdated = (header.version != ENTRIES_VERSION);
+
+    if (newMaster != master)
+    {
+        // Data key is kept: only its wrapping changes
+        std::shared_ptr<SessionKey> newKey = std::make_shared<SessionKey>();
+        if (newKey->derive(newMaster) != 0
+            || (result.key->isEnveloped() && newKey->adoptDataKey(*result.key) != 0))
+        {
+            qCritical() << "Failed to derive key from new master password. Aborted unlock.";
+            result.key->wipe();
+            result.entries->clear();
+            result.status = -1;
+            return result;
+        }
+        result.key.swap(newKey);
+        result.rewrapped = true;
+    }
+
+    // Legacy key only hashed part of non-ASCII passwords: it is kept for reading legacy entries
+    // file, and the migrated vault is keyed from the whole UTF-8 password like later unlocks
+    if (result.key->isLegacy())
+    {
+        std::shared_ptr<SessionKey> freshKey = std::make_shared<SessionKey>();
+        if (freshKey->derive(master) != 0)
+        {
+            qCritical() << "Failed to derive key for migrated vault. Aborted unlock.";
+            result.key->wipe();
+            result.entries->clear();
+            result.status = -1;
+            return result;
+        }
+        result.key.swap(freshKey);
+    }
+
+    // Files written before key files: encrypting them with a new data key
+    if (!result.key->isEnveloped())
+    {
+        if (result.key->generateDataKey() != 0)
+        {
+            result.key->wipe();
+            result.entries->clear();
+            result.status = -1;
+            return result;
+        }
+        result.rekeyed = true;
+        result.rewrapped = false;
     }
 
-    // Verifying password with hash
-    if (crypto_pwhash_str_verify(
-            hash,
-            master.toStdString().c_str(),
-            master.size()) == 0)
-        return true;
+    // Passwords are only sealed once data key is final
+    if (header.version == 0 && sealPasswords(*result.key, *result.entries) != 0)
+    {
+        result.key->wipe();
+        result.entries->clear();
+        result.status = -1;
+        return result;
+    }
+
+    result.lock = lock;
+    return result;
+}
+
+RekeyResult prepareRekey(const QString &master)
+{
+    RekeyResult result;
+    CryptoParams current;
+
+    if (readCryptoParams(current) != 0 || calibrateCryptoParams(result.params) != 0)
+    {
+        qWarning() << "Failed to calibrate crypto parameters. Kept current parameters.";
+        return result;
+    }
+
+    // Slow machines keep minimum parameters: nothing to gain from a rewrap, but calibration is
+    // recorded so that it is not run again on every unlock (see cryptoParamsNeedCalibration())
+    if (result.params.opslimit == current.opslimit && result.params.memlimit == current.memlimit && result.params.alg == current.alg
+        && result.params.lanes == current.lanes)
+    {
+        current.calibratedMs = result.params.calibratedMs;
+        result.params = current;
+        if (writeCryptoParams(current, CRYPTO_PARAMS_TMPFILE) != 0
+            || replaceFile(CRYPTO_PARAMS_TMPFILE, CRYPTO_PARAMS_FILE) != 0)
+        {
+            qWarning() << "Failed to record calibration in crypto parameters file.";
+            remove(CRYPTO_PARAMS_TMPFILE);
+        }
+        result.status = 1;
+        return result;
+    }
+
+    // Derivation with calibrated parameters is timed: it is the calibration recorded with them
+    QElapsedTimer timer;
+    timer.start();
+    result.key = std::make_shared<SessionKey>();
+    if (result.key->derive(master, result.params) != 0)
+    {
+        qWarning() << "Failed to derive key with calibrated parameters. Kept current parameters.";
+        return result;
+    }
+    result.params.calibratedMs = static_cast<quint32>(std::max<qint64>(timer.elapsed(), 1));
+
+    result.status = 0;
+    return result;
+}
+
+/**
+ * @brief Replace vault files by the ones written by a rekey, then remove REKEY_MARKER.
+ * Files already replaced (e.g. before a crash) are skipped.
+ * @param withEntries: True if entries file is part of the rekey; ENTRIES_TMPFILE is left alone otherwise,
+ * since it may be written by a save.
+ * @return 0 if every file is replaced; -1 otherwise.
+ */
+static int commitRekey(const bool withEntries)
+{
+    const char *files[][2] = {
+        {ENTRIES_TMPFILE, "entries.cipher"},
+        {KEYFILE_TMPFILE, KEYFILE_NAME},
+        {MASTER_HASH_TMPFILE, "master.hash"},
+        {CRYPTO_PARAMS_TMPFILE, CRYPTO_PARAMS_FILE}
+    };
+    bool entriesReplaced = false;
+
+    for (size_t file = withEntries ? 0 : 1 ; file < sizeof files / sizeof files[0] ; ++file)
+    {
+        FILE * temporaryFile = fopen(files[file][0], "rb");
+        if (temporaryFile == NULL) continue; // already replaced, or not part of this rekey
+        fclose(temporaryFile);
+
+        if (replaceFile(files[file][0], files[file][1]) != 0)
+        {
+            qCritical() << "Failed to replace" << files[file][1] << "during rekey.";
+            return -1;
+        }
+        if (file == 0) entriesReplaced = true;
+    }
+
+    // Journal was encrypted with previous data key, for previous entries file
+    if (entriesReplaced) resetJournal();
+
+    if (remove(REKEY_MARKER) != 0)
+    {
+        qCritical() << "Failed to remove rekey marker.";
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Write rekeyed files next to current ones, create REKEY_MARKER, then replace current files.
+ * @param entries: Entries to write with a new data key; null to keep entries file.
+ * @return 0 if vault now uses [key]; -1 otherwise.
+ */
+static int writeRekeyedFiles(const SessionKey &key, const CryptoParams &params, const EntryStore *entries, KeyFile &keyFile)
+{
+    if (!key.isValid() || !key.isEnveloped())
+    {
+        qCritical() << "Session key has no data key. Aborted rekey.";
+        return -1;
+    }
+
+    // Only files written below may be committed: without entries, ENTRIES_TMPFILE is not part of the rekey
+    const unsigned char withEntries = (entries != nullptr) ? REKEY_WITHENTRIES : 0;
+    if (withEntries) remove(ENTRIES_TMPFILE);
+
+    // New files are written next to previous ones, which are still valid until commit point
+    FILE * marker = NULL;
+    if ((withEntries && writeEntriesFile(key, *entries, ENTRIES_TMPFILE) != 0)
+        || key.wrap(keyFile) != 0
+        || writeKeyFile(keyFile, KEYFILE_TMPFILE) != 0
+        || writeMasterHash(key, MASTER_HASH_TMPFILE) != 0
+        || writeCryptoParams(params, CRYPTO_PARAMS_TMPFILE) != 0
+        || (marker = fopen(REKEY_MARKER, "wb")) == NULL
+        || fwrite(&withEntries, 1, 1, marker) != 1
+        || syncFile(marker) != 0)
+    {
+        qCritical() << "Failed to write rekeyed files. Kept previous key.";
+        if (marker != NULL) fclose(marker);
+        remove(REKEY_MARKER);
+        if (withEntries) remove(ENTRIES_TMPFILE);
+        remove(KEYFILE_TMPFILE);
+        remove(MASTER_HASH_TMPFILE);
+        remove(CRYPTO_PARAMS_TMPFILE);
+        return -1;
+    }
+    fclose(marker);
+    syncDirectory();
+
+    // Commit point: from now on, new files replace previous ones even after a crash
+    return commitRekey(withEntries);
+}
+
+int rekeyVault(const SessionKey &key, const CryptoParams &params, const EntryStore &entries)
+{
+    // Other slots wrap previous data key
+    KeyFile keyFile;
+    return writeRekeyedFiles(key, params, &entries, keyFile);
+}
+
+int rewrapVault(const SessionKey &key, const CryptoParams &params)
+{
+    KeyFile keyFile;
+    if (readKeyFile(keyFile) != 0)
+    {
+        qCritical() << "Failed to read key file. Aborted rewrap.";
+        return -1;
+    }
+
+    return writeRekeyedFiles(key, params, nullptr, keyFile);
+}
+
+int updateVault(const SessionKey &key, const EntryStore &entries, const bool rekeyed, const bool rewrapped, const bool outdated)
+{
+    CryptoParams params;
+
+    if ((rekeyed || rewrapped) && readCryptoParams(params) != 0)
+    {
+        qCritical() << "Failed to read crypto parameters. Aborted vault update.";
+        return -1;
+    }
+
+    // Entries file is only re-written if data key is new or if file format is outdated.
+    // A new master password only re-wraps data key.
+    if (rekeyed) return rekeyVault(key, params, entries);
+    if (outdated && writeEntries(key, entries) != 0) return -1;
+    if (rewrapped) return rewrapVault(key, params);
+
+    return 0;
+}
+
+int recoverRekey()
+{
+    FILE * marker = fopen(REKEY_MARKER, "rb");
+    unsigned char withEntries = 0;
+    const bool committed = (marker != NULL && fread(&withEntries, 1, 1, marker) == 1);
+
+    if (marker != NULL) fclose(marker);
+
+    if (!committed)
+    {
+        // Rekey interrupted before commit point (marker missing or incomplete), or none: previous files are valid
+        if (marker != NULL && remove(REKEY_MARKER) != 0)
+        {
+            qCritical() << "Failed to remove incomplete rekey marker.";
+            return -1;
+        }
+        remove(KEYFILE_TMPFILE);
+        remove(MASTER_HASH_TMPFILE);
+        remove(CRYPTO_PARAMS_TMPFILE);
+        return 0;
+    }
 
-    return false;
+    qWarning() << "Completing interrupted rekey.";
+    return commitRekey(withEntries == REKEY_WITHENTRIES);
 }
 
 } // namespace pwm
@@ -6,65 +6,313 @@
 
 #include <QString>
 #include <QStringList>
+#include <QLockFile>
 #include <QDebug>
 
 #include <sodium.h>
 #include <cstdio>
+#include <memory>
 
-// ENTRY_MAXLEN =
-// ENTRYNAME_MAXLEN
-// + USERNAME_MAXLEN
-// + PASSWORD_MAXLEN
+#include "pwmentrystore.h"
+#include "pwmcryptoparams.h"
+#include "pwmkeyfile.h"
+
+// Size of each entry in legacy entries files (version 0):
+// entry name (22)
+// + user name (32)
+// + password (60)
 // + 10 date characters
 // + 3 separating characters ('\t')
 // + end character '\0'
-#define ENTRY_MAXLEN 128
-#define ENTRYNAME_MAXLEN 22
-#define USERNAME_MAXLEN 32
-#define PASSWORD_MAXLEN 60
+#define LEGACY_ENTRY_MAXLEN 128
+// Fields of each entry in legacy entries files: entry name, user name, password, date
+#define LEGACY_ENTRY_NBFIELDS 4
+
+// Maximum field lengths accepted by user interface.
+// Entries file records are length-prefixed: these are not limited by file format.
+#define ENTRYNAME_MAXLEN 64
+#define USERNAME_MAXLEN 128
+#define PASSWORD_MAXLEN 128
+
+// Entries file format
+#define ENTRIES_MAGIC "PWMV"
+#define ENTRIES_MAGICBYTES 4
+#define ENTRIES_FILEHEADERBYTES 8
+#define ENTRIES_VERSION 1
+#define ENTRIES_PADDING 32 // records are padded to a multiple of this size to limit length leakage (0: no padding)
+#define ENTRIES_CHUNK_SIZE 32768 // records are packed into blocks of about this size
+#define ENTRIES_CHUNK_MAXLEN (1 << 24) // blocks bigger than this are considered corrupted
+#define ENTRIES_TMPFILE "entries.cipher.tmp" // entries file being written, renamed once complete
 
 #define MASTER_MINLEN crypto_pwhash_PASSWD_MIN
 #define MASTER_MAXLEN crypto_pwhash_PASSWD_MAX
 
+// Root key derived from master password is split into subkeys
+#define KDF_CONTEXT "pwmvault"
+#define KDF_SUBKEY_ENCRYPTION 1
+#define KDF_SUBKEY_VERIFIER 2
+#define KDF_SUBKEY_WRAPPING 3
+
+// Master hash files written before subkeys were introduced
+// contain a crypto_pwhash_str() string starting with this prefix
+#define MASTER_HASH_LEGACY_PREFIX "$argon2"
+#define MASTER_HASH_TMPFILE "master.hash.tmp"
+
+// Created once every file of a rekey is written, removed once they all replaced previous ones
+// (see rekeyVault()). Holds a single byte: REKEY_WITHENTRIES if entries file is part of the rekey, 0 otherwise.
+#define REKEY_MARKER "rekey.pending"
+#define REKEY_WITHENTRIES 1
+
+// Held by the process which unlocked the vault, for its whole session (see unlockEntries())
+#define VAULT_LOCKFILE "vault.lock"
+
 
 namespace pwm {
 
+/**
+ * @brief Encryption/decryption key kept for the whole session.
+ *
+ * A single root key is derived from master password and crypto parameters
+ * when unlocking, then split with crypto_kdf into:
+ * - a wrapping subkey, which encrypts the data key in key file (see KeyFile);
+ * - a verifier subkey, whose hash is stored in master hash file;
+ * - an encryption subkey, which encrypted entries file before key files were introduced.
+ * Entries file and journal are encrypted with the data key, unwrapped from key file
+ * when unlocking (see unwrap()): it never changes with master password.
+ * Keys are stored in guarded, locked memory (sodium_malloc) so that they never
+ * reach swap, and are wiped by wipe() or on destruction.
+ *
+ * Legacy files (see MASTER_HASH_LEGACY_PREFIX) are encrypted with the root key
+ * itself. Files without key file are encrypted with the encryption subkey. Both are
+ * re-written with a new data key once read (see generateDataKey()).
+ */
+class SessionKey
+{
+public:
+    SessionKey();
+    ~SessionKey();
+    SessionKey(const SessionKey &) = delete;
+    SessionKey &operator=(const SessionKey &) = delete;
+
+    /**
+     * @brief Derive keys from master password and crypto parameters file.
+     * @param master: Master password used to generate root key.
+     * @param legacy: True to keep root key as encryption key (legacy files).
+     * @return 0 if successfully derived keys; -1 otherwise.
+     * @see generateSecretKey()
+     */
+    int derive(const QString &master, const bool legacy = false);
+    /**
+     * @brief Derive keys from master password and given crypto parameters.
+     * @param master: Master password used to generate root key.
+     * @param params: Crypto parameters, e.g. not yet written to crypto parameters file.
+     * @param legacy: True to keep root key as encryption key (legacy files).
+     * @return 0 if successfully derived keys; -1 otherwise.
+     */
+    int derive(const QString &master, const CryptoParams &params, const bool legacy = false);
+    /**
+     * @brief Replace encryption key by the data key of key file master slot.
+     * @param keyFile: Key file read from disk.
+     * @return 0 if successfully unwrapped data key; -1 otherwise.
+     */
+    int unwrap(const KeyFile &keyFile);
+    /**
+     * @brief Wrap data key into key file master slot.
+     * @param keyFile: Key file to update; other slots are kept.
+     * @return 0 if successfully wrapped data key; -1 otherwise.
+     */
+    int wrap(KeyFile &keyFile) const;
+    /**
+     * @brief Replace encryption key by a new random data key.
+     * Entries file and key file must then be re-written (see rekeyVault()).
+     * @return 0 if successfully generated key; -1 otherwise.
+     */
+    int generateDataKey();
+    /**
+     * @brief Use the data key of another session key, e.g. after deriving keys from a new master password.
+     * @param other: Session key whose data key is copied.
+     * @return 0 if successfully copied data key; -1 otherwise.
+     */
+    int adoptDataKey(const SessionKey &other);
+    /**
+     * @brief Compute the hash of verifier subkey, as stored in master hash file.
+     * @param hash: Array where hash is going to be stored.
+     */
+    void masterHash(unsigned char hash[crypto_generichash_BYTES]) const;
+    /**
+     * @brief Wipe keys from memory. Keys are invalid until next derive().
+     */
+    void wipe();
+    /**
+     * @brief Exchange keys with another session key, without copying them.
+     * @param other: Session key to exchange keys with.
+     */
+    void swap(SessionKey &other);
+
+    bool isValid() const { return valid; }
+    bool isLegacy() const { return legacy; }
+    bool isEnveloped() const { return enveloped; }
+    const unsigned char *data() const { return key; }
+
+private:
+    unsigned char *key;      // crypto_kdf_KEYBYTES bytes
+    unsigned char *verifier; // crypto_kdf_KEYBYTES bytes, follows [key] in secure memory
+    unsigned char *wrapping; // crypto_kdf_KEYBYTES bytes, follows [verifier] in secure memory
+    unsigned char *scratch;  // crypto_kdf_KEYBYTES bytes, follows [wrapping] in secure memory
+    bool valid = false;
+    bool legacy = false;
+    bool enveloped = false;  // true if [key] is a data key (see unwrap())
+};
+
 /**
  * @brief Update master password hash file.
  *
- * @param password: Password to hash.
+ * @param key: Session key derived from master password.
  *
  * @return 0 if successfully updated password hash file; -1 otherwise.
  *
  * File structure:
- * hash (char)
+ * hash (unsigned char, crypto_generichash_BYTES of verifier subkey)
+ *
+ * Master hash file is replaced in a single step (see replaceFile()).
  *
  * @attention Access to current password could be lost.
  */
-int updateMasterHash(const QString &password);
+int updateMasterHash(const SessionKey &key);
 
 /**
- * @brief Update crypto parameters file with random salt.
+ * @brief Update crypto parameters file with random salt and interactive limits.
  *
  * @return 0 if successfully updated crypto parameters file; -1 otherwise.
  *
- * File structure:
- * salt      (unsigned char)
- * opslimit  (unsigned long long)
- * memlimit  (size_t)
- * alg       (int)
+ * @see CryptoParams for file structure, rekeyVault() to change parameters of an existing vault.
  *
  * @attention Access to entries file could be lost if called before decryption.
  */
 int updateCryptoParams();
 
 /**
- * @brief Verify if given password corresponds to master password.
+ * @brief Verify master password and derive session key with a single key derivation.
+ *
+ * @param key: Session key to derive.
+ * @param master: Master password to verify.
+ * @return 0 if given password is correct and key is derived; 1 if given password is incorrect; -1 otherwise.
+ *
+ * Legacy master hash files are verified with crypto_pwhash_str_verify(),
+ * and key is derived in legacy mode. Data key is then unwrapped from key file if any (see SessionKey::unwrap()).
+ */
+int unlock(SessionKey &key, const QString &master);
+
+/**
+ * @brief Result of unlockEntries().
+ */
+struct UnlockResult
+{
+    int status = -1;                     // 0 if unlocked; 1 if master password is incorrect; 2 if vault is open in another process; -1 otherwise
+    qint64 unlockTime = 0;               // time (ms) taken by master password verification and key derivation
+    bool rekeyed = false;                // true if data key is new: entries file, key file and master hash must be re-written (see rekeyVault())
+    bool rewrapped = false;              // true if data key is wrapped by a new master password: key file and master hash must be re-written (see rewrapVault())
+    bool outdated = false;               // true if entries file has a previous version and must be re-written
+    std::shared_ptr<SessionKey> key;     // wiped when last reference is released
+    std::shared_ptr<EntryStore> entries; // wiped when last reference is released
+    std::shared_ptr<QLockFile> lock;     // lock of the vault if unlocked, released when last reference is released
+};
+
+/**
+ * @brief Verify master password, read entries and derive new key if needed.
  *
  * @param master: Master password to verify.
- * @return True if given password is correct; False otherwise.
+ * @param newMaster: New master password; same as [master] if unchanged.
+ * @return Status, session key and entries.
+ *
+ * Runs every key derivation and decryption of the unlock sequence, so that it
+ * can be run on a worker thread (blocking, does not use any GUI object).
+ * 0. Vault is locked (VAULT_LOCKFILE), so that no other process reads or writes it until
+ *    [lock] is released: keep it for the whole session. A rekey interrupted after its commit
+ *    point is then completed (see recoverRekey()).
+ * 1. Master password is verified and session key is derived (see unlock()).
+ * 2. Entries file is read.
+ * 3. Key is re-derived from [newMaster] if different from [master], keeping data key;
+ *    legacy keys are re-derived from [master] as non-legacy keys.
+ * 4. A data key is generated if files were encrypted before key files were introduced.
+ * 5. Passwords read from a legacy entries file are sealed with final data key.
+ */
+UnlockResult unlockEntries(const QString &master, const QString &newMaster);
+
+/**
+ * @brief Result of prepareRekey().
+ */
+struct RekeyResult
+{
+    int status = -1;                 // 0 if [key] is derived with [params]; 1 if parameters are already calibrated; -1 otherwise
+    CryptoParams params;             // calibrated parameters, with a new salt (status 0) or current one (status 1)
+    std::shared_ptr<SessionKey> key; // wiped when last reference is released
+};
+
+/**
+ * @brief Calibrate crypto parameters on this machine and derive a new session key with them.
+ *
+ * @param master: Master password of the vault.
+ * @return Status, calibrated parameters and new session key.
+ *
+ * Blocking for several key derivations (see calibrateCryptoParams()), so that it is run on
+ * a worker thread once unlocked. Data key is then re-wrapped with new key by rewrapVault().
+ * If calibrated parameters are the current ones, only calibration time is recorded in crypto
+ * parameters file, so that it is not calibrated again (see cryptoParamsNeedCalibration()).
+ */
+RekeyResult prepareRekey(const QString &master);
+
+/**
+ * @brief Re-write entries file, key file, master hash file and crypto parameters file for a new data key.
+ *
+ * @param key: Session key derived from master password and [params], with a new data key.
+ * @param params: Crypto parameters [key] is derived with.
+ * @param entries: Entries to write.
+ * @return 0 if vault now uses [key]; -1 otherwise, and vault is left untouched.
+ *
+ * 1. Each file is written next to the one it replaces, and flushed to disk.
+ * 2. REKEY_MARKER is created: new files are complete (commit point).
+ * 3. Each file replaces previous one, then journal and REKEY_MARKER are removed.
+ *
+ * Files do not match each other between steps 2 and 3: a crash there is completed
+ * by recoverRekey() before next unlock. Key file only keeps master slot: other slots
+ * wrap previous data key.
+ */
+int rekeyVault(const SessionKey &key, const CryptoParams &params, const EntryStore &entries);
+
+/**
+ * @brief Re-write key file, master hash file and crypto parameters file for a new master key.
+ *
+ * @param key: Session key derived from master password and [params], with current data key.
+ * @param params: Crypto parameters [key] is derived with.
+ * @return 0 if vault now uses [key]; -1 otherwise, and vault is left untouched.
+ *
+ * Data key is only re-wrapped: cost does not depend on the number of entries, and entries
+ * file and journal are kept. Other slots of key file are kept. Files are replaced with the
+ * same commit point as rekeyVault(). ENTRIES_TMPFILE is neither removed nor committed, so that
+ * it may be written by a save at the same time; saves should still be finished first.
  */
-const bool masterIsCorrect(const QString &master);
+int rewrapVault(const SessionKey &key, const CryptoParams &params);
+
+/**
+ * @brief Re-write vault files after unlockEntries(), when its result requires it.
+ *
+ * @param key: Session key of unlockEntries() result.
+ * @param entries: Entries of unlockEntries() result.
+ * @param rekeyed: True if data key is new (see rekeyVault()).
+ * @param rewrapped: True if data key is wrapped by a new master password (see rewrapVault()).
+ * @param outdated: True if entries file has a previous version.
+ * @return 0 if vault files match [key]; -1 otherwise, and vault is left untouched.
+ *
+ * Must be called before any change is saved: journal records are sealed with [key].
+ */
+int updateVault(const SessionKey &key, const EntryStore &entries, const bool rekeyed, const bool rewrapped, const bool outdated);
+
+/**
+ * @brief Complete or discard a rekey interrupted by a crash (see rekeyVault() and rewrapVault()).
+ * @return 0 if vault files match each other; -1 otherwise.
+ */
+int recoverRekey();
 
 /**
  * @brief Generate an unpredictible password from given parameters.
@@ -74,61 +322,167 @@ const bool masterIsCorrect(const QString &master);
  * @param hasUpCase: 1 to insert high case letters; 0 to not.
  * @param hasNumbers: 1 to insert numbers; 0 to not.
  * @param hasSpecials: 1 to insert special characters; 0 to not.
- * @return Unpredictible password.
+ * @return Unpredictible password, containing every selected class if long enough; empty if none is selected.
+ *
+ * @see generatePasswords() to generate several passwords at once.
  */
 QString generatePassword(const int passwordLength, const bool hasLowCase, const bool hasUpCase, const bool hasNumbers, const bool hasSpecials);
 
 /**
- * @brief Generate an encryption/decryption key from password and crypto parameters.
+ * @brief Generate a root key from password and crypto parameters.
  *
  * @param secretKey: Array where key is going to be stored.
  * @param master: Master password used to generate secret key.
  * @return 0 if successfully generated key; -1 otherwise.
  *
- * Crypto parameters are extracted from crypto.params file.
- * File structure:
- * salt\n       (unsigned char, do not forget to cast!)
- * opslimit\n   (unsigned long long)
- * memlimit\n   (int)
- * alg          (int)
+ * Crypto parameters are extracted from crypto parameters file (see readCryptoParams()).
  */
 int generateSecretKey(unsigned char secretKey[], const QString &master);
 
+/**
+ * @brief Generate a root key from password and given crypto parameters.
+ *
+ * @param secretKey: Array where key is going to be stored.
+ * @param master: Master password used to generate secret key.
+ * @param params: Crypto parameters.
+ * @param legacy: True to hash as many UTF-8 bytes of [master] as it has UTF-16 code units, like
+ * legacy files did; whole UTF-8 password is hashed otherwise.
+ * @return 0 if successfully generated key; -1 otherwise.
+ */
+int generateSecretKey(unsigned char secretKey[], const QString &master, const CryptoParams &params, const bool legacy = false);
+
+/**
+ * @brief Header of entries file.
+ */
+struct EntriesHeader
+{
+    int version = 0;      // 0 for legacy files, which have no file header
+    quint16 padding = 0;  // records are padded to a multiple of [padding] bytes (0: no padding)
+    quint8 algorithm = 0; // AEAD sealing blocks (see BlockAlgorithm)
+    unsigned char bytes[ENTRIES_FILEHEADERBYTES] = {0}; // raw file header, authenticated with each block
+    unsigned char streamHeader[crypto_secretstream_xchacha20poly1305_HEADERBYTES] = {0}; // random file id, or stream header of legacy files; also identifies entries file
+};
+
+/**
+ * @brief Parse header of entries file from its first bytes.
+ *
+ * @param data: First bytes of entries file.
+ * @param size: Number of bytes available in [data].
+ * @param header: Header where values are going to be stored.
+ * @param headerLength: Where length of file and stream headers is stored (offset of first block).
+ * @return 0 if successfully parsed header of a supported version; -1 otherwise.
+ */
+int parseEntriesHeader(const unsigned char *data, const size_t size, EntriesHeader &header, size_t &headerLength);
+
+/**
+ * @brief Read header of entries file.
+ *
+ * @param header: Header where values are going to be stored.
+ * @return 0 if successfully read header of a supported version; -1 otherwise.
+ */
+int readEntriesHeader(EntriesHeader &header);
+
 /**
  * @brief Read entries encrypted data from entries file.
  *
- * @param master: Master password used to generate encryption/decryption key.
- * @return List of each line of password file.
+ * @param key: Session key used for decryption.
+ * @param entries: Store where entries are going to be added.
+ * @return 0 if successfully read entries file; -1 otherwise, and [entries] is left unchanged.
+ *
+ * 1. Each index record of entries file is decrypted (see MappedEntries).
+ * 2. Its fields are added to the store as an entry (see ENTRY_SCHEMA), with its sealed password.
+ * 3. Changes saved in journal file since entries file was written are applied (see replayJournal()).
+ *
+ * File structure: blocks are sealed independently (see EntryBlockCipher)
+ * magic          (char, ENTRIES_MAGIC)
+ * version        (quint8, ENTRIES_VERSION)
+ * algorithm      (quint8, BlockAlgorithm)
+ * padding        (quint16, little endian)
+ * file id        (unsigned char, random)
+ * block 1
+ * block 2
+ * ...
+ * end marker     (quint32, 0)
+ * password 1     (quint32 little endian length, then sealed password of record 1)
+ * password 2
+ * ...
+ * file MAC       (unsigned char, BLOCK_MACBYTES)
+ *
+ * Block structure:
+ * length         (quint32, little endian, length of cipher)
+ * cipher         (unsigned char, authenticated with file header)
+ *
+ * Block structure (decrypted): index records packed up to ENTRIES_CHUNK_SIZE bytes
+ * length         (quint32, little endian, length of padded record 1)
+ * padded record 1
+ * length
+ * padded record 2
+ * ...
+ *
+ * Record structure (decrypted, see EntryRecord):
+ * nbFields       (quint8)
+ * field 1        (quint32 little endian length, then UTF-8 characters)
+ * field 2
+ * ...
+ * Fields follow ENTRY_SCHEMA: fields missing from older records are empty, extra fields are ignored.
+ * Password field of index records is empty.
  *
- * 1. Secret key is generated from password and parameters.
- * 2. Each line of password file is decrypted and stored as string.
- * 3. All strings are returned as a list.
+ * Passwords are sealed on their own (see sealPassword()), and written apart from index
+ * records: only names, user names and dates are decrypted at unlock. Sealed passwords are
+ * copied to [entries] as they are, and only opened when needed (see OpenedPassword).
+ * Passwords read from legacy files are plaintext: see sealPasswords().
  *
- * File structure (encrypted):
- * entryname1\tusername1\tpassword1\tdate1\0
+ * File structure (version 0, legacy, read only):
+ * stream header  (unsigned char)
+ * entryname1\tusername1\tpassword1\tdate1\0 (encrypted, padded to LEGACY_ENTRY_MAXLEN)
  * entryname2\tusername2\tpassword2\tdate2\0
- * entryname3\tusername3\tpassword3\tdate3\0
  * ...
  */
-QStringList readEntries(const QString &master);
+int readEntries(const SessionKey &key, EntryStore &entries);
 
 /**
  * @brief Write entries encrypted data to entries file.
  *
- * @return 0 if successfully wrote entries file and entry fields have same number of elements; -1 otherwise.
+ * @param key: Session key used for encryption.
+ * @param entries: Entries to write, in their order, with sealed passwords.
+ * @return 0 if successfully wrote entries file; -1 otherwise.
  *
- * 1. Secret key is generated from password and parameters.
- * 2. Each entry is concanetated as a line.
- * 3. Each line is encrypted.
- * 4. Each encrypted line is written to entries file.
+ * 1. Each entry is encoded as a length-prefixed index record without its password, then padded.
+ * 2. Records are packed into chunks of about ENTRIES_CHUNK_SIZE bytes.
+ * 3. Each chunk is sealed as a block and written to ENTRIES_TMPFILE, followed by sealed
+ *    passwords as they are stored in [entries], then file MAC.
+ * 4. ENTRIES_TMPFILE is flushed to disk, then replaces entries file (see replaceFile()).
+ * 5. Journal file is removed since entries file contains every change.
  *
- * File structure (encrypted):
- * entryname1\tusername1\tpassword1\tdate1\0
- * entryname2\tusername2\tpassword2\tdate2\0
- * entryname3\tusername3\tpassword3\tdate3\0
- * ...
+ * Entries file is left untouched if writing fails or is interrupted.
+ * Entries file is always written with ENTRIES_VERSION (see readEntries() for file structure).
+ * Block algorithm of current entries file is kept if available on this processor; legacy
+ * files get the preferred one (see preferredBlockAlgorithm()).
+ */
+int writeEntries(const SessionKey &key, const EntryStore &entries);
+
+/**
+ * @brief Flush a file to disk, not only to system cache.
+ * @param file: File opened for writing.
+ * @return 0 if successfully flushed file; -1 otherwise.
+ */
+int syncFile(FILE *file);
+
+/**
+ * @brief Replace a file by another one, in a single step.
+ * @param temporaryName: Name of the complete, flushed file.
+ * @param fileName: Name of the file to replace.
+ * @return 0 if [fileName] now has the content of [temporaryName]; -1 otherwise.
+ *
+ * After a crash, [fileName] has either its previous or its new content.
+ */
+int replaceFile(const char *temporaryName, const char *fileName);
+
+/**
+ * @brief Flush entries of working directory to disk, so that created or renamed files survive a crash.
+ * Does nothing on Windows, where replaceFile() writes through.
  */
-int writeEntries(const QString &master, const QStringList &entrynames, const QStringList &usernames, const QStringList &passwords, const QStringList &dates);
+void syncDirectory();
 
 } // namespace pwm
 
@@ -0,0 +1,88 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+// Multi-lane Argon2id against the test vector of RFC 9106 (section 5.3), and single-lane
+// Argon2id against libsodium crypto_pwhash().
+// Usage: pwm_argon2_test (exit status 0 if every check passed)
+
+#include "pwmargon2.h"
+#include "pwmcryptoparams.h"
+
+#include <QCoreApplication>
+#include <cstring>
+#include <stdio.h>
+
+static int failures = 0;
+
+static void check(const bool condition, const char *description)
+{
+    if (condition) return;
+    fprintf(stderr, "FAILED: %s\n", description);
+    ++failures;
+}
+
+int main(int argc, char *argv[])
+{
+    if (sodium_init() == -1) return 1;
+    QCoreApplication application(argc, argv);
+
+    // RFC 9106 section 5.3: t = 3, m = 32 KiB, p = 4, with secret and associated data
+    {
+        unsigned char password[32];
+        unsigned char salt[16];
+        unsigned char secret[8];
+        unsigned char ad[12];
+        unsigned char tag[32];
+        static const unsigned char expected[32] = {
+            0x0d, 0x64, 0x0d, 0xf5, 0x8d, 0x78, 0x76, 0x6c, 0x08, 0xc0, 0x37, 0xa3, 0x4a, 0x8b, 0x53, 0xc9,
+            0xd0, 0x1e, 0xf0, 0x45, 0x2d, 0x75, 0xb6, 0x5e, 0xb5, 0x25, 0x20, 0xe9, 0x6b, 0x01, 0xe6, 0x59
+        };
+
+        memset(password, 0x01, sizeof password);
+        memset(salt, 0x02, sizeof salt);
+        memset(secret, 0x03, sizeof secret);
+        memset(ad, 0x04, sizeof ad);
+
+        check(pwm::argon2id(tag, sizeof tag, password, sizeof password, salt, sizeof salt, 3, 32, 4,
+                            secret, sizeof secret, ad, sizeof ad) == 0
+              && memcmp(tag, expected, sizeof tag) == 0,
+              "4 lanes match RFC 9106 test vector");
+        check(pwm::argon2idSelfTest() == 0, "self-test passes");
+    }
+
+    // Single lane: same key as crypto_pwhash(), over several passes and memory sizes
+    {
+        static const char password[] = "pwm argon2 test";
+        unsigned char salt[crypto_pwhash_SALTBYTES];
+        unsigned char expected[crypto_kdf_KEYBYTES];
+        unsigned char key[crypto_kdf_KEYBYTES];
+        const quint32 costs[][2] = {{1, 64}, {2, 1024}, {3, 4096}}; // passes, KiB
+        randombytes_buf(salt, sizeof salt);
+
+        for (const auto &cost : costs)
+        {
+            const bool derived =
+                crypto_pwhash(expected, sizeof expected, password, strlen(password), salt,
+                              cost[0], static_cast<size_t>(cost[1]) * 1024, crypto_pwhash_ALG_ARGON2ID13) == 0
+                && pwm::argon2id(key, sizeof key, password, strlen(password), salt, sizeof salt, cost[0], cost[1], 1) == 0;
+            check(derived && memcmp(key, expected, sizeof key) == 0, "single lane matches crypto_pwhash()");
+        }
+
+        // Parameters read from crypto parameters file go through the same paths
+        pwm::CryptoParams params;
+        memcpy(params.salt, salt, sizeof salt);
+        params.opslimit = 2;
+        params.memlimit = 1024 * 1024;
+        params.alg = crypto_pwhash_ALG_ARGON2ID13;
+        unsigned char multiLane[crypto_kdf_KEYBYTES];
+        check(pwm::hashPassword(key, sizeof key, password, strlen(password), params) == 0, "single-lane parameters are derived");
+        params.lanes = 4;
+        check(pwm::hashPassword(multiLane, sizeof multiLane, password, strlen(password), params) == 0
+              && memcmp(key, multiLane, sizeof key) != 0,
+              "multi-lane parameters are derived with another key");
+    }
+
+    if (failures != 0) return 1;
+    fprintf(stderr, "Every Argon2id check passed.\n");
+    return 0;
+}
@@ -0,0 +1,120 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+// Journal replay of entries whose names hold separators (tabs, line breaks), of a rename that
+// would give an entry the names of another one, of sealed passwords read back from entries file
+// and journal, and of journals cut or extended after their head.
+// Usage: pwm_journal_test (exit status 0 if every check passed)
+
+#include "pwmsecurity.h"
+#include "pwmjournal.h"
+#include "pwmsealedpassword.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <stdio.h>
+
+static int failures = 0;
+
+static void check(const bool condition, const char *description)
+{
+    if (condition) return;
+    fprintf(stderr, "FAILED: %s\n", description);
+    ++failures;
+}
+
+int main(int argc, char *argv[])
+{
+    if (sodium_init() == -1) return 1;
+    QCoreApplication application(argc, argv);
+
+    // Vault files are written in a directory removed on exit
+    QTemporaryDir vaultDir;
+    if (!vaultDir.isValid() || !QDir::setCurrent(vaultDir.path()))
+    {
+        fprintf(stderr, "Failed to create temporary vault directory.\n");
+        return 1;
+    }
+
+    // Cheapest derivation: journal only needs a data key
+    pwm::CryptoParams params;
+    randombytes_buf(params.salt, sizeof params.salt);
+    params.opslimit = crypto_pwhash_OPSLIMIT_MIN;
+    params.memlimit = crypto_pwhash_MEMLIMIT_MIN;
+    params.alg = crypto_pwhash_ALG_ARGON2ID13;
+
+    pwm::SessionKey key;
+    if (key.derive("journal test", params) != 0 || key.generateDataKey() != 0) return 1;
+
+    QByteArray sealed;
+    if (pwm::sealPassword(key, QString("password"), sealed) != 0) return 1;
+    const QString date = "2025.01.01";
+
+    // Entries file holds a single entry, every other change is journaled
+    pwm::EntryStore entries;
+    entries.add("plain", "user", std::string_view(sealed.constData(), sealed.size()), date);
+    if (pwm::writeEntries(key, entries) != 0) return 1;
+
+    const QString tabName = "tab\tname";
+    const QString tabUser = "user\twith\ttabs";
+    const QString breakName = "line\nbreak\r";
+
+    QVector<pwm::JournalChange> changes;
+    changes.append({pwm::JOURNAL_ADD, {tabName.toUtf8(), tabUser.toUtf8(), sealed, date.toUtf8()}});
+    changes.append({pwm::JOURNAL_ADD, {breakName.toUtf8(), "user", sealed, date.toUtf8()}});
+    changes.append({pwm::JOURNAL_RENAME, {"plain", "user", "renamed\t", "user\t"}});
+    changes.append({pwm::JOURNAL_REGENERATE, {tabName.toUtf8(), tabUser.toUtf8(), sealed, "2025.02.02"}});
+    // Would give an entry the names of another one: skipped on replay
+    changes.append({pwm::JOURNAL_RENAME, {breakName.toUtf8(), "user", tabName.toUtf8(), tabUser.toUtf8()}});
+    check(pwm::appendJournal(key, changes) == 0, "journal records with tabs are appended");
+
+    // Fields must match op
+    check(pwm::appendJournal(key, pwm::JOURNAL_DELETE, {tabName.toUtf8(), tabUser.toUtf8(), sealed}) != 0, "change with extra fields is rejected");
+
+    pwm::EntryStore replayed;
+    check(pwm::readEntries(key, replayed) == 0, "journal with tabs in names is replayed");
+    check(replayed.size() == 3, "replay keeps every entry");
+
+    const pwm::EntryId tabId = replayed.find(tabName, tabUser);
+    check(tabId != ENTRY_NOID, "entry with tabs in names is added");
+    check(tabId != ENTRY_NOID && replayed.field(tabId, pwm::ENTRY_DATE) == "2025.02.02", "entry with tabs in names is regenerated");
+    check(replayed.find(breakName, "user") != ENTRY_NOID, "entry with line breaks in name keeps its names");
+    check(replayed.find(QString("renamed\t"), QString("user\t")) != ENTRY_NOID, "entry is renamed with tabs");
+    check(replayed.find(QString("plain"), QString("user")) == ENTRY_NOID, "renamed entry loses its previous names");
+
+    // Sealed passwords come from password segment of entries file, and from journal records
+    for (const pwm::EntryId id : {replayed.find(QString("renamed\t"), QString("user\t")), tabId})
+    {
+        pwm::OpenedPassword password;
+        check(id != ENTRY_NOID && password.open(key, replayed.view(id, pwm::ENTRY_PASSWORD)) == 0
+              && password.view() == "password",
+              "sealed password is opened after replay");
+    }
+
+    // Delete applies to the right entry
+    check(pwm::appendJournal(key, pwm::JOURNAL_DELETE, {tabName.toUtf8(), tabUser.toUtf8()}) == 0, "delete record is appended");
+    pwm::EntryStore afterDelete;
+    check(pwm::readEntries(key, afterDelete) == 0 && afterDelete.size() == 2
+          && afterDelete.find(tabName, tabUser) == ENTRY_NOID && afterDelete.find(breakName, "user") != ENTRY_NOID,
+          "entry with tabs in names is deleted");
+
+    // Bytes after acknowledged records (interrupted batch) are ignored, then dropped by next append
+    const qint64 acknowledgedSize = QFile("entries.journal").size();
+    QFile journal("entries.journal");
+    check(journal.open(QIODevice::Append) && journal.write("torn record", 11) == 11, "journal is extended");
+    journal.close();
+    pwm::EntryStore afterTornRecord;
+    check(pwm::readEntries(key, afterTornRecord) == 0 && afterTornRecord.size() == 2, "unacknowledged bytes are ignored");
+    check(pwm::appendJournal(key, pwm::JOURNAL_DELETE, {breakName.toUtf8(), "user"}) == 0, "record is appended after unacknowledged bytes");
+
+    // Journal cut at a record boundary would roll back an acknowledged change
+    check(QFile::resize("entries.journal", acknowledgedSize), "journal is cut");
+    pwm::EntryStore afterCut;
+    check(pwm::readEntries(key, afterCut) != 0, "journal cut after its head is rejected");
+
+    if (failures != 0) return 1;
+    fprintf(stderr, "Every journal check passed.\n");
+    return 0;
+}
@@ -0,0 +1,157 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+// Migration of a legacy vault (crypto_pwhash_str() master hash, version 0 entries file) whose
+// master password holds non-ASCII characters, then unlock of the migrated vault.
+// Usage: pwm_legacy_test (exit status 0 if every check passed)
+
+#include "pwmsecurity.h"
+#include "pwmsealedpassword.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cstring>
+#include <stdio.h>
+
+static int failures = 0;
+
+static void check(const bool condition, const char *description)
+{
+    if (condition) return;
+    fprintf(stderr, "FAILED: %s\n", description);
+    ++failures;
+}
+
+/**
+ * @brief Write master hash file as legacy versions did: over as many UTF-8 bytes as UTF-16 code units.
+ * @return 0 if successfully wrote file; -1 otherwise.
+ */
+static int writeLegacyMasterHash(const QString &master)
+{
+    char hash[crypto_pwhash_STRBYTES];
+    const QByteArray utf8 = master.toUtf8();
+
+    if (crypto_pwhash_str(hash, utf8.constData(), master.size(),
+                          crypto_pwhash_OPSLIMIT_MIN, crypto_pwhash_MEMLIMIT_MIN) != 0)
+        return -1;
+
+    FILE * masterHashFile = fopen("master.hash", "wb");
+    if (masterHashFile == NULL) return -1;
+    const size_t hashLength = strlen(hash);
+    const int returnValue = (fwrite(hash, 1, hashLength, masterHashFile) == hashLength) ? 0 : -1;
+    fclose(masterHashFile);
+    return returnValue;
+}
+
+/**
+ * @brief Write a version 0 entries file, encrypted with the legacy root key.
+ * @return 0 if successfully wrote file; -1 otherwise.
+ */
+static int writeLegacyEntries(const QString &master, const pwm::CryptoParams &params, const QStringList &lines)
+{
+    unsigned char rootKey[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+    unsigned char streamHeader[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
+    crypto_secretstream_xchacha20poly1305_state state;
+    int returnValue = -1;
+
+    if (pwm::generateSecretKey(rootKey, master, params, true) != 0) return -1;
+    crypto_secretstream_xchacha20poly1305_init_push(&state, streamHeader, rootKey);
+    sodium_memzero(rootKey, sizeof rootKey);
+
+    FILE * entriesFile = fopen("entries.cipher", "wb");
+    if (entriesFile == NULL) return -1;
+    if (fwrite(streamHeader, 1, sizeof streamHeader, entriesFile) != sizeof streamHeader) goto ret;
+
+    for (int line = 0 ; line < lines.size() ; ++line)
+    {
+        unsigned char entryPlain[LEGACY_ENTRY_MAXLEN] = {0};
+        unsigned char entryCipher[LEGACY_ENTRY_MAXLEN + crypto_secretstream_xchacha20poly1305_ABYTES];
+        const QByteArray latin1 = lines[line].toLatin1();
+        const unsigned char tag = (line == lines.size() - 1) ? crypto_secretstream_xchacha20poly1305_TAG_FINAL : 0;
+
+        memcpy(entryPlain, latin1.constData(), std::min<size_t>(latin1.size(), LEGACY_ENTRY_MAXLEN - 1));
+        crypto_secretstream_xchacha20poly1305_push(&state, entryCipher, NULL, entryPlain, sizeof entryPlain, NULL, 0, tag);
+        if (fwrite(entryCipher, 1, sizeof entryCipher, entriesFile) != sizeof entryCipher) goto ret;
+    }
+
+    returnValue = 0;
+ret:
+    fclose(entriesFile);
+    return returnValue;
+}
+
+int main(int argc, char *argv[])
+{
+    if (sodium_init() == -1) return 1;
+    QCoreApplication application(argc, argv);
+
+    // Vault files are written in a directory removed on exit
+    QTemporaryDir vaultDir;
+    if (!vaultDir.isValid() || !QDir::setCurrent(vaultDir.path()))
+    {
+        fprintf(stderr, "Failed to create temporary vault directory.\n");
+        return 1;
+    }
+
+    // Cheapest derivation: only key handling is checked
+    pwm::CryptoParams params;
+    randombytes_buf(params.salt, sizeof params.salt);
+    params.opslimit = crypto_pwhash_OPSLIMIT_MIN;
+    params.memlimit = crypto_pwhash_MEMLIMIT_MIN;
+    params.alg = crypto_pwhash_ALG_ARGON2ID13;
+
+    // UTF-8 password is longer than its UTF-16 code units: legacy files only hashed its beginning
+    const QString master = QString::fromUtf8("mot de passe \xc3\xa9t\xc3\xa9 \xe2\x82\xac");
+    const QStringList lines = {"site\tuser\tsecret\t2020.01.01", "mail\tme\tother\t2021.02.02"};
+
+    if (pwm::writeCryptoParams(params, CRYPTO_PARAMS_FILE) != 0
+        || writeLegacyMasterHash(master) != 0
+        || writeLegacyEntries(master, params, lines) != 0)
+    {
+        fprintf(stderr, "Failed to write legacy vault.\n");
+        return 1;
+    }
+
+    // First unlock reads legacy files and migrates vault
+    pwm::UnlockResult migration = pwm::unlockEntries(master, master);
+    check(migration.status == 0, "legacy vault is unlocked");
+    check(migration.rekeyed, "legacy vault gets a data key");
+    check(migration.entries->size() == lines.size(), "legacy entries are read");
+    check(migration.status == 0
+          && pwm::updateVault(*migration.key, *migration.entries, migration.rekeyed, migration.rewrapped, migration.outdated) == 0,
+          "legacy vault is migrated");
+
+    // Vault stays locked until its session ends
+    check(pwm::unlockEntries(master, master).status == 2, "vault unlocked in a session is locked");
+    migration.lock.reset();
+
+    // Migrated vault is unlocked by the same password, without legacy mode
+    pwm::UnlockResult unlocked = pwm::unlockEntries(master, master);
+    check(unlocked.status == 0, "migrated vault is unlocked by non-ASCII master password");
+    check(unlocked.status == 0 && !unlocked.key->isLegacy() && !unlocked.rekeyed && !unlocked.outdated,
+          "migrated vault needs no further migration");
+    check(unlocked.entries->size() == lines.size()
+          && unlocked.entries->find(QString("site"), QString("user")) != ENTRY_NOID
+          && unlocked.entries->find(QString("mail"), QString("me")) != ENTRY_NOID,
+          "migrated vault keeps legacy entries");
+
+    // Plaintext passwords of legacy file are sealed, and read back from password segment
+    {
+        pwm::OpenedPassword password;
+        const pwm::EntryId id = unlocked.entries->find(QString("site"), QString("user"));
+        check(id != ENTRY_NOID && password.open(*unlocked.key, unlocked.entries->view(id, pwm::ENTRY_PASSWORD)) == 0
+              && password.view() == "secret",
+              "legacy password is sealed by migration");
+    }
+
+    // Legacy hash could not tell apart passwords sharing their first bytes: migrated one does
+    unlocked.lock.reset();
+    const QString sameBeginning = master.left(master.size() - 1) + "$";
+    check(pwm::unlockEntries(sameBeginning, sameBeginning).status == 1, "migrated vault rejects another password");
+
+    if (failures != 0) return 1;
+    fprintf(stderr, "Every legacy migration check passed.\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+// Copyright (C) 2025 Pierre Desbruns
+// SPDX-License-Identifier: LGPL-3.0-only
+
+// Uniformity of generated characters (see generatePasswords()): a chi-square test over the
+// 94 characters of every class, and over digits only. Modulo bias, which rejection sampling
+// removes, makes some characters up to 50% more likely and fails both tests by far.
+// Usage: pwm_password_test (exit status 0 if every check passed)
+
+#include "pwmpasswordgenerator.h"
+
+#include <QCoreApplication>
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Characters drawn for each test: modulo bias of digits adds about 700 to their chi-square
+#define TEST_DRAWS 2000000
+#define TEST_PASSWORD_LENGTH 20
+// Standard normal quantile of the test threshold: a uniform generator fails once in a million runs
+#define TEST_QUANTILE 4.753
+
+/**
+ * @brief Chi-square critical value with [degrees] degrees of freedom (Wilson-Hilferty approximation).
+ */
+static double chiSquareThreshold(const int degrees)
+{
+    const double variance = 2.0 / (9.0 * degrees);
+    return degrees * std::pow(1.0 - variance + TEST_QUANTILE * std::sqrt(variance), 3);
+}
+
+/**
+ * @brief Generate passwords of given classes, and test that every allowed character is equally likely.
+ * @param name: Name of the test, for its report.
+ * @param characters: Every character allowed by [classes].
+ * @return 0 if characters are allowed ones and pass chi-square test; -1 otherwise.
+ */
+static int testUniformity(const char *name, const unsigned int classes, const char *characters)
+{
+    const int nbCharacters = static_cast<int>(strlen(characters));
+    const int count = TEST_DRAWS / TEST_PASSWORD_LENGTH;
+
+    pwm::PasswordPolicy policy;
+    policy.length = TEST_PASSWORD_LENGTH;
+    policy.classes = classes;
+    policy.everyClass = false; // every password is kept: characters are independent
+
+    std::vector<char> passwords(static_cast<size_t>(count) * policy.length);
+    if (pwm::generatePasswords(policy, count, passwords.data()) != 0)
+    {
+        fprintf(stderr, "FAILED: %s: generation failed.\n", name);
+        return -1;
+    }
+
+    // Occurrences of each character, in [characters] order
+    int index[256];
+    std::fill(std::begin(index), std::end(index), -1);
+    for (int character = 0 ; character < nbCharacters ; ++character)
+        index[static_cast<unsigned char>(characters[character])] = character;
+
+    std::vector<long long> observed(nbCharacters, 0);
+    for (const char character : passwords)
+    {
+        const int position = index[static_cast<unsigned char>(character)];
+        if (position == -1)
+        {
+            fprintf(stderr, "FAILED: %s: unexpected character 0x%02x.\n", name, static_cast<unsigned char>(character));
+            return -1;
+        }
+        ++observed[position];
+    }
+
+    const double expected = static_cast<double>(passwords.size()) / nbCharacters;
+    double chiSquare = 0;
+    for (const long long occurrences : observed)
+        chiSquare += (occurrences - expected) * (occurrences - expected) / expected;
+
+    const double threshold = chiSquareThreshold(nbCharacters - 1);
+    fprintf(stderr, "%s: %d characters, %zu draws, chi-square %.1f (threshold %.1f).\n",
+            name, nbCharacters, passwords.size(), chiSquare, threshold);
+
+    if (chiSquare > threshold)
+    {
+        fprintf(stderr, "FAILED: %s: characters are not uniformly distributed.\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (sodium_init() == -1) return 1;
+    QCoreApplication application(argc, argv);
+
+    // Printable ASCII, space excluded
+    char printable[PASSWORD_MAXCHARACTERS + 1];
+    for (int character = 0 ; character < PASSWORD_MAXCHARACTERS ; ++character)
+        printable[character] = static_cast<char>('!' + character);
+    printable[PASSWORD_MAXCHARACTERS] = '\0';
+
+    const unsigned int everyClass = pwm::PASSWORD_LOWCASE | pwm::PASSWORD_UPCASE | pwm::PASSWORD_NUMBERS | pwm::PASSWORD_SPECIALS;
+    int failures = 0;
+    if (testUniformity("every class", everyClass, printable) != 0) ++failures;
+    if (testUniformity("numbers", pwm::PASSWORD_NUMBERS, "0123456789") != 0) ++failures;
+
+    if (failures != 0) return 1;
+    fprintf(stderr, "Every password check passed.\n");
+    return 0;
+}